@@ -4,15 +4,37 @@
 #include <string>
 #include <cstdlib>
 
+// 把参数原样交给 shell：整体放进单引号，参数中的 ' 写成 '\''
+static std::string shellQuote(const std::string &arg) {
+    std::string quoted = "'";
+    for (char c : arg) {
+        if (c == '\'') {
+            quoted += "'\\''";
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "'";
+}
 
-int main() {
+int main(int argc, char *argv[]) {
     try {
+        // 命令行参数原样转发给 back；-g 需要 front 同时输出源码位置
+        std::string frontArgs;
+        std::string backArgs;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-g") {
+                frontArgs += " --loc";
+            }
+            backArgs += " " + shellQuote(arg);
+        }
         // 直接将标准输入内容通过管道传递给 front，再传递给 back
         std::string command;
 #ifdef _WIN32
-        command = "type nul | front.exe | back.exe"; // Windows下可用方式（需调整）
+        command = "type nul | front.exe" + frontArgs + " | back.exe" + backArgs; // Windows下可用方式（需调整）
 #else
-        command = "cat - | ./front | ./back";
+        command = "cat - | ./front" + frontArgs + " | ./back" + backArgs;
 #endif
         
         // 使用 popen 读取 back 的标准输出并由 compiler 输出
@@ -13,10 +13,22 @@ enum class BinOp {
 enum class UnOp {
     Neg, Not
 };
+// Position of a node in the ToyC source, line 0 means unknown
+struct SourcePos {
+    int line = 0;
+    int col = 0;
+};
 // Base class for all expressions
 class Expr{
 public:
+    SourcePos pos;
     virtual ~Expr() = default;//use default destructor
+    // Copy this node's source position onto a rebuilt node
+    template <typename T>
+    std::unique_ptr<T> withPos(std::unique_ptr<T> node) const {
+        node->pos = pos;
+        return node;
+    }
     virtual std::unique_ptr<Expr> foldConstants() {
         return nullptr; // Default implementation does nothing
     }
@@ -28,7 +40,7 @@ public:
         : value(v) {}
     int value;
     std::unique_ptr<Expr> foldConstants() override {
-        return std::make_unique<IntLit>(value); // Return itself as it is already constant
+        return withPos(std::make_unique<IntLit>(value)); // Return itself as it is already constant
     }
 };
 
@@ -38,7 +50,7 @@ public:
         : name(n) {}
     std::string name;
     std::unique_ptr<Expr> foldConstants() override {
-        return std::make_unique<Var>(name); // Return itself as it is a variable
+        return withPos(std::make_unique<Var>(name)); // Return itself as it is a variable
     }
 };
 
@@ -93,11 +105,11 @@ public:
                     case BinOp::Or: result = (leftLit->value != 0 || rightLit->value != 0) ? 1 : 0;
                         break;
                 }
-                return std::make_unique<IntLit>(result);
+                return withPos(std::make_unique<IntLit>(result));
             }
         }
         // If we can't fold constants, return a new BinOpExpr with folded children
-        return std::make_unique<BinOpExpr>(std::move(leftFolded), op, std::move(rightFolded));
+        return withPos(std::make_unique<BinOpExpr>(std::move(leftFolded), op, std::move(rightFolded)));
     }   
 };
 
@@ -118,10 +130,10 @@ public:
                 case UnOp::Not: result = (rightLit->value == 0) ? 1 : 0;
                     break;
             }
-            return std::make_unique<IntLit>(result);
+            return withPos(std::make_unique<IntLit>(result));
         }
         // If we can't fold constants, return a new UnOpExpr with folded child
-        return std::make_unique<UnOpExpr>(op, std::move(rightFolded));
+        return withPos(std::make_unique<UnOpExpr>(op, std::move(rightFolded)));
     }
 };
 
@@ -139,16 +151,23 @@ public:
             auto folded = arg->foldConstants();
             foldedArgs.push_back(folded ? std::move(folded) : std::move(arg));
         }
-        return std::make_unique<Call>(name, std::move(foldedArgs));
+        return withPos(std::make_unique<Call>(name, std::move(foldedArgs)));
     }
 };
 
 //Base class for all statements
 class Stmt {
 public:
+    SourcePos pos;
     // 活跃变量分析结果：该语句结点的活跃变量集合
     std::vector<std::string> liveVars;
     virtual ~Stmt() = default;
+    // Copy this node's source position onto a rebuilt node
+    template <typename T>
+    std::unique_ptr<T> withPos(std::unique_ptr<T> node) const {
+        node->pos = pos;
+        return node;
+    }
     // Default implementation does nothing
     virtual std::unique_ptr<Stmt> foldConstants() {
         return nullptr; // Default implementation does nothing
@@ -171,7 +190,7 @@ public:
                 foldedStmts.push_back(std::move(folded));
             }
         }
-        return std::make_unique<Block>(std::move(foldedStmts));
+        return withPos(std::make_unique<Block>(std::move(foldedStmts)));
     }
 };
 
@@ -179,7 +198,7 @@ class EmptyStmt : public Stmt {
 public:
     EmptyStmt() = default;
     std::unique_ptr<Stmt> foldConstants() override {
-        return std::make_unique<EmptyStmt>(); // Return itself as it is an empty statement
+        return withPos(std::make_unique<EmptyStmt>()); // Return itself as it is an empty statement
     }
 };
 
@@ -192,9 +211,9 @@ public:
     std::unique_ptr<Stmt> foldConstants() override {
         auto foldedExpr = expr->foldConstants();
         if (foldedExpr) {
-            return std::make_unique<ExprStmt>(std::move(foldedExpr));
+            return withPos(std::make_unique<ExprStmt>(std::move(foldedExpr)));
         }
-        return std::make_unique<ExprStmt>(std::move(expr)); // Return itself if no folding occurred
+        return withPos(std::make_unique<ExprStmt>(std::move(expr))); // Return itself if no folding occurred
     }
 };
 
@@ -207,9 +226,9 @@ public:
     std::unique_ptr<Stmt> foldConstants() override {
         auto foldedValue = value->foldConstants();
         if (foldedValue) {
-            return std::make_unique<Assign>(name, std::move(foldedValue));
+            return withPos(std::make_unique<Assign>(name, std::move(foldedValue)));
         }
-        return std::make_unique<Assign>(name, std::move(value)); // Return itself
+        return withPos(std::make_unique<Assign>(name, std::move(value))); // Return itself
     }
 };
 
@@ -222,9 +241,9 @@ public:
     std::unique_ptr<Stmt> foldConstants() override {
         auto foldedValue = value ? value->foldConstants() : nullptr;
         if (foldedValue) {
-            return std::make_unique<Decl>(name, std::move(foldedValue));
+            return withPos(std::make_unique<Decl>(name, std::move(foldedValue)));
         }
-        return std::make_unique<Decl>(name, std::move(value)); // Return itself
+        return withPos(std::make_unique<Decl>(name, std::move(value))); // Return itself
     }
 };
 
@@ -243,11 +262,11 @@ public:
         auto condFolded = condition ? condition->foldConstants() : nullptr;
         auto thenFolded = thenBody ? thenBody->foldConstants() : nullptr;
         auto elseFolded = elseBody ? elseBody->foldConstants() : nullptr;
-        return std::make_unique<If>(
+        return withPos(std::make_unique<If>(
             condFolded ? std::move(condFolded) : std::move(condition),
             thenFolded ? std::move(thenFolded) : std::move(thenBody),
             elseFolded ? std::move(elseFolded) : (elseBody ? std::move(elseBody) : nullptr)
-        );
+        ));
     }
 };
 
@@ -263,10 +282,10 @@ public:
     std::unique_ptr<Stmt> foldConstants() override {
         auto condFolded = condition ? condition->foldConstants() : nullptr;
         auto bodyFolded = body ? body->foldConstants() : nullptr;
-        return std::make_unique<While>(
+        return withPos(std::make_unique<While>(
             condFolded ? std::move(condFolded) : std::move(condition),
             bodyFolded ? std::move(bodyFolded) : std::move(body)
-        );
+        ));
     }
 };
 
@@ -274,14 +293,14 @@ class Break : public Stmt {
 public:
     Break() = default;
     std::unique_ptr<Stmt> foldConstants() override {
-        return std::make_unique<Break>();
+        return withPos(std::make_unique<Break>());
     }
 };
 class Continue : public Stmt {
 public:
     Continue() = default;
     std::unique_ptr<Stmt> foldConstants() override {
-        return std::make_unique<Continue>();
+        return withPos(std::make_unique<Continue>());
     }
 };
 class Return : public Stmt {
@@ -292,7 +311,7 @@ public:
         : returnValue(std::move(value)) {}
     std::unique_ptr<Stmt> foldConstants() override {
         auto foldedValue = returnValue ? returnValue->foldConstants() : nullptr;
-        return std::make_unique<Return>(foldedValue ? std::move(foldedValue) : (returnValue ? std::move(returnValue) : nullptr));
+        return withPos(std::make_unique<Return>(foldedValue ? std::move(foldedValue) : (returnValue ? std::move(returnValue) : nullptr)));
     }
 };
 //return type
@@ -302,6 +321,7 @@ enum class RetType {
 
 class FuncDef {
 public:
+    SourcePos pos;
     std::string name;
     RetType rtype;
     std::vector<std::string> args;
@@ -313,7 +333,9 @@ public:
 
     std::unique_ptr<FuncDef> foldConstants(){
         auto foldedBody = body ? body->foldConstants() : nullptr;
-        return std::make_unique<FuncDef>(name, rtype, args, foldedBody ? std::move(foldedBody) : (body ? std::move(body) : nullptr));
+        auto folded = std::make_unique<FuncDef>(name, rtype, args, foldedBody ? std::move(foldedBody) : (body ? std::move(body) : nullptr));
+        folded->pos = pos;
+        return folded;
     }
 };
 class Program {
@@ -115,6 +115,29 @@ void ASTParser::skipToNextLine() {
     } else {
         currentLine.clear(); // End of file
     }
+    extractLinePosition();
+}
+// Strip an optional " @line:col" source position from the end of the current line
+void ASTParser::extractLinePosition() {
+    currentLinePos = SourcePos();
+    size_t end = currentLine.find_last_not_of(" \t\r");
+    size_t at = currentLine.rfind('@');
+    if (end == std::string::npos || at == std::string::npos || at >= end) {
+        return;
+    }
+    std::string suffix = currentLine.substr(at + 1, end - at);
+    size_t colon = suffix.find(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 >= suffix.size()) {
+        return;
+    }
+    for (size_t i = 0; i < suffix.size(); i++) {
+        if (i != colon && !isdigit(suffix[i])) {
+            return;
+        }
+    }
+    currentLinePos.line = std::stoi(suffix.substr(0, colon));
+    currentLinePos.col = std::stoi(suffix.substr(colon + 1));
+    currentLine.erase(at);
 }
 
 std::string ASTParser::readKeyword() {
@@ -261,6 +284,7 @@ std::unique_ptr<Program> ASTParser::parseProgram() {
 }
 std::unique_ptr<FuncDef> ASTParser::parseFunction() {
     try {
+        SourcePos funcPos = currentLinePos;
         skipWhitespace();
         // Function name
         std::string funcName = readIdentifier();
@@ -283,7 +307,9 @@ std::unique_ptr<FuncDef> ASTParser::parseFunction() {
         if (!body) {
             error("Function body cannot be empty");
         }
-        return std::make_unique<FuncDef>(funcName, retType, std::move(params), std::move(body));
+        auto funcDef = std::make_unique<FuncDef>(funcName, retType, std::move(params), std::move(body));
+        funcDef->pos = funcPos;
+        return funcDef;
     } catch (const std::exception& e) {
         throw;
     }
@@ -339,36 +365,39 @@ std::vector<std::string> ASTParser::parseParameters() {
 }
 std::unique_ptr<Stmt> ASTParser::parseStatement() {
     skipWhitespace();
+    SourcePos pos = currentLinePos;
     std::string keyword = readKeyword();
     
+    std::unique_ptr<Stmt> stmt;
     try {
         if (keyword == "Block") {
-            return parseBlock();
+            stmt = parseBlock();
         } else if (keyword == "Decl") {
-            return parseDecl();
+            stmt = parseDecl();
         } else if (keyword == "Assign") {
-            return parseAssign();
+            stmt = parseAssign();
         } else if (keyword == "If") {
-            return parseIf();
+            stmt = parseIf();
         } else if (keyword == "While") {
-            return parseWhile();
+            stmt = parseWhile();
         } else if (keyword == "Return") {
-            return parseReturn();
+            stmt = parseReturn();
         } else if (keyword == "Break") {
-            return parseBreak();
+            stmt = parseBreak();
         } else if (keyword == "Continue") {
-            return parseContinue();
+            stmt = parseContinue();
         } else if (keyword == "ExprStmt") {
-            return parseExprStmt();
+            stmt = parseExprStmt();
         } else if (keyword == "EmptyStmt") {
-            return parseEmptyStmt();
+            stmt = parseEmptyStmt();
         } else {
             error("Unknown statement type: " + keyword);
         }
     } catch (const std::exception& e) {
         throw;
     }
-    return nullptr; // This line will never be reached due to error handling
+    stmt->pos = pos;
+    return stmt;
 }
 std::unique_ptr<Block> ASTParser::parseBlock() {
     try {
@@ -446,6 +475,9 @@ std::unique_ptr<Assign> ASTParser::parseAssign() {
 
 std::unique_ptr<If> ASTParser::parseIf() {
     try {
+        // Else of this If is indented deeper than the If line; an Else at the
+        // same or lower indent belongs to an enclosing If
+        int ifIndent = getCurrentIndentLevel();
         skipToNextLine();
         if(matchKeyword("Condition")){
             skipToNextLine();
@@ -465,9 +497,13 @@ std::unique_ptr<If> ASTParser::parseIf() {
         // Parse then branch
         std::unique_ptr<Stmt> thenBranch = parseStatement();
         
+        // A non-block then branch leaves us on its last, fully consumed line
+        if (isAtEndOfLine() && !currentLine.empty()) {
+            skipToNextLine();
+        }
         // Check for else branch (optional)
         std::unique_ptr<Stmt> elseBranch = nullptr;
-        if (matchKeyword("Else")) {
+        if (getCurrentIndentLevel() > ifIndent && matchKeyword("Else")) {
             skipToNextLine();
             elseBranch = parseStatement();
         }
@@ -515,6 +551,9 @@ std::unique_ptr<Return> ASTParser::parseReturn() {
         
         // Parse return value (optional)
         std::unique_ptr<Expr> returnValue = nullptr;
+        if (matchSymbol("(void)")) {
+            return std::make_unique<Return>();
+        }
         if (!isAtEndOfLine()) {
             returnValue = parseExpression();
         }
@@ -551,26 +590,29 @@ std::unique_ptr<EmptyStmt> ASTParser::parseEmptyStmt() {
 // Expression parsing methods
 std::unique_ptr<Expr> ASTParser::parseExpression() {
     skipWhitespace();
+    SourcePos pos = currentLinePos;
     std::string Keyword = readKeyword();
     
+    std::unique_ptr<Expr> expr;
     try {
         if (Keyword == "IntLit") {
-            return parseIntLit();
+            expr = parseIntLit();
         } else if (Keyword == "Var") {
-            return parseVar();
+            expr = parseVar();
         } else if (Keyword == "Call") {
-            return parseCall();
+            expr = parseCall();
         } else if (Keyword == "Binop") {
-            return parseBinOpExpr();
+            expr = parseBinOpExpr();
         } else if (Keyword == "Unop") {
-            return parseUnOpExpr();
+            expr = parseUnOpExpr();
         } else {
             error("Unknown expression type: " + Keyword);
         }
     } catch (const std::exception& e) {
         throw;
     }
-    return nullptr;
+    expr->pos = pos;
+    return expr;
 }
 
 std::unique_ptr<IntLit> ASTParser::parseIntLit() {
@@ -601,6 +643,9 @@ std::unique_ptr<Var> ASTParser::parseVar() {
 
 std::unique_ptr<Call> ASTParser::parseCall() {
     try {
+        // Args of this call are indented deeper than the Call line; an Arg[n]
+        // at the same or lower indent belongs to an enclosing call
+        int callIndent = getCurrentIndentLevel();
         expectSymbol("(");
         skipWhitespace();
         std::string funcName = readIdentifier();
@@ -610,12 +655,14 @@ std::unique_ptr<Call> ASTParser::parseCall() {
         
         std::vector<std::unique_ptr<Expr>> args;
         int argIndex = 0;
-        // int baseIndent = getCurrentIndentLevel();
         while (!inputStream->eof()) {
             if (isAtEndOfLine() || currentLine.empty()) {
                 skipToNextLine();
                 continue;
             }
+            if (getCurrentIndentLevel() <= callIndent) {
+                break;
+            }
             // Look for Arg[n]: pattern
             std::string expectedArg = "Arg[" + std::to_string(argIndex) + "]";
             if (matchKeyword(expectedArg)) {
@@ -821,6 +868,7 @@ ASTParser::ASTParser(const std::string& filename){
     if (std::getline(*inputStream, currentLine)) {
         currentPos = 0;
     }
+    extractLinePosition();
 }
 
 ASTParser::ASTParser(std::istream& input) {
@@ -834,6 +882,7 @@ ASTParser::ASTParser(std::istream& input) {
     if (std::getline(*inputStream, currentLine)) {
         currentPos = 0;
     }
+    extractLinePosition();
 }
 
 ASTParser::~ASTParser() {
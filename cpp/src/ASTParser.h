@@ -18,10 +18,12 @@ private:
     std::string currentLine;
     size_t currentPos;
     int currentLineNumber;
+    SourcePos currentLinePos; // "@line:col" suffix of the current line, if any
     
     // Helper methods for parsing
     void skipWhitespace();
     void skipToNextLine();
+    void extractLinePosition();
     std::string readKeyword();
     std::string readIdentifier();
     std::string readSymbol();
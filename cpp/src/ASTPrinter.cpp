@@ -0,0 +1,171 @@
+#include "ASTPrinter.h"
+#include <stdexcept>
+
+static const char *binOpText(BinOp op)
+{
+    static const char *names[] = {"+", "-", "*", "/", "%", "<", ">", "<=", ">=", "==", "!=", "&&", "||"};
+    return names[static_cast<int>(op)];
+}
+
+void ASTPrinter::printPos(const SourcePos &pos)
+{
+    if (pos.line > 0)
+    {
+        output << " @" << pos.line << ":" << pos.col;
+    }
+    output << "\n";
+}
+
+void ASTPrinter::printExpr(const Expr &expr, const std::string &indent)
+{
+    if (auto lit = dynamic_cast<const IntLit *>(&expr))
+    {
+        output << indent << "IntLit(" << lit->value << ")";
+        printPos(expr.pos);
+    }
+    else if (auto var = dynamic_cast<const Var *>(&expr))
+    {
+        output << indent << "Var(" << var->name << ")";
+        printPos(expr.pos);
+    }
+    else if (auto bin = dynamic_cast<const BinOpExpr *>(&expr))
+    {
+        output << indent << "Binop";
+        printPos(expr.pos);
+        output << indent << "  Operator " << binOpText(bin->op) << "\n";
+        output << indent << "  Left\n";
+        printExpr(*bin->left, indent + "    ");
+        output << indent << "  Right\n";
+        printExpr(*bin->right, indent + "    ");
+    }
+    else if (auto un = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        output << indent << "Unop(" << (un->op == UnOp::Neg ? "-" : "!") << ")";
+        printPos(expr.pos);
+        printExpr(*un->right, indent + "  ");
+    }
+    else if (auto call = dynamic_cast<const Call *>(&expr))
+    {
+        output << indent << "Call(" << call->name << ")";
+        printPos(expr.pos);
+        for (size_t i = 0; i < call->args.size(); i++)
+        {
+            output << indent << "  Arg[" << i << "]\n";
+            printExpr(*call->args[i], indent + "    ");
+        }
+    }
+    else
+    {
+        throw std::runtime_error("Unknown expression type");
+    }
+}
+
+void ASTPrinter::printStmt(const Stmt &stmt, const std::string &indent)
+{
+    if (auto block = dynamic_cast<const Block *>(&stmt))
+    {
+        output << indent << "Block";
+        printPos(stmt.pos);
+        for (const auto &s : block->stmts)
+        {
+            printStmt(*s, indent + "  ");
+        }
+    }
+    else if (auto assign = dynamic_cast<const Assign *>(&stmt))
+    {
+        output << indent << "Assign(" << assign->name << ")";
+        printPos(stmt.pos);
+        printExpr(*assign->value, indent + "  ");
+    }
+    else if (auto decl = dynamic_cast<const Decl *>(&stmt))
+    {
+        output << indent << "Decl(" << decl->name << ")";
+        printPos(stmt.pos);
+        if (decl->value)
+        {
+            printExpr(*decl->value, indent + "  ");
+        }
+    }
+    else if (auto ifStmt = dynamic_cast<const If *>(&stmt))
+    {
+        output << indent << "If:";
+        printPos(stmt.pos);
+        output << indent << "  Condition\n";
+        printExpr(*ifStmt->condition, indent + "    ");
+        output << indent << "  Then\n";
+        printStmt(*ifStmt->thenBody, indent + "    ");
+        if (ifStmt->elseBody)
+        {
+            output << indent << "  Else\n";
+            printStmt(*ifStmt->elseBody, indent + "    ");
+        }
+    }
+    else if (auto whileStmt = dynamic_cast<const While *>(&stmt))
+    {
+        output << indent << "While";
+        printPos(stmt.pos);
+        output << indent << "  Condition\n";
+        printExpr(*whileStmt->condition, indent + "    ");
+        output << indent << "  Body\n";
+        printStmt(*whileStmt->body, indent + "    ");
+    }
+    else if (auto ret = dynamic_cast<const Return *>(&stmt))
+    {
+        output << indent << "Return";
+        printPos(stmt.pos);
+        if (ret->returnValue)
+        {
+            printExpr(*ret->returnValue, indent + "  ");
+        }
+        else
+        {
+            output << indent << "  (void)\n";
+        }
+    }
+    else if (auto exprStmt = dynamic_cast<const ExprStmt *>(&stmt))
+    {
+        output << indent << "ExprStmt";
+        printPos(stmt.pos);
+        printExpr(*exprStmt->expr, indent + "  ");
+    }
+    else if (dynamic_cast<const Break *>(&stmt))
+    {
+        output << indent << "Break";
+        printPos(stmt.pos);
+    }
+    else if (dynamic_cast<const Continue *>(&stmt))
+    {
+        output << indent << "Continue";
+        printPos(stmt.pos);
+    }
+    else if (dynamic_cast<const EmptyStmt *>(&stmt))
+    {
+        output << indent << "EmptyStmt";
+        printPos(stmt.pos);
+    }
+    else
+    {
+        throw std::runtime_error("Unknown statement type");
+    }
+}
+
+void ASTPrinter::print(const Program &program)
+{
+    for (const auto &func : program.functions)
+    {
+        output << "Function " << func->name << " (returns " << (func->rtype == RetType::Int ? "int" : "void") << ")";
+        printPos(func->pos);
+        output << "Parameters [";
+        for (size_t i = 0; i < func->args.size(); i++)
+        {
+            output << (i ? "; " : "") << func->args[i];
+        }
+        output << "]\n";
+        output << "Body\n";
+        if (func->body)
+        {
+            printStmt(*func->body, "  ");
+        }
+        output << "\n";
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include "ASTNode.h"
+
+// Prints an AST in the same indented text format the front end produces,
+// so the output can be fed back into back. Known source positions are
+// written as " @line:col" suffixes.
+class ASTPrinter
+{
+private:
+    std::ostream &output;
+
+    void printPos(const SourcePos &pos);
+    void printExpr(const Expr &expr, const std::string &indent);
+    void printStmt(const Stmt &stmt, const std::string &indent);
+
+public:
+    ASTPrinter(std::ostream &out) : output(out) {}
+    void print(const Program &program);
+};
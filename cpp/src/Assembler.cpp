@@ -0,0 +1,1096 @@
+#include "Assembler.h"
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+    const uint32_t OP_LUI = 0x37, OP_AUIPC = 0x17, OP_JAL = 0x6f, OP_JALR = 0x67, OP_BRANCH = 0x63, OP_LOAD = 0x03,
+                   OP_STORE = 0x23, OP_IMM = 0x13, OP_REG = 0x33, OP_SYSTEM = 0x73;
+    const uint32_t NOP = 0x00000013; // addi x0, x0, 0
+    const int RA = 1;
+
+    uint32_t encodeR(uint32_t funct7, int rs2, int rs1, uint32_t funct3, int rd)
+    {
+        return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | OP_REG;
+    }
+    uint32_t encodeI(uint32_t opcode, int32_t imm, int rs1, uint32_t funct3, int rd)
+    {
+        return (static_cast<uint32_t>(imm) & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+    }
+    uint32_t encodeS(int32_t imm, int rs2, int rs1, uint32_t funct3)
+    {
+        uint32_t u = static_cast<uint32_t>(imm);
+        return ((u >> 5) & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (u & 0x1f) << 7 | OP_STORE;
+    }
+    uint32_t branchOffset(int32_t offset)
+    {
+        uint32_t u = static_cast<uint32_t>(offset);
+        return ((u >> 12) & 1) << 31 | ((u >> 5) & 0x3f) << 25 | ((u >> 1) & 0xf) << 8 | ((u >> 11) & 1) << 7;
+    }
+    uint32_t encodeJ(int rd, int32_t offset)
+    {
+        uint32_t u = static_cast<uint32_t>(offset);
+        return ((u >> 20) & 1) << 31 | ((u >> 1) & 0x3ff) << 21 | ((u >> 11) & 1) << 20 | ((u >> 12) & 0xff) << 12 |
+               rd << 7 | OP_JAL;
+    }
+    uint32_t encodeU(uint32_t opcode, uint32_t upper, int rd) { return (upper & 0xfffff) << 12 | rd << 7 | opcode; }
+    bool fitsI(int64_t v) { return v >= -2048 && v <= 2047; }
+    // Split a pc-relative or absolute value into the auipc/lui part and the signed low 12 bits
+    void splitHiLo(int32_t value, uint32_t &hi, int32_t &lo)
+    {
+        hi = (static_cast<uint32_t>(value) + 0x800) >> 12;
+        lo = static_cast<int32_t>(static_cast<uint32_t>(value) - (hi << 12));
+    }
+
+    // RVC: registers x8-x15 are reachable from the 3-bit fields
+    const char *const abiNames[32] = {"zero", "ra", "sp", "gp", "tp",  "t0",  "t1", "t2", "s0", "s1", "a0",
+                                      "a1",   "a2", "a3", "a4", "a5",  "a6",  "a7", "s2", "s3", "s4", "s5",
+                                      "s6",   "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+    bool isCReg(int r) { return r >= 8 && r <= 15; }
+    bool fits6(int32_t v) { return v >= -32 && v <= 31; }
+    uint32_t bit(uint32_t value, int from, int to) { return ((value >> from) & 1) << to; }
+    uint16_t cFormatCI(uint32_t funct3, int rd, int32_t imm6, uint32_t op)
+    {
+        uint32_t u = static_cast<uint32_t>(imm6);
+        return static_cast<uint16_t>(funct3 << 13 | bit(u, 5, 12) | rd << 7 | (u & 0x1f) << 2 | op);
+    }
+    uint16_t cFormatCR(uint32_t funct4, int rd, int rs2)
+    {
+        return static_cast<uint16_t>(funct4 << 12 | rd << 7 | rs2 << 2 | 2);
+    }
+    // c.lw/c.sw: offset[5:3] at 12:10, offset[2] at 6, offset[6] at 5
+    uint16_t cFormatCLS(uint32_t funct3, int rs1, int r, int32_t offset)
+    {
+        uint32_t u = static_cast<uint32_t>(offset);
+        return static_cast<uint16_t>(funct3 << 13 | ((u >> 3) & 7) << 10 | (rs1 - 8) << 7 | bit(u, 2, 6) |
+                                     bit(u, 6, 5) | (r - 8) << 2);
+    }
+    uint16_t cJump(uint32_t funct3, int32_t offset)
+    {
+        uint32_t u = static_cast<uint32_t>(offset);
+        return static_cast<uint16_t>(funct3 << 13 | bit(u, 11, 12) | bit(u, 4, 11) | ((u >> 8) & 3) << 9 |
+                                     bit(u, 10, 8) | bit(u, 6, 7) | bit(u, 7, 6) | ((u >> 1) & 7) << 3 |
+                                     bit(u, 5, 2) | 1);
+    }
+    uint16_t cBranch(uint32_t funct3, int rs1, int32_t offset)
+    {
+        uint32_t u = static_cast<uint32_t>(offset);
+        return static_cast<uint16_t>(funct3 << 13 | bit(u, 8, 12) | ((u >> 3) & 3) << 10 | (rs1 - 8) << 7 |
+                                     ((u >> 6) & 3) << 5 | ((u >> 1) & 3) << 3 | bit(u, 5, 2) | 1);
+    }
+
+    // Pick the 16-bit encoding of a base instruction if its operands fit one
+    bool compressWord(uint32_t word, uint16_t &half, std::string &spelling)
+    {
+        uint32_t opcode = word & 0x7f, funct3 = (word >> 12) & 7, funct7 = word >> 25;
+        int rd = (word >> 7) & 31, rs1 = (word >> 15) & 31, rs2 = (word >> 20) & 31;
+        int32_t immI = static_cast<int32_t>(word) >> 20;
+        int32_t immS = (static_cast<int32_t>(word) >> 25) << 5 | static_cast<int32_t>((word >> 7) & 0x1f);
+        auto name = [](int r) { return std::string(abiNames[r]); };
+        auto set = [&](uint32_t h, const std::string &text) {
+            half = static_cast<uint16_t>(h);
+            spelling = text;
+            return true;
+        };
+        if (word == 0x00100000 + OP_SYSTEM)
+        {
+            return set(0x9002, "c.ebreak");
+        }
+        if (opcode == OP_IMM && funct3 == 0)
+        {
+            if (rd == 0 && rs1 == 0 && immI == 0)
+                return set(0x0001, "c.nop");
+            if (rd == 0)
+                return false;
+            if (rs1 == 0 && fits6(immI))
+                return set(cFormatCI(2, rd, immI, 1), "c.li " + name(rd) + ", " + std::to_string(immI));
+            if (immI == 0 && rs1 != 0)
+                return set(cFormatCR(8, rd, rs1), "c.mv " + name(rd) + ", " + name(rs1));
+            if (rd == 2 && rs1 == 2 && immI % 16 == 0 && immI >= -512 && immI <= 496)
+            {
+                uint32_t u = static_cast<uint32_t>(immI);
+                return set(3 << 13 | bit(u, 9, 12) | 2 << 7 | bit(u, 4, 6) | bit(u, 6, 5) | ((u >> 7) & 3) << 3 |
+                               bit(u, 5, 2) | 1,
+                           "c.addi16sp sp, " + std::to_string(immI));
+            }
+            if (rd == rs1 && fits6(immI))
+                return set(cFormatCI(0, rd, immI, 1), "c.addi " + name(rd) + ", " + std::to_string(immI));
+            if (isCReg(rd) && rs1 == 2 && immI > 0 && immI % 4 == 0 && immI <= 1020)
+            {
+                uint32_t u = static_cast<uint32_t>(immI);
+                return set(((u >> 4) & 3) << 11 | ((u >> 6) & 0xf) << 7 | bit(u, 2, 6) | bit(u, 3, 5) | (rd - 8) << 2,
+                           "c.addi4spn " + name(rd) + ", sp, " + std::to_string(immI));
+            }
+            return false;
+        }
+        if (opcode == OP_IMM && funct3 == 7 && rd == rs1 && isCReg(rd) && fits6(immI))
+        {
+            return set(4 << 13 | bit(static_cast<uint32_t>(immI), 5, 12) | 2 << 10 | (rd - 8) << 7 |
+                           (static_cast<uint32_t>(immI) & 0x1f) << 2 | 1,
+                       "c.andi " + name(rd) + ", " + std::to_string(immI));
+        }
+        if (opcode == OP_IMM && (funct3 == 1 || funct3 == 5) && rd == rs1 && rd != 0 && rs2 != 0)
+        {
+            if (funct3 == 1)
+                return set(cFormatCI(0, rd, rs2, 2), "c.slli " + name(rd) + ", " + std::to_string(rs2));
+            if (!isCReg(rd))
+                return false;
+            bool arithmetic = funct7 == 0x20;
+            return set(4 << 13 | (arithmetic ? 1 : 0) << 10 | (rd - 8) << 7 | rs2 << 2 | 1,
+                       std::string(arithmetic ? "c.srai " : "c.srli ") + name(rd) + ", " + std::to_string(rs2));
+        }
+        if (opcode == OP_LUI && rd != 0 && rd != 2)
+        {
+            int32_t upper = static_cast<int32_t>(word) >> 12;
+            if (upper != 0 && fits6(upper))
+                return set(cFormatCI(3, rd, upper, 1),
+                           "c.lui " + name(rd) + ", " + std::to_string(static_cast<uint32_t>(upper) & 0xfffff));
+            return false;
+        }
+        if (opcode == OP_LOAD && funct3 == 2 && immI >= 0 && immI % 4 == 0)
+        {
+            std::string operands = name(rd) + ", " + std::to_string(immI) + "(" + name(rs1) + ")";
+            uint32_t u = static_cast<uint32_t>(immI);
+            if (rs1 == 2 && rd != 0 && immI <= 252)
+                return set(2 << 13 | bit(u, 5, 12) | rd << 7 | ((u >> 2) & 7) << 4 | ((u >> 6) & 3) << 2 | 2,
+                           "c.lwsp " + operands);
+            if (isCReg(rd) && isCReg(rs1) && immI <= 124)
+                return set(cFormatCLS(2, rs1, rd, immI), "c.lw " + operands);
+            return false;
+        }
+        if (opcode == OP_STORE && funct3 == 2 && immS >= 0 && immS % 4 == 0)
+        {
+            std::string operands = name(rs2) + ", " + std::to_string(immS) + "(" + name(rs1) + ")";
+            uint32_t u = static_cast<uint32_t>(immS);
+            if (rs1 == 2 && immS <= 252)
+                return set(6 << 13 | ((u >> 2) & 0xf) << 9 | ((u >> 6) & 3) << 7 | rs2 << 2 | 2, "c.swsp " + operands);
+            if (isCReg(rs2) && isCReg(rs1) && immS <= 124)
+                return set(cFormatCLS(6, rs1, rs2, immS), "c.sw " + operands);
+            return false;
+        }
+        if (opcode == OP_REG && funct7 == 0 && funct3 == 0 && rd != 0)
+        {
+            if (rs1 == 0 && rs2 != 0)
+                return set(cFormatCR(8, rd, rs2), "c.mv " + name(rd) + ", " + name(rs2));
+            if (rd == rs1 && rs2 != 0)
+                return set(cFormatCR(9, rd, rs2), "c.add " + name(rd) + ", " + name(rs2));
+            if (rd == rs2 && rs1 != 0)
+                return set(cFormatCR(9, rd, rs1), "c.add " + name(rd) + ", " + name(rs1));
+            return false;
+        }
+        bool isSub = funct7 == 0x20 && funct3 == 0;
+        if (opcode == OP_REG && (isSub || (funct7 == 0 && (funct3 == 4 || funct3 == 6 || funct3 == 7))))
+        {
+            // c.sub/c.xor/c.or/c.and: rd' = rd' op rs2'; xor/or/and commute
+            int other = rd == rs1 ? rs2 : (funct3 != 0 && rd == rs2 ? rs1 : -1);
+            if (other < 0 || !isCReg(rd) || !isCReg(other))
+                return false;
+            uint32_t selector = funct3 == 0 ? 0 : funct3 == 4 ? 1 : funct3 == 6 ? 2 : 3;
+            static const char *const names[] = {"c.sub ", "c.xor ", "c.or ", "c.and "};
+            return set(0x8c01 | (rd - 8) << 7 | selector << 5 | (other - 8) << 2,
+                       names[selector] + name(rd) + ", " + name(other));
+        }
+        if (opcode == OP_JALR && funct3 == 0 && immI == 0 && rs1 != 0 && (rd == 0 || rd == RA))
+        {
+            return set(cFormatCR(rd == 0 ? 8 : 9, rs1, 0), std::string(rd == 0 ? "c.jr " : "c.jalr ") + name(rs1));
+        }
+        return false;
+    }
+
+    std::string trim(const std::string &s)
+    {
+        size_t begin = s.find_first_not_of(" \t\r");
+        if (begin == std::string::npos)
+            return "";
+        size_t end = s.find_last_not_of(" \t\r");
+        return s.substr(begin, end - begin + 1);
+    }
+
+    struct RFormat
+    {
+        uint32_t funct7, funct3;
+    };
+    const std::map<std::string, RFormat> rOps = {
+        {"add", {0, 0}},  {"sub", {0x20, 0}}, {"sll", {0, 1}},    {"slt", {0, 2}},    {"sltu", {0, 3}},
+        {"xor", {0, 4}},  {"srl", {0, 5}},    {"sra", {0x20, 5}}, {"or", {0, 6}},     {"and", {0, 7}},
+        {"mul", {1, 0}},  {"mulh", {1, 1}},   {"mulhsu", {1, 2}}, {"mulhu", {1, 3}},  {"div", {1, 4}},
+        {"divu", {1, 5}}, {"rem", {1, 6}},    {"remu", {1, 7}}};
+    const std::map<std::string, uint32_t> iOps = {{"addi", 0}, {"slti", 2}, {"sltiu", 3},
+                                                  {"xori", 4}, {"ori", 6},  {"andi", 7}};
+    // funct7 << 4 | funct3
+    const std::map<std::string, uint32_t> shiftOps = {{"slli", 0x001}, {"srli", 0x005}, {"srai", 0x205}};
+    const std::map<std::string, uint32_t> loadOps = {{"lb", 0}, {"lh", 1}, {"lw", 2}, {"lbu", 4}, {"lhu", 5}};
+    const std::map<std::string, uint32_t> storeOps = {{"sb", 0}, {"sh", 1}, {"sw", 2}};
+    const std::map<std::string, uint32_t> branchOps = {{"beq", 0}, {"bne", 1},  {"blt", 4},
+                                                       {"bge", 5}, {"bltu", 6}, {"bgeu", 7}};
+}
+
+void RiscvAssembler::error(const std::string &message) const
+{
+    throw std::runtime_error("Assembler line " + std::to_string(lineNumber) + ": " + message);
+}
+
+int RiscvAssembler::parseRegister(const std::string &name) const
+{
+    static const std::map<std::string, int> abi = {
+        {"zero", 0}, {"ra", 1},  {"sp", 2},   {"gp", 3},   {"tp", 4},  {"t0", 5},  {"t1", 6},  {"t2", 7},
+        {"s0", 8},   {"fp", 8},  {"s1", 9},   {"a0", 10},  {"a1", 11}, {"a2", 12}, {"a3", 13}, {"a4", 14},
+        {"a5", 15},  {"a6", 16}, {"a7", 17},  {"s2", 18},  {"s3", 19}, {"s4", 20}, {"s5", 21}, {"s6", 22},
+        {"s7", 23},  {"s8", 24}, {"s9", 25},  {"s10", 26}, {"s11", 27}, {"t3", 28}, {"t4", 29}, {"t5", 30},
+        {"t6", 31}};
+    auto it = abi.find(name);
+    if (it != abi.end())
+    {
+        return it->second;
+    }
+    if (name.size() >= 2 && name[0] == 'x' && std::all_of(name.begin() + 1, name.end(), ::isdigit))
+    {
+        int n = std::stoi(name.substr(1));
+        if (n < 32)
+            return n;
+    }
+    error("bad register '" + name + "'");
+}
+
+int32_t RiscvAssembler::parseImmediate(const std::string &text) const
+{
+    try
+    {
+        size_t used = 0;
+        long long value = std::stoll(text, &used, 0);
+        if (used != text.size() || value < INT32_MIN || value > UINT32_MAX)
+        {
+            error("bad immediate '" + text + "'");
+        }
+        return static_cast<int32_t>(value);
+    }
+    catch (const std::logic_error &)
+    {
+        error("bad immediate '" + text + "'");
+    }
+}
+
+void RiscvAssembler::parseMemory(const std::string &operand, int32_t &offset, int &base) const
+{
+    size_t open = operand.find('(');
+    size_t close = operand.find(')');
+    if (open == std::string::npos || close == std::string::npos || close < open)
+    {
+        error("bad memory operand '" + operand + "'");
+    }
+    std::string imm = trim(operand.substr(0, open));
+    offset = imm.empty() ? 0 : parseImmediate(imm);
+    base = parseRegister(trim(operand.substr(open + 1, close - open - 1)));
+}
+
+void RiscvAssembler::addPlain(uint32_t word)
+{
+    TextItem item;
+    item.kind = ItemKind::Plain;
+    item.word = word;
+    item.line = lineNumber;
+    text.push_back(item);
+}
+
+void RiscvAssembler::addLi(int rd, int32_t value)
+{
+    if (fitsI(value))
+    {
+        addPlain(encodeI(OP_IMM, value, 0, 0, rd));
+        return;
+    }
+    uint32_t hi;
+    int32_t lo;
+    splitHiLo(value, hi, lo);
+    addPlain(encodeU(OP_LUI, hi, rd));
+    if (lo != 0)
+    {
+        addPlain(encodeI(OP_IMM, lo, rd, 0, rd));
+    }
+}
+
+void RiscvAssembler::defineLabel(const std::string &name)
+{
+    if (labels.count(name))
+    {
+        error("label '" + name + "' defined twice");
+    }
+    labels[name] = {currentSection, currentSection == 1 ? text.size() : data.size()};
+    labelOrder.push_back(name);
+}
+
+void RiscvAssembler::parseDirective(const std::string &name, const std::string &rest)
+{
+    if (name == ".text")
+    {
+        currentSection = 1;
+    }
+    else if (name == ".data")
+    {
+        currentSection = 2;
+    }
+    else if (name == ".section")
+    {
+        std::string section = trim(rest.substr(0, rest.find(',')));
+        if (section == ".text")
+            currentSection = 1;
+        else if (section == ".data" || section == ".rodata")
+            currentSection = 2;
+        else
+            error("unsupported section " + section);
+    }
+    else if (name == ".globl" || name == ".global")
+    {
+        globals[trim(rest)] = true;
+    }
+    else if (name == ".align" || name == ".p2align")
+    {
+        int power = parseImmediate(trim(rest));
+        if (currentSection == 1)
+        {
+            TextItem item;
+            item.kind = ItemKind::Align;
+            item.addend = power;
+            item.size = 0;
+            item.line = lineNumber;
+            text.push_back(item);
+        }
+        else
+        {
+            while (data.size() % (size_t(1) << power))
+                data.push_back(0);
+        }
+    }
+    else if (name == ".word" || name == ".zero" || name == ".space" || name == ".asciz" || name == ".string" ||
+             name == ".byte")
+    {
+        if (currentSection != 2)
+        {
+            error("data directive " + name + " outside .data");
+        }
+        if (name == ".word" || name == ".byte")
+        {
+            std::stringstream values(rest);
+            std::string value;
+            while (std::getline(values, value, ','))
+            {
+                uint32_t v = static_cast<uint32_t>(parseImmediate(trim(value)));
+                int bytes = name == ".word" ? 4 : 1;
+                for (int i = 0; i < bytes; i++)
+                    data.push_back((v >> (8 * i)) & 0xff);
+            }
+        }
+        else if (name == ".zero" || name == ".space")
+        {
+            data.insert(data.end(), parseImmediate(trim(rest)), 0);
+        }
+        else
+        {
+            std::string literal = trim(rest);
+            if (literal.size() < 2 || literal.front() != '"' || literal.back() != '"')
+            {
+                error("bad string literal");
+            }
+            for (size_t i = 1; i + 1 < literal.size(); i++)
+            {
+                char c = literal[i];
+                if (c == '\\' && i + 2 < literal.size())
+                {
+                    char e = literal[++i];
+                    c = e == 'n' ? '\n' : e == 't' ? '\t' : e == '0' ? '\0' : e;
+                }
+                data.push_back(static_cast<uint8_t>(c));
+            }
+            data.push_back(0);
+        }
+    }
+    else if (name == ".file" || name == ".loc" || name == ".type" || name == ".size" || name == ".option" ||
+             name == ".attribute")
+    {
+        // Debug and symbol metadata is not encoded
+    }
+    else
+    {
+        error("unsupported directive " + name);
+    }
+}
+
+void RiscvAssembler::parseInstruction(const std::string &m, const std::vector<std::string> &ops)
+{
+    if (currentSection != 1)
+    {
+        error("instruction outside .text");
+    }
+    auto need = [&](size_t n) {
+        if (ops.size() != n)
+            error(m + " expects " + std::to_string(n) + " operands");
+    };
+    auto reg = [&](size_t i) { return parseRegister(ops[i]); };
+    auto branchTo = [&](uint32_t funct3, int rs1, int rs2, const std::string &label) {
+        TextItem item;
+        item.kind = ItemKind::Branch;
+        item.word = rs2 << 20 | rs1 << 15 | funct3 << 12 | OP_BRANCH;
+        item.symbol = label;
+        item.line = lineNumber;
+        text.push_back(item);
+    };
+    auto jalTo = [&](int rd, const std::string &label) {
+        TextItem item;
+        item.kind = ItemKind::Jal;
+        item.rd = rd;
+        item.symbol = label;
+        item.line = lineNumber;
+        text.push_back(item);
+    };
+
+    if (auto r = rOps.find(m); r != rOps.end())
+    {
+        need(3);
+        addPlain(encodeR(r->second.funct7, reg(2), reg(1), r->second.funct3, reg(0)));
+    }
+    else if (auto i = iOps.find(m); i != iOps.end())
+    {
+        need(3);
+        int32_t imm = parseImmediate(ops[2]);
+        if (!fitsI(imm))
+            error("immediate out of range");
+        addPlain(encodeI(OP_IMM, imm, reg(1), i->second, reg(0)));
+    }
+    else if (auto s = shiftOps.find(m); s != shiftOps.end())
+    {
+        need(3);
+        int32_t shamt = parseImmediate(ops[2]);
+        if (shamt < 0 || shamt > 31)
+            error("shift amount out of range");
+        addPlain(encodeI(OP_IMM, static_cast<int32_t>((s->second >> 4) << 5 | shamt), reg(1), s->second & 7,
+                         reg(0)));
+    }
+    else if (auto l = loadOps.find(m); l != loadOps.end())
+    {
+        need(2);
+        int32_t offset;
+        int base;
+        parseMemory(ops[1], offset, base);
+        if (!fitsI(offset))
+            error("offset out of range");
+        addPlain(encodeI(OP_LOAD, offset, base, l->second, reg(0)));
+    }
+    else if (auto st = storeOps.find(m); st != storeOps.end())
+    {
+        need(2);
+        int32_t offset;
+        int base;
+        parseMemory(ops[1], offset, base);
+        if (!fitsI(offset))
+            error("offset out of range");
+        addPlain(encodeS(offset, reg(0), base, st->second));
+    }
+    else if (auto b = branchOps.find(m); b != branchOps.end())
+    {
+        need(3);
+        branchTo(b->second, reg(0), reg(1), ops[2]);
+    }
+    else if (m == "bgt" || m == "ble" || m == "bgtu" || m == "bleu")
+    {
+        need(3);
+        uint32_t funct3 = m == "bgt" ? 4 : m == "ble" ? 5 : m == "bgtu" ? 6 : 7;
+        branchTo(funct3, reg(1), reg(0), ops[2]);
+    }
+    else if (m == "beqz" || m == "bnez" || m == "bltz" || m == "bgez" || m == "blez" || m == "bgtz")
+    {
+        need(2);
+        int rs = reg(0);
+        if (m == "beqz")
+            branchTo(0, rs, 0, ops[1]);
+        else if (m == "bnez")
+            branchTo(1, rs, 0, ops[1]);
+        else if (m == "bltz")
+            branchTo(4, rs, 0, ops[1]);
+        else if (m == "bgez")
+            branchTo(5, rs, 0, ops[1]);
+        else if (m == "blez")
+            branchTo(5, 0, rs, ops[1]);
+        else
+            branchTo(4, 0, rs, ops[1]);
+    }
+    else if (m == "li")
+    {
+        need(2);
+        addLi(reg(0), parseImmediate(ops[1]));
+    }
+    else if (m == "lui" || m == "auipc")
+    {
+        need(2);
+        addPlain(encodeU(m == "lui" ? OP_LUI : OP_AUIPC, static_cast<uint32_t>(parseImmediate(ops[1])), reg(0)));
+    }
+    else if (m == "mv")
+    {
+        need(2);
+        addPlain(encodeI(OP_IMM, 0, reg(1), 0, reg(0)));
+    }
+    else if (m == "not")
+    {
+        need(2);
+        addPlain(encodeI(OP_IMM, -1, reg(1), 4, reg(0)));
+    }
+    else if (m == "neg")
+    {
+        need(2);
+        addPlain(encodeR(0x20, reg(1), 0, 0, reg(0)));
+    }
+    else if (m == "seqz")
+    {
+        need(2);
+        addPlain(encodeI(OP_IMM, 1, reg(1), 3, reg(0)));
+    }
+    else if (m == "snez")
+    {
+        need(2);
+        addPlain(encodeR(0, reg(1), 0, 3, reg(0)));
+    }
+    else if (m == "sltz")
+    {
+        need(2);
+        addPlain(encodeR(0, 0, reg(1), 2, reg(0)));
+    }
+    else if (m == "sgtz")
+    {
+        need(2);
+        addPlain(encodeR(0, reg(1), 0, 2, reg(0)));
+    }
+    else if (m == "nop")
+    {
+        need(0);
+        addPlain(NOP);
+    }
+    else if (m == "ecall")
+    {
+        need(0);
+        addPlain(OP_SYSTEM);
+    }
+    else if (m == "ebreak")
+    {
+        need(0);
+        addPlain(0x00100000 | OP_SYSTEM);
+    }
+    else if (m == "ret")
+    {
+        need(0);
+        addPlain(encodeI(OP_JALR, 0, RA, 0, 0));
+    }
+    else if (m == "jr")
+    {
+        need(1);
+        addPlain(encodeI(OP_JALR, 0, reg(0), 0, 0));
+    }
+    else if (m == "jalr")
+    {
+        if (ops.size() == 1)
+        {
+            addPlain(encodeI(OP_JALR, 0, reg(0), 0, RA));
+        }
+        else if (ops.size() == 2)
+        {
+            int32_t offset;
+            int base;
+            parseMemory(ops[1], offset, base);
+            addPlain(encodeI(OP_JALR, offset, base, 0, reg(0)));
+        }
+        else
+        {
+            need(3);
+            addPlain(encodeI(OP_JALR, parseImmediate(ops[2]), reg(1), 0, reg(0)));
+        }
+    }
+    else if (m == "j")
+    {
+        need(1);
+        jalTo(0, ops[0]);
+    }
+    else if (m == "jal")
+    {
+        if (ops.size() == 1)
+        {
+            jalTo(RA, ops[0]);
+        }
+        else
+        {
+            need(2);
+            jalTo(reg(0), ops[1]);
+        }
+    }
+    else if (m == "call")
+    {
+        need(1);
+        TextItem item;
+        item.kind = ItemKind::Call;
+        item.symbol = ops[0];
+        item.line = lineNumber;
+        text.push_back(item);
+        callTargets[ops[0]] = true;
+    }
+    else if (m == "la" || m == "lla")
+    {
+        need(2);
+        TextItem item;
+        item.kind = ItemKind::La;
+        item.rd = reg(0);
+        std::string symbol = ops[1];
+        size_t plus = symbol.find_first_of("+-", 1);
+        if (plus != std::string::npos)
+        {
+            item.addend = parseImmediate(trim(symbol.substr(plus)));
+            symbol = trim(symbol.substr(0, plus));
+        }
+        item.symbol = symbol;
+        item.size = 8;
+        item.line = lineNumber;
+        text.push_back(item);
+    }
+    else
+    {
+        error("unsupported instruction " + m);
+    }
+}
+
+void RiscvAssembler::parseLine(const std::string &rawLine)
+{
+    std::string line = rawLine;
+    // Strip comments, keeping '#' inside string literals
+    bool inString = false;
+    for (size_t i = 0; i < line.size(); i++)
+    {
+        if (line[i] == '"' && (i == 0 || line[i - 1] != '\\'))
+            inString = !inString;
+        else if (line[i] == '#' && !inString)
+        {
+            line.resize(i);
+            break;
+        }
+    }
+    line = trim(line);
+    // Leading labels
+    while (!line.empty())
+    {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || (line[0] == '.' && line.find_first_of(" \t") < colon))
+        {
+            break;
+        }
+        std::string name = trim(line.substr(0, colon));
+        if (name.empty() || name.find_first_of(" \t\"") != std::string::npos)
+        {
+            break;
+        }
+        defineLabel(name);
+        line = trim(line.substr(colon + 1));
+    }
+    if (line.empty())
+    {
+        return;
+    }
+    size_t space = line.find_first_of(" \t");
+    std::string head = line.substr(0, space);
+    std::string rest = space == std::string::npos ? "" : trim(line.substr(space));
+    if (head[0] == '.')
+    {
+        parseDirective(head, rest);
+        return;
+    }
+    std::vector<std::string> ops;
+    if (!rest.empty())
+    {
+        std::stringstream operands(rest);
+        std::string op;
+        while (std::getline(operands, op, ','))
+        {
+            ops.push_back(trim(op));
+        }
+    }
+    parseInstruction(head, ops);
+}
+
+bool RiscvAssembler::labelAddress(const std::string &name, uint32_t &address) const
+{
+    auto it = labels.find(name);
+    if (it == labels.end())
+    {
+        return false;
+    }
+    if (it->second.section == 1)
+    {
+        address = textAddress + itemOffset[it->second.index];
+    }
+    else
+    {
+        address = dataAddress + static_cast<uint32_t>(it->second.index);
+    }
+    return true;
+}
+
+// RVC: encode plain instructions compressed where possible and start
+// branches and jumps that have a 16-bit form at 2 bytes
+void RiscvAssembler::compressItems()
+{
+    for (auto &item : text)
+    {
+        uint16_t half;
+        switch (item.kind)
+        {
+        case ItemKind::Plain:
+            if (compressWord(item.word, half, item.spelling))
+            {
+                item.word = half;
+                item.size = 2;
+            }
+            break;
+        case ItemKind::Branch:
+        {
+            // Only beqz/bnez on x8-x15 have a compressed form
+            int rs1 = (item.word >> 15) & 31, rs2 = (item.word >> 20) & 31;
+            uint32_t funct3 = (item.word >> 12) & 7;
+            if (rs2 == 0 && funct3 <= 1 && isCReg(rs1))
+                item.size = 2;
+            break;
+        }
+        case ItemKind::Jal:
+            if (item.rd == 0 || item.rd == RA)
+                item.size = 2;
+            break;
+        case ItemKind::Call:
+            item.size = 2;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Assign offsets, growing branches, jumps and calls whose targets are out
+// of range until nothing changes. Items only ever grow, so this terminates.
+void RiscvAssembler::layout()
+{
+    itemOffset.assign(text.size() + 1, 0);
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        uint32_t offset = 0;
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            TextItem &item = text[i];
+            itemOffset[i] = offset;
+            if (item.kind == ItemKind::Align)
+            {
+                uint32_t alignment = 1u << item.addend;
+                item.size = static_cast<int>((alignment - offset % alignment) % alignment);
+            }
+            offset += item.size;
+        }
+        itemOffset[text.size()] = offset;
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            TextItem &item = text[i];
+            bool relaxable = item.kind == ItemKind::Branch || item.kind == ItemKind::Call ||
+                             (item.kind == ItemKind::Jal && item.size == 2);
+            if (!relaxable || item.longForm)
+            {
+                continue;
+            }
+            auto it = labels.find(item.symbol);
+            bool local = it != labels.end() && it->second.section == 1;
+            int64_t distance = 0;
+            if (local)
+            {
+                distance = static_cast<int64_t>(itemOffset[it->second.index]) - itemOffset[i];
+            }
+            if (item.kind == ItemKind::Branch && !local)
+            {
+                lineNumber = item.line;
+                error("branch to undefined label " + item.symbol);
+            }
+            if (item.size == 2)
+            {
+                // c.beqz/c.bnez reach ±256 B, c.j/c.jal ±2 KiB
+                int64_t reach = item.kind == ItemKind::Branch ? 256 : 2048;
+                if (local && distance >= -reach && distance < reach)
+                {
+                    continue;
+                }
+                item.size = 4;
+                changed = true;
+                if (local || item.kind != ItemKind::Call)
+                {
+                    continue;
+                }
+            }
+            if (item.kind == ItemKind::Jal)
+            {
+                continue;
+            }
+            bool inRange = item.kind == ItemKind::Branch ? distance >= -4096 && distance <= 4094
+                                                         : distance >= -(1 << 20) && distance < (1 << 20);
+            if (!local || !inRange)
+            {
+                item.longForm = true;
+                item.size = 8;
+                changed = true;
+                if (item.kind == ItemKind::Branch)
+                {
+                    relaxedBranches++;
+                }
+            }
+        }
+    }
+}
+
+void RiscvAssembler::put16(uint16_t half)
+{
+    textBytes.push_back(half & 0xff);
+    textBytes.push_back(half >> 8);
+}
+
+void RiscvAssembler::put32(uint32_t word)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        textBytes.push_back((word >> (8 * i)) & 0xff);
+    }
+}
+
+void RiscvAssembler::encode()
+{
+    int pcrelLabels = 0;
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        const TextItem &item = text[i];
+        lineNumber = item.line;
+        uint32_t pc = textAddress + itemOffset[i];
+        uint32_t target = 0;
+        bool defined = item.symbol.empty() || labelAddress(item.symbol, target);
+        int32_t distance = static_cast<int32_t>(target - pc);
+        switch (item.kind)
+        {
+        case ItemKind::Plain:
+            if (item.size == 2)
+                put16(static_cast<uint16_t>(item.word));
+            else
+                put32(item.word);
+            break;
+        case ItemKind::Align:
+            for (int n = 0; n + 4 <= item.size; n += 4)
+                put32(NOP);
+            if (item.size % 4)
+                put16(0x0001); // c.nop
+            break;
+        case ItemKind::Branch:
+            if (item.size == 2)
+            {
+                bool notZero = (item.word >> 12) & 1;
+                int rs1 = (item.word >> 15) & 31;
+                put16(cBranch(notZero ? 7 : 6, rs1, distance));
+                text[i].spelling =
+                    std::string(notZero ? "c.bnez " : "c.beqz ") + abiNames[rs1] + ", " + item.symbol;
+            }
+            else if (!item.longForm)
+            {
+                put32(item.word | branchOffset(distance));
+            }
+            else
+            {
+                // Inverted condition skips the jal that reaches the target
+                put32((item.word ^ (1u << 12)) | branchOffset(8));
+                put32(encodeJ(0, distance - 4));
+            }
+            break;
+        case ItemKind::Jal:
+            if (!defined || labels.at(item.symbol).section != 1)
+            {
+                error("jump to undefined label " + item.symbol);
+            }
+            if (distance < -(1 << 20) || distance >= (1 << 20))
+            {
+                error("jump to " + item.symbol + " out of range");
+            }
+            if (item.size == 2)
+            {
+                put16(cJump(item.rd == 0 ? 5 : 1, distance));
+                text[i].spelling = std::string(item.rd == 0 ? "c.j " : "c.jal ") + item.symbol;
+            }
+            else
+            {
+                put32(encodeJ(item.rd, distance));
+            }
+            break;
+        case ItemKind::Call:
+            if (item.size == 2)
+            {
+                put16(cJump(1, distance));
+                text[i].spelling = "c.jal " + item.symbol;
+            }
+            else if (!item.longForm)
+            {
+                put32(encodeJ(RA, distance));
+                text[i].spelling = "jal " + item.symbol;
+            }
+            else if (defined)
+            {
+                uint32_t hi;
+                int32_t lo;
+                splitHiLo(distance, hi, lo);
+                put32(encodeU(OP_AUIPC, hi, RA));
+                put32(encodeI(OP_JALR, lo, RA, 0, RA));
+            }
+            else
+            {
+                if (kind == OutputKind::Executable)
+                {
+                    error("call to undefined function " + item.symbol);
+                }
+                relocations.push_back({textSize(), RelocType::Call, item.symbol, 0});
+                put32(encodeU(OP_AUIPC, 0, RA));
+                put32(encodeI(OP_JALR, 0, RA, 0, RA));
+            }
+            break;
+        case ItemKind::La:
+        {
+            bool sameSection = defined && labels.at(item.symbol).section == 1;
+            if (kind == OutputKind::Executable || sameSection)
+            {
+                if (!defined)
+                {
+                    error("undefined symbol " + item.symbol);
+                }
+                uint32_t hi;
+                int32_t lo;
+                splitHiLo(distance + item.addend, hi, lo);
+                put32(encodeU(OP_AUIPC, hi, item.rd));
+                put32(encodeI(OP_IMM, lo, item.rd, 0, item.rd));
+            }
+            else
+            {
+                std::string anchor = ".Lpcrel_hi" + std::to_string(pcrelLabels++);
+                symbols.push_back({anchor, 1, itemOffset[i], false, false});
+                relocations.push_back({textSize(), RelocType::PcrelHi20, item.symbol, item.addend});
+                relocations.push_back({textSize() + 4, RelocType::PcrelLo12I, anchor, 0});
+                put32(encodeU(OP_AUIPC, 0, item.rd));
+                put32(encodeI(OP_IMM, 0, item.rd, 0, item.rd));
+            }
+            break;
+        }
+        }
+        if (item.kind != ItemKind::Align)
+        {
+            instructionCount += item.kind == ItemKind::La || item.size == 8 ? 2 : 1;
+            compressedCount += item.size == 2 ? 1 : 0;
+        }
+    }
+}
+
+void RiscvAssembler::assemble(const std::string &source)
+{
+    if (kind == OutputKind::Executable)
+    {
+        // Entry stub: exit(main())
+        for (const char *line : {".globl _start", "_start:", "call main", "li a7, 93", "ecall"})
+        {
+            parseLine(line);
+        }
+        textAddress = executableBase + elfExecutableHeaderSize;
+    }
+    std::istringstream in(source);
+    std::string line;
+    lineNumber = 0;
+    while (std::getline(in, line))
+    {
+        lineNumber++;
+        parseLine(line);
+    }
+    if (compressed)
+    {
+        compressItems();
+    }
+    layout();
+    uint32_t textEnd = textAddress + itemOffset[text.size()];
+    dataAddress = kind == OutputKind::Executable ? (textEnd + 3) / 4 * 4 : 0;
+    encode();
+
+    // Symbols: every label, then functions that are called but not defined
+    for (const auto &name : labelOrder)
+    {
+        const LabelRef &ref = labels.at(name);
+        uint32_t address = 0;
+        labelAddress(name, address);
+        bool global = globals.count(name) > 0;
+        symbols.push_back({name, ref.section, address, global, ref.section == 1 && (global || callTargets.count(name))});
+    }
+    std::map<std::string, bool> undefined;
+    for (const auto &rel : relocations)
+    {
+        if (!labels.count(rel.symbol) && rel.symbol.rfind(".Lpcrel_hi", 0) != 0)
+        {
+            undefined[rel.symbol] = true;
+        }
+    }
+    for (const auto &entry : undefined)
+    {
+        symbols.push_back({entry.first, 0, 0, true, false});
+    }
+}
+
+void RiscvAssembler::write(std::ostream &out) const
+{
+    ElfImage image;
+    image.executable = kind == OutputKind::Executable;
+    image.textAddress = textAddress;
+    image.dataAddress = dataAddress;
+    image.entry = textAddress; // _start is the first instruction
+    image.flags = compressed ? 1 : 0; // EF_RISCV_RVC
+    image.text = textBytes;
+    image.data = data;
+    image.symbols = symbols;
+    image.relocations = relocations;
+    writeElf(out, image);
+}
+
+std::string RiscvAssembler::compressedListing(const std::string &source) const
+{
+    // Source line -> spelling of its items, when every item has one
+    std::map<int, std::vector<std::string>> rewrites;
+    std::map<int, bool> keep;
+    for (const auto &item : text)
+    {
+        if (item.kind == ItemKind::Align || item.line <= 0)
+            continue;
+        if (!item.spelling.empty())
+            rewrites[item.line].push_back(item.spelling);
+        else
+            keep[item.line] = true;
+    }
+    std::ostringstream out;
+    out << ".option rvc\n";
+    std::istringstream in(source);
+    std::string line;
+    int number = 0;
+    while (std::getline(in, line))
+    {
+        number++;
+        auto it = rewrites.find(number);
+        if (it == rewrites.end() || keep.count(number) || line.find(':') != std::string::npos)
+        {
+            out << line << "\n";
+            continue;
+        }
+        std::string indent = line.substr(0, line.find_first_not_of(" \t"));
+        size_t comment = line.find('#');
+        for (size_t k = 0; k < it->second.size(); k++)
+        {
+            out << indent << it->second[k];
+            if (k + 1 == it->second.size() && comment != std::string::npos)
+                out << " " << line.substr(comment);
+            out << "\n";
+        }
+    }
+    return out.str();
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include "ElfWriter.h"
+
+// Assembler for the RV32IM subset Generator and IREmitter produce.
+//
+// Parses the assembly text (labels, the base instructions, the usual
+// pseudo-instructions such as li/mv/la/call/j/beqz, and the .text/.data/
+// .globl/.align/.word/.zero/.asciz directives; .file/.loc are accepted
+// and ignored), lays out the sections and relaxes branches: a conditional
+// branch whose target is out of the ±4 KiB range becomes an inverted
+// branch over a jal, and a call to a function defined in the same file
+// uses a single jal when it is in range. Calls to undefined functions and
+// references from .text to .data become relocations in an object; an
+// executable is linked on the spot with a _start stub that calls main and
+// exits with its return value.
+//
+// With RVC enabled (RV32IMC) every instruction whose operands fit one of
+// the 16-bit forms is encoded compressed, branches and jumps start in
+// their c.beqz/c.bnez/c.j/c.jal form and grow like the others, and
+// compressedListing() rewrites the source to spell out the chosen c.*
+// instructions (and calls shortened to jal) so the textual output
+// matches the object byte for byte.
+class RiscvAssembler
+{
+public:
+    enum class OutputKind
+    {
+        Object,
+        Executable
+    };
+    static constexpr uint32_t executableBase = 0x10000; // load address of the executable image
+
+private:
+    enum class ItemKind : uint8_t
+    {
+        Plain,  // fully encoded instruction
+        Branch, // conditional branch to a label
+        Jal,    // jal rd, label
+        Call,   // call label
+        La,     // auipc+addi of a symbol address
+        Align   // padding with nops to 1 << value bytes
+    };
+    struct TextItem
+    {
+        ItemKind kind;
+        uint32_t word = 0;  // Plain: encoding; Branch: encoding with a zero offset
+        int rd = 0;
+        std::string symbol;
+        int32_t addend = 0;
+        int size = 4;       // current size in bytes; 2 when compressed
+        bool longForm = false;
+        std::string spelling; // explicit c.*/jal form written by compressedListing()
+        int line = 0;
+    };
+    struct LabelRef
+    {
+        int section; // 1 .text, 2 .data
+        size_t index; // text item index or data byte offset
+    };
+
+    OutputKind kind;
+    bool compressed;
+    std::vector<TextItem> text;
+    std::vector<uint8_t> data;
+    std::vector<std::string> labelOrder;
+    std::map<std::string, LabelRef> labels;
+    std::map<std::string, bool> globals;
+    std::map<std::string, bool> callTargets;
+    int currentSection = 1;
+    int lineNumber = 0;
+
+    // Results of layout/encoding
+    std::vector<uint32_t> itemOffset;
+    std::vector<uint8_t> textBytes;
+    std::vector<Relocation> relocations;
+    std::vector<ElfSymbol> symbols;
+    uint32_t textAddress = 0;
+    uint32_t dataAddress = 0;
+    int relaxedBranches = 0;
+    int instructionCount = 0;
+    int compressedCount = 0;
+
+    [[noreturn]] void error(const std::string &message) const;
+    int parseRegister(const std::string &name) const;
+    int32_t parseImmediate(const std::string &text) const;
+    void parseMemory(const std::string &operand, int32_t &offset, int &base) const;
+    void parseLine(const std::string &line);
+    void parseDirective(const std::string &name, const std::string &rest);
+    void parseInstruction(const std::string &mnemonic, const std::vector<std::string> &ops);
+    void addPlain(uint32_t word);
+    void addLi(int rd, int32_t value);
+    void defineLabel(const std::string &name);
+
+    bool labelAddress(const std::string &name, uint32_t &address) const;
+    void compressItems();
+    void layout();
+    void encode();
+    void put16(uint16_t half);
+    void put32(uint32_t word);
+
+public:
+    explicit RiscvAssembler(OutputKind k, bool rvc = false) : kind(k), compressed(rvc) {}
+    // Assemble a complete file; throws std::runtime_error on bad input
+    void assemble(const std::string &source);
+    // Write the ELF32 object or executable
+    void write(std::ostream &out) const;
+    // The source with every compressed instruction spelled as its c.* form
+    std::string compressedListing(const std::string &source) const;
+
+    uint32_t textSize() const { return static_cast<uint32_t>(textBytes.size()); }
+    uint32_t dataSize() const { return static_cast<uint32_t>(data.size()); }
+    int relaxedBranchCount() const { return relaxedBranches; }
+    int relocationCount() const { return static_cast<int>(relocations.size()); }
+    int instructions() const { return instructionCount; }
+    int compressedInstructions() const { return compressedCount; }
+};
@@ -0,0 +1,641 @@
+#include "BytecodeVM.h"
+#include <stdexcept>
+#include <limits>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TOYC_COMPUTED_GOTO 1
+#endif
+
+static const char *opcodeName(Opcode op)
+{
+    static const char *names[] = {"li", "mv", "add", "addi", "sub", "mul", "div", "mod", "lt", "gt", "le", "ge",
+                                  "eq", "ne", "neg", "not", "jmp", "jz", "jnz", "call", "ret", "retv"};
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(Opcode::Count));
+    return names[static_cast<int>(op)];
+}
+
+void BytecodeProgram::disassemble(std::ostream &out) const
+{
+    for (const auto &func : functions)
+    {
+        out << func.name << ": params " << func.numParams << ", regs " << func.numRegs << "\n";
+        for (size_t i = 0; i < func.code.size(); i++)
+        {
+            const Instruction &inst = func.code[i];
+            out << "  " << i << "\t" << opcodeName(inst.op);
+            switch (inst.op)
+            {
+            case Opcode::LoadImm:
+                out << " r" << inst.a << ", " << inst.imm;
+                break;
+            case Opcode::Move:
+            case Opcode::Neg:
+            case Opcode::Not:
+                out << " r" << inst.a << ", r" << inst.b;
+                break;
+            case Opcode::AddImm:
+                out << " r" << inst.a << ", r" << inst.b << ", " << inst.imm;
+                break;
+            case Opcode::Jump:
+                out << " " << inst.imm;
+                break;
+            case Opcode::JumpIfZero:
+            case Opcode::JumpIfNotZero:
+                out << " r" << inst.b << ", " << inst.imm;
+                break;
+            case Opcode::Call:
+                out << " r" << inst.a << ", " << functions[inst.c].name << "(r" << inst.b << "...)";
+                break;
+            case Opcode::Return:
+                out << " r" << inst.b;
+                break;
+            case Opcode::ReturnVoid:
+                break;
+            default:
+                out << " r" << inst.a << ", r" << inst.b << ", r" << inst.c;
+                break;
+            }
+            out << "\n";
+        }
+    }
+}
+
+size_t BytecodeCompiler::emit(Opcode op, int32_t a, int32_t b, int32_t c, int32_t imm)
+{
+    current->code.push_back({op, a, b, c, imm});
+    return current->code.size() - 1;
+}
+
+void BytecodeCompiler::patch(size_t at, size_t target)
+{
+    current->code[at].imm = static_cast<int32_t>(target);
+}
+
+int BytecodeCompiler::allocReg()
+{
+    int reg = nextReg++;
+    current->numRegs = std::max(current->numRegs, nextReg);
+    return reg;
+}
+
+int BytecodeCompiler::lookup(const std::string &name) const
+{
+    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
+    {
+        auto found = it->find(name);
+        if (found != it->end())
+        {
+            return found->second;
+        }
+    }
+    throw std::runtime_error("Undefined variable: " + name);
+}
+
+int BytecodeCompiler::compileExpr(const Expr &expr)
+{
+    if (auto var = dynamic_cast<const Var *>(&expr))
+    {
+        return lookup(var->name);
+    }
+    int reg = allocReg();
+    compileExprInto(expr, reg);
+    return reg;
+}
+
+void BytecodeCompiler::compileCondJump(const Expr &expr, bool jumpIfTrue, std::vector<size_t> &jumps)
+{
+    if (auto lit = dynamic_cast<const IntLit *>(&expr))
+    {
+        if ((lit->value != 0) == jumpIfTrue)
+        {
+            jumps.push_back(emit(Opcode::Jump));
+        }
+        return;
+    }
+    if (auto un = dynamic_cast<const UnOpExpr *>(&expr); un && un->op == UnOp::Not)
+    {
+        compileCondJump(*un->right, !jumpIfTrue, jumps);
+        return;
+    }
+    if (auto bin = dynamic_cast<const BinOpExpr *>(&expr); bin && (bin->op == BinOp::And || bin->op == BinOp::Or))
+    {
+        // And jumps on false as soon as one side is false, Or jumps on true
+        bool shortCircuitValue = bin->op == BinOp::Or;
+        if (jumpIfTrue == shortCircuitValue)
+        {
+            compileCondJump(*bin->left, jumpIfTrue, jumps);
+            compileCondJump(*bin->right, jumpIfTrue, jumps);
+        }
+        else
+        {
+            std::vector<size_t> skip;
+            compileCondJump(*bin->left, !jumpIfTrue, skip);
+            compileCondJump(*bin->right, jumpIfTrue, jumps);
+            for (size_t at : skip)
+            {
+                patch(at, current->code.size());
+            }
+        }
+        return;
+    }
+    int saved = nextReg;
+    int reg = compileExpr(expr);
+    nextReg = saved;
+    jumps.push_back(emit(jumpIfTrue ? Opcode::JumpIfNotZero : Opcode::JumpIfZero, 0, reg));
+}
+
+void BytecodeCompiler::compileExprInto(const Expr &expr, int dest)
+{
+    int saved = nextReg;
+    if (auto lit = dynamic_cast<const IntLit *>(&expr))
+    {
+        emit(Opcode::LoadImm, dest, 0, 0, lit->value);
+    }
+    else if (auto var = dynamic_cast<const Var *>(&expr))
+    {
+        int reg = lookup(var->name);
+        if (reg != dest)
+        {
+            emit(Opcode::Move, dest, reg);
+        }
+    }
+    else if (auto bin = dynamic_cast<const BinOpExpr *>(&expr))
+    {
+        if (bin->op == BinOp::And || bin->op == BinOp::Or)
+        {
+            std::vector<size_t> jumps;
+            bool shortCircuitValue = bin->op == BinOp::Or;
+            compileCondJump(expr, shortCircuitValue, jumps);
+            emit(Opcode::LoadImm, dest, 0, 0, shortCircuitValue ? 0 : 1);
+            size_t end = emit(Opcode::Jump);
+            for (size_t at : jumps)
+            {
+                patch(at, current->code.size());
+            }
+            emit(Opcode::LoadImm, dest, 0, 0, shortCircuitValue ? 1 : 0);
+            patch(end, current->code.size());
+            return;
+        }
+        auto leftLit = dynamic_cast<const IntLit *>(bin->left.get());
+        auto rightLit = dynamic_cast<const IntLit *>(bin->right.get());
+        if (bin->op == BinOp::Add && (rightLit || leftLit))
+        {
+            const Expr &other = rightLit ? *bin->left : *bin->right;
+            int reg = compileExpr(other);
+            emit(Opcode::AddImm, dest, reg, 0, rightLit ? rightLit->value : leftLit->value);
+            nextReg = saved;
+            return;
+        }
+        if (bin->op == BinOp::Sub && rightLit)
+        {
+            int reg = compileExpr(*bin->left);
+            emit(Opcode::AddImm, dest, reg, 0, static_cast<int32_t>(0u - static_cast<uint32_t>(rightLit->value)));
+            nextReg = saved;
+            return;
+        }
+        static const std::map<BinOp, Opcode> opcodes = {
+            {BinOp::Add, Opcode::Add}, {BinOp::Sub, Opcode::Sub}, {BinOp::Mul, Opcode::Mul},
+            {BinOp::Div, Opcode::Div}, {BinOp::Mod, Opcode::Mod}, {BinOp::Lt, Opcode::Lt},
+            {BinOp::Gt, Opcode::Gt}, {BinOp::Le, Opcode::Le}, {BinOp::Ge, Opcode::Ge},
+            {BinOp::Eq, Opcode::Eq}, {BinOp::Ne, Opcode::Ne}};
+        int left = compileExpr(*bin->left);
+        int right = compileExpr(*bin->right);
+        emit(opcodes.at(bin->op), dest, left, right);
+    }
+    else if (auto un = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        int reg = compileExpr(*un->right);
+        emit(un->op == UnOp::Neg ? Opcode::Neg : Opcode::Not, dest, reg);
+    }
+    else if (auto call = dynamic_cast<const Call *>(&expr))
+    {
+        auto it = funcIndex.find(call->name);
+        if (it == funcIndex.end())
+        {
+            throw std::runtime_error("Call to undefined function: " + call->name);
+        }
+        if (funcParams.at(call->name) != call->args.size())
+        {
+            throw std::runtime_error("Wrong number of arguments in call to " + call->name);
+        }
+        // Arguments go to consecutive registers which become the callee's window
+        int argBase = nextReg;
+        for (size_t i = 0; i < call->args.size(); i++)
+        {
+            allocReg();
+        }
+        for (size_t i = 0; i < call->args.size(); i++)
+        {
+            compileExprInto(*call->args[i], argBase + static_cast<int>(i));
+        }
+        emit(Opcode::Call, dest, argBase, it->second);
+    }
+    else
+    {
+        throw std::runtime_error("Unknown expression type in bytecode compiler");
+    }
+    nextReg = saved;
+}
+
+void BytecodeCompiler::compileStmt(const Stmt &stmt)
+{
+    int saved = nextReg;
+    if (auto block = dynamic_cast<const Block *>(&stmt))
+    {
+        scopes.emplace_back();
+        for (const auto &s : block->stmts)
+        {
+            compileStmt(*s);
+        }
+        scopes.pop_back();
+    }
+    else if (dynamic_cast<const EmptyStmt *>(&stmt))
+    {
+    }
+    else if (auto exprStmt = dynamic_cast<const ExprStmt *>(&stmt))
+    {
+        if (dynamic_cast<const Call *>(exprStmt->expr.get()))
+        {
+            compileExprInto(*exprStmt->expr, allocReg());
+        }
+        else if (!dynamic_cast<const Var *>(exprStmt->expr.get()))
+        {
+            compileExpr(*exprStmt->expr);
+        }
+    }
+    else if (auto assign = dynamic_cast<const Assign *>(&stmt))
+    {
+        compileExprInto(*assign->value, lookup(assign->name));
+    }
+    else if (auto decl = dynamic_cast<const Decl *>(&stmt))
+    {
+        // The initializer still sees an outer variable of the same name
+        int reg = allocReg();
+        if (decl->value)
+        {
+            compileExprInto(*decl->value, reg);
+        }
+        else
+        {
+            emit(Opcode::LoadImm, reg, 0, 0, 0);
+        }
+        scopes.back()[decl->name] = reg;
+        return; // keep the register for the rest of the scope
+    }
+    else if (auto ifStmt = dynamic_cast<const If *>(&stmt))
+    {
+        std::vector<size_t> elseJumps;
+        compileCondJump(*ifStmt->condition, false, elseJumps);
+        compileStmt(*ifStmt->thenBody);
+        if (ifStmt->elseBody)
+        {
+            size_t end = emit(Opcode::Jump);
+            for (size_t at : elseJumps)
+            {
+                patch(at, current->code.size());
+            }
+            compileStmt(*ifStmt->elseBody);
+            patch(end, current->code.size());
+        }
+        else
+        {
+            for (size_t at : elseJumps)
+            {
+                patch(at, current->code.size());
+            }
+        }
+    }
+    else if (auto whileStmt = dynamic_cast<const While *>(&stmt))
+    {
+        // jmp cond; body: ...; cond: jnz body
+        size_t toCond = emit(Opcode::Jump);
+        size_t body = current->code.size();
+        loops.emplace_back();
+        compileStmt(*whileStmt->body);
+        size_t cond = current->code.size();
+        patch(toCond, cond);
+        std::vector<size_t> bodyJumps;
+        compileCondJump(*whileStmt->condition, true, bodyJumps);
+        for (size_t at : bodyJumps)
+        {
+            patch(at, body);
+        }
+        for (size_t at : loops.back().continueJumps)
+        {
+            patch(at, cond);
+        }
+        for (size_t at : loops.back().breakJumps)
+        {
+            patch(at, current->code.size());
+        }
+        loops.pop_back();
+    }
+    else if (dynamic_cast<const Break *>(&stmt))
+    {
+        if (loops.empty())
+        {
+            throw std::runtime_error("Break statement not within a loop");
+        }
+        loops.back().breakJumps.push_back(emit(Opcode::Jump));
+    }
+    else if (dynamic_cast<const Continue *>(&stmt))
+    {
+        if (loops.empty())
+        {
+            throw std::runtime_error("Continue statement not within a loop");
+        }
+        loops.back().continueJumps.push_back(emit(Opcode::Jump));
+    }
+    else if (auto ret = dynamic_cast<const Return *>(&stmt))
+    {
+        if (ret->returnValue)
+        {
+            emit(Opcode::Return, 0, compileExpr(*ret->returnValue));
+        }
+        else
+        {
+            emit(Opcode::ReturnVoid);
+        }
+    }
+    else
+    {
+        throw std::runtime_error("Unknown statement type in bytecode compiler");
+    }
+    nextReg = saved;
+}
+
+void BytecodeCompiler::compileFunc(const FuncDef &func, BytecodeFunction &out)
+{
+    current = &out;
+    out.name = func.name;
+    out.numParams = static_cast<int>(func.args.size());
+    nextReg = 0;
+    scopes.clear();
+    scopes.emplace_back();
+    for (const auto &arg : func.args)
+    {
+        scopes.back()[arg] = allocReg();
+    }
+    if (func.body)
+    {
+        compileStmt(*func.body);
+    }
+    emit(Opcode::ReturnVoid); // falling off the end returns 0
+    current = nullptr;
+}
+
+BytecodeProgram BytecodeCompiler::compile(const Program &program)
+{
+    BytecodeProgram result;
+    funcIndex.clear();
+    funcParams.clear();
+    for (const auto &func : program.functions)
+    {
+        funcIndex[func->name] = static_cast<int>(result.functions.size());
+        funcParams[func->name] = func->args.size();
+        result.functions.emplace_back();
+    }
+    for (size_t i = 0; i < program.functions.size(); i++)
+    {
+        compileFunc(*program.functions[i], result.functions[i]);
+    }
+    auto mainIt = funcIndex.find("main");
+    if (mainIt == funcIndex.end())
+    {
+        throw std::runtime_error("Program has no main function");
+    }
+    result.mainIndex = mainIt->second;
+    return result;
+}
+
+namespace
+{
+    struct Frame
+    {
+        const Instruction *code; // caller's code, for jump targets
+        const Instruction *ret;  // instruction after the call
+        size_t base;             // offset of the caller's register window
+        int32_t dest;            // caller register receiving the result
+    };
+
+    inline int32_t wrap(uint32_t value) { return static_cast<int32_t>(value); }
+
+    inline int32_t divide(int32_t x, int32_t y)
+    {
+        if (y == 0)
+            return -1;
+        if (x == std::numeric_limits<int32_t>::min() && y == -1)
+            return x;
+        return x / y;
+    }
+
+    inline int32_t modulo(int32_t x, int32_t y)
+    {
+        if (y == 0)
+            return x;
+        if (x == std::numeric_limits<int32_t>::min() && y == -1)
+            return 0;
+        return x % y;
+    }
+}
+
+VMResult BytecodeVM::run(const BytecodeProgram &program, uint64_t stepLimit)
+{
+    static constexpr size_t MAX_FRAMES = 1 << 20;
+    const BytecodeFunction &mainFunc = program.functions.at(program.mainIndex);
+    if (static_cast<size_t>(mainFunc.numRegs) > maxStackWords)
+    {
+        throw std::runtime_error("VM register stack overflow");
+    }
+    if (static_cast<size_t>(mainFunc.numRegs) > stack.size())
+    {
+        stack.resize(mainFunc.numRegs);
+    }
+    std::vector<Frame> frames;
+    frames.reserve(1024);
+    int32_t *R = stack.data();
+    const Instruction *code = mainFunc.code.data();
+    const Instruction *ip = code;
+    const Instruction *inst = nullptr;
+    uint64_t steps = 0;
+    uint64_t limit = stepLimit ? stepLimit : std::numeric_limits<uint64_t>::max();
+
+    // Pop a frame and deliver the result, or finish when main returns
+#define VM_RETURN(result)                   \
+    {                                       \
+        int32_t value = (result);           \
+        if (frames.empty())                 \
+            return {value, steps};          \
+        const Frame &frame = frames.back(); \
+        R = stack.data() + frame.base;      \
+        R[frame.dest] = value;              \
+        code = frame.code;                  \
+        ip = frame.ret;                     \
+        frames.pop_back();                  \
+        VM_NEXT();                          \
+    }
+
+#ifdef TOYC_COMPUTED_GOTO
+    static void *const dispatch[] = {
+        &&L_LoadImm, &&L_Move, &&L_Add, &&L_AddImm, &&L_Sub, &&L_Mul, &&L_Div, &&L_Mod, &&L_Lt, &&L_Gt,
+        &&L_Le, &&L_Ge, &&L_Eq, &&L_Ne, &&L_Neg, &&L_Not, &&L_Jump, &&L_JumpIfZero,
+        &&L_JumpIfNotZero, &&L_Call, &&L_Return, &&L_ReturnVoid};
+    static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == static_cast<size_t>(Opcode::Count));
+#define VM_CASE(name) L_##name:
+#define VM_NEXT()                                  \
+    do                                             \
+    {                                              \
+        if (++steps > limit)                       \
+            goto step_limit;                       \
+        inst = ip++;                               \
+        goto *dispatch[static_cast<int>(inst->op)]; \
+    } while (0)
+    VM_NEXT();
+#else
+#define VM_CASE(name) case Opcode::name:
+#define VM_NEXT() continue
+    for (;;)
+    {
+        if (++steps > limit)
+            goto step_limit;
+        inst = ip++;
+        switch (inst->op)
+        {
+#endif
+    VM_CASE(LoadImm)
+    {
+        R[inst->a] = inst->imm;
+        VM_NEXT();
+    }
+    VM_CASE(Move)
+    {
+        R[inst->a] = R[inst->b];
+        VM_NEXT();
+    }
+    VM_CASE(Add)
+    {
+        R[inst->a] = wrap(static_cast<uint32_t>(R[inst->b]) + static_cast<uint32_t>(R[inst->c]));
+        VM_NEXT();
+    }
+    VM_CASE(AddImm)
+    {
+        R[inst->a] = wrap(static_cast<uint32_t>(R[inst->b]) + static_cast<uint32_t>(inst->imm));
+        VM_NEXT();
+    }
+    VM_CASE(Sub)
+    {
+        R[inst->a] = wrap(static_cast<uint32_t>(R[inst->b]) - static_cast<uint32_t>(R[inst->c]));
+        VM_NEXT();
+    }
+    VM_CASE(Mul)
+    {
+        R[inst->a] = wrap(static_cast<uint32_t>(R[inst->b]) * static_cast<uint32_t>(R[inst->c]));
+        VM_NEXT();
+    }
+    VM_CASE(Div)
+    {
+        R[inst->a] = divide(R[inst->b], R[inst->c]);
+        VM_NEXT();
+    }
+    VM_CASE(Mod)
+    {
+        R[inst->a] = modulo(R[inst->b], R[inst->c]);
+        VM_NEXT();
+    }
+    VM_CASE(Lt)
+    {
+        R[inst->a] = R[inst->b] < R[inst->c];
+        VM_NEXT();
+    }
+    VM_CASE(Gt)
+    {
+        R[inst->a] = R[inst->b] > R[inst->c];
+        VM_NEXT();
+    }
+    VM_CASE(Le)
+    {
+        R[inst->a] = R[inst->b] <= R[inst->c];
+        VM_NEXT();
+    }
+    VM_CASE(Ge)
+    {
+        R[inst->a] = R[inst->b] >= R[inst->c];
+        VM_NEXT();
+    }
+    VM_CASE(Eq)
+    {
+        R[inst->a] = R[inst->b] == R[inst->c];
+        VM_NEXT();
+    }
+    VM_CASE(Ne)
+    {
+        R[inst->a] = R[inst->b] != R[inst->c];
+        VM_NEXT();
+    }
+    VM_CASE(Neg)
+    {
+        R[inst->a] = wrap(0u - static_cast<uint32_t>(R[inst->b]));
+        VM_NEXT();
+    }
+    VM_CASE(Not)
+    {
+        R[inst->a] = R[inst->b] == 0;
+        VM_NEXT();
+    }
+    VM_CASE(Jump)
+    {
+        ip = code + inst->imm;
+        VM_NEXT();
+    }
+    VM_CASE(JumpIfZero)
+    {
+        if (R[inst->b] == 0)
+            ip = code + inst->imm;
+        VM_NEXT();
+    }
+    VM_CASE(JumpIfNotZero)
+    {
+        if (R[inst->b] != 0)
+            ip = code + inst->imm;
+        VM_NEXT();
+    }
+    VM_CASE(Call)
+    {
+        const BytecodeFunction &callee = program.functions[inst->c];
+        size_t base = static_cast<size_t>(R - stack.data());
+        size_t calleeBase = base + inst->b;
+        if (calleeBase + callee.numRegs > stack.size())
+        {
+            if (calleeBase + callee.numRegs > maxStackWords || frames.size() >= MAX_FRAMES)
+            {
+                throw std::runtime_error("VM stack overflow in call to " + callee.name);
+            }
+            stack.resize(std::min(maxStackWords, std::max(stack.size() * 2, calleeBase + callee.numRegs)));
+        }
+        frames.push_back({code, ip, base, inst->a});
+        R = stack.data() + calleeBase;
+        code = callee.code.data();
+        ip = code;
+        VM_NEXT();
+    }
+    VM_CASE(Return)
+    {
+        VM_RETURN(R[inst->b]);
+    }
+    VM_CASE(ReturnVoid)
+    {
+        VM_RETURN(0);
+    }
+#ifndef TOYC_COMPUTED_GOTO
+        default:
+            throw std::runtime_error("Invalid bytecode opcode");
+        }
+    }
+#endif
+
+step_limit:
+    throw std::runtime_error("VM step limit of " + std::to_string(stepLimit) + " exceeded");
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_RETURN
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include "ASTNode.h"
+
+// Register-based bytecode for running ToyC programs without an assembler.
+//
+// Every function owns a window of virtual registers: parameters first, then
+// locals, then expression temporaries. A call passes its arguments in
+// consecutive registers of the caller, which become registers 0..n-1 of the
+// callee window, so no copying is needed on entry.
+// Arithmetic wraps at 32 bits and division follows RISC-V semantics
+// (x/0 = -1, x%0 = x, INT_MIN/-1 = INT_MIN), so the VM can be used as an
+// oracle for the generated assembly.
+enum class Opcode : uint8_t
+{
+    LoadImm,   // a = imm
+    Move,      // a = b
+    Add,       // a = b + c
+    AddImm,    // a = b + imm
+    Sub,       // a = b - c
+    Mul,       // a = b * c
+    Div,       // a = b / c
+    Mod,       // a = b % c
+    Lt,        // a = b < c
+    Gt,        // a = b > c
+    Le,        // a = b <= c
+    Ge,        // a = b >= c
+    Eq,        // a = b == c
+    Ne,        // a = b != c
+    Neg,       // a = -b
+    Not,       // a = !b
+    Jump,      // pc = imm
+    JumpIfZero,    // if b == 0: pc = imm
+    JumpIfNotZero, // if b != 0: pc = imm
+    Call,      // a = functions[c](registers b...)
+    Return,    // return b
+    ReturnVoid,
+    Count
+};
+
+struct Instruction
+{
+    Opcode op;
+    int32_t a = 0;
+    int32_t b = 0;
+    int32_t c = 0;
+    int32_t imm = 0;
+};
+
+struct BytecodeFunction
+{
+    std::string name;
+    int numParams = 0;
+    int numRegs = 0; // size of the register window
+    std::vector<Instruction> code;
+};
+
+struct BytecodeProgram
+{
+    std::vector<BytecodeFunction> functions;
+    int mainIndex = -1;
+
+    void disassemble(std::ostream &out) const;
+};
+
+// Lowers a folded Program into bytecode
+class BytecodeCompiler
+{
+private:
+    struct LoopLabels
+    {
+        std::vector<size_t> breakJumps;    // jumps patched to the loop exit
+        std::vector<size_t> continueJumps; // jumps patched to the condition
+    };
+
+    std::map<std::string, int> funcIndex;
+    std::map<std::string, size_t> funcParams;
+    BytecodeFunction *current = nullptr;
+    std::vector<std::map<std::string, int>> scopes;
+    std::vector<LoopLabels> loops;
+    int nextReg = 0;
+
+    size_t emit(Opcode op, int32_t a = 0, int32_t b = 0, int32_t c = 0, int32_t imm = 0);
+    void patch(size_t at, size_t target);
+    int allocReg();
+    int lookup(const std::string &name) const;
+
+    int compileExpr(const Expr &expr);                // register holding the value
+    void compileExprInto(const Expr &expr, int dest); // value written to dest
+    void compileCondJump(const Expr &expr, bool jumpIfTrue, std::vector<size_t> &jumps);
+    void compileStmt(const Stmt &stmt);
+    void compileFunc(const FuncDef &func, BytecodeFunction &out);
+
+public:
+    BytecodeProgram compile(const Program &program);
+};
+
+struct VMResult
+{
+    int32_t value = 0;  // return value of main
+    uint64_t steps = 0; // executed instructions
+};
+
+class BytecodeVM
+{
+private:
+    std::vector<int32_t> stack; // register windows of all active frames, grown on demand
+    size_t maxStackWords;
+
+public:
+    static constexpr size_t INITIAL_STACK_WORDS = 1 << 12;
+    static constexpr size_t DEFAULT_MAX_STACK_WORDS = 1 << 24;
+    explicit BytecodeVM(size_t maxWords = DEFAULT_MAX_STACK_WORDS)
+        : stack(INITIAL_STACK_WORDS), maxStackWords(maxWords) {}
+
+    // Run main; throws std::runtime_error when the step limit (0 = none)
+    // is exceeded or the register stack overflows
+    VMResult run(const BytecodeProgram &program, uint64_t stepLimit = 0);
+};
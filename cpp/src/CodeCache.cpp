@@ -0,0 +1,334 @@
+#include "CodeCache.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <cstdint>
+#include <random>
+
+namespace
+{
+    const char *binOpName(BinOp op)
+    {
+        static const char *names[] = {"+", "-", "*", "/", "%", "<", ">", "<=", ">=", "==", "!=", "&&", "||"};
+        return names[static_cast<int>(op)];
+    }
+
+    // Identity of the running compiler: a hash of its own executable
+    std::string compilerIdentity()
+    {
+        std::ifstream exe("/proc/self/exe", std::ios::binary);
+        if (!exe)
+        {
+            return "unknown";
+        }
+        uint64_t hash = 1469598103934665603ull;
+        char buffer[1 << 16];
+        while (exe.read(buffer, sizeof(buffer)) || exe.gcount() > 0)
+        {
+            for (std::streamsize i = 0; i < exe.gcount(); i++)
+            {
+                hash = (hash ^ static_cast<unsigned char>(buffer[i])) * 1099511628211ull;
+            }
+        }
+        std::ostringstream out;
+        out << std::hex << hash;
+        return out.str();
+    }
+}
+
+CodeCache::CodeCache(const std::string &dir, const std::string &opts, bool positions)
+    : directory(dir), withPositions(positions)
+{
+    options = "v" + std::to_string(FORMAT_VERSION) + ";" + opts + ";compiler=" + compilerIdentity();
+    std::filesystem::create_directories(directory);
+}
+
+std::string CodeCache::hashHex(const std::string &key)
+{
+    // Two independent 64-bit FNV-1a hashes
+    uint64_t a = 1469598103934665603ull;
+    uint64_t b = 0x84222325cbf29ce4ull;
+    for (unsigned char c : key)
+    {
+        a = (a ^ c) * 1099511628211ull;
+        b = (b ^ c) * 0x100000001b3ull;
+        b ^= b >> 29;
+    }
+    std::ostringstream out;
+    out << std::hex << std::setfill('0') << std::setw(16) << a << std::setw(16) << b;
+    return out.str();
+}
+
+void CodeCache::serialize(const Expr &expr, std::string &out) const
+{
+    if (withPositions)
+    {
+        out += "@" + std::to_string(expr.pos.line) + ":" + std::to_string(expr.pos.col);
+    }
+    if (auto lit = dynamic_cast<const IntLit *>(&expr))
+    {
+        out += "I" + std::to_string(lit->value);
+    }
+    else if (auto var = dynamic_cast<const Var *>(&expr))
+    {
+        out += "V" + var->name + ";";
+    }
+    else if (auto bin = dynamic_cast<const BinOpExpr *>(&expr))
+    {
+        out += std::string("B") + binOpName(bin->op) + "(";
+        serialize(*bin->left, out);
+        out += ",";
+        serialize(*bin->right, out);
+        out += ")";
+    }
+    else if (auto un = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        out += un->op == UnOp::Neg ? "U-(" : "U!(";
+        serialize(*un->right, out);
+        out += ")";
+    }
+    else if (auto call = dynamic_cast<const Call *>(&expr))
+    {
+        out += "C" + call->name + "(";
+        for (const auto &arg : call->args)
+        {
+            serialize(*arg, out);
+            out += ",";
+        }
+        out += ")";
+    }
+}
+
+void CodeCache::serialize(const Stmt &stmt, std::string &out) const
+{
+    if (withPositions)
+    {
+        out += "@" + std::to_string(stmt.pos.line) + ":" + std::to_string(stmt.pos.col);
+    }
+    if (auto block = dynamic_cast<const Block *>(&stmt))
+    {
+        out += "{";
+        for (const auto &s : block->stmts)
+        {
+            serialize(*s, out);
+        }
+        out += "}";
+    }
+    else if (dynamic_cast<const EmptyStmt *>(&stmt))
+    {
+        out += ";";
+    }
+    else if (auto exprStmt = dynamic_cast<const ExprStmt *>(&stmt))
+    {
+        out += "E";
+        serialize(*exprStmt->expr, out);
+        out += ";";
+    }
+    else if (auto assign = dynamic_cast<const Assign *>(&stmt))
+    {
+        out += "A" + assign->name + "=";
+        serialize(*assign->value, out);
+        out += ";";
+    }
+    else if (auto decl = dynamic_cast<const Decl *>(&stmt))
+    {
+        out += "D" + decl->name + "=";
+        if (decl->value)
+        {
+            serialize(*decl->value, out);
+        }
+        out += ";";
+    }
+    else if (auto ifStmt = dynamic_cast<const If *>(&stmt))
+    {
+        out += "if(";
+        serialize(*ifStmt->condition, out);
+        out += ")";
+        serialize(*ifStmt->thenBody, out);
+        if (ifStmt->elseBody)
+        {
+            out += "else";
+            serialize(*ifStmt->elseBody, out);
+        }
+        out += ";";
+    }
+    else if (auto whileStmt = dynamic_cast<const While *>(&stmt))
+    {
+        out += "while(";
+        serialize(*whileStmt->condition, out);
+        out += ")";
+        serialize(*whileStmt->body, out);
+    }
+    else if (dynamic_cast<const Break *>(&stmt))
+    {
+        out += "break;";
+    }
+    else if (dynamic_cast<const Continue *>(&stmt))
+    {
+        out += "continue;";
+    }
+    else if (auto ret = dynamic_cast<const Return *>(&stmt))
+    {
+        out += "return";
+        if (ret->returnValue)
+        {
+            serialize(*ret->returnValue, out);
+        }
+        out += ";";
+    }
+}
+
+static void collectExprCallees(const Expr &expr, std::map<std::string, bool> &callees)
+{
+    if (auto bin = dynamic_cast<const BinOpExpr *>(&expr))
+    {
+        collectExprCallees(*bin->left, callees);
+        collectExprCallees(*bin->right, callees);
+    }
+    else if (auto un = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        collectExprCallees(*un->right, callees);
+    }
+    else if (auto call = dynamic_cast<const Call *>(&expr))
+    {
+        callees[call->name] = true;
+        for (const auto &arg : call->args)
+        {
+            collectExprCallees(*arg, callees);
+        }
+    }
+}
+
+void CodeCache::collectCallees(const Stmt &stmt, std::map<std::string, bool> &callees) const
+{
+    if (auto block = dynamic_cast<const Block *>(&stmt))
+    {
+        for (const auto &s : block->stmts)
+        {
+            collectCallees(*s, callees);
+        }
+    }
+    else if (auto exprStmt = dynamic_cast<const ExprStmt *>(&stmt))
+    {
+        collectExprCallees(*exprStmt->expr, callees);
+    }
+    else if (auto assign = dynamic_cast<const Assign *>(&stmt))
+    {
+        collectExprCallees(*assign->value, callees);
+    }
+    else if (auto decl = dynamic_cast<const Decl *>(&stmt))
+    {
+        if (decl->value)
+        {
+            collectExprCallees(*decl->value, callees);
+        }
+    }
+    else if (auto ifStmt = dynamic_cast<const If *>(&stmt))
+    {
+        collectExprCallees(*ifStmt->condition, callees);
+        collectCallees(*ifStmt->thenBody, callees);
+        if (ifStmt->elseBody)
+        {
+            collectCallees(*ifStmt->elseBody, callees);
+        }
+    }
+    else if (auto whileStmt = dynamic_cast<const While *>(&stmt))
+    {
+        collectExprCallees(*whileStmt->condition, callees);
+        collectCallees(*whileStmt->body, callees);
+    }
+    else if (auto ret = dynamic_cast<const Return *>(&stmt))
+    {
+        if (ret->returnValue)
+        {
+            collectExprCallees(*ret->returnValue, callees);
+        }
+    }
+}
+
+void CodeCache::setProgram(const Program &program)
+{
+    signatures.clear();
+    for (const auto &func : program.functions)
+    {
+        signatures[func->name] = std::string(func->rtype == RetType::Int ? "int" : "void") + "(" +
+                                 std::to_string(func->args.size()) + ")";
+    }
+}
+
+std::string CodeCache::key(const FuncDef &func) const
+{
+    std::string out = options + "\n";
+    out += std::string(func.rtype == RetType::Int ? "int " : "void ") + func.name + "(";
+    for (const auto &arg : func.args)
+    {
+        out += arg + ",";
+    }
+    out += ")";
+    if (withPositions)
+    {
+        out += "@" + std::to_string(func.pos.line) + ":" + std::to_string(func.pos.col);
+    }
+    out += "\n";
+    if (func.body)
+    {
+        serialize(*func.body, out);
+        std::map<std::string, bool> callees;
+        collectCallees(*func.body, callees);
+        out += "\ncallees:";
+        for (const auto &[name, used] : callees)
+        {
+            (void)used;
+            auto it = signatures.find(name);
+            out += name + "=" + (it == signatures.end() ? std::string("extern") : it->second) + ";";
+        }
+    }
+    return out;
+}
+
+bool CodeCache::lookup(const std::string &key, std::string &code)
+{
+    std::ifstream in(directory + "/" + hashHex(key) + ".s", std::ios::binary);
+    if (in)
+    {
+        // Entry layout: key length, newline, key, assembly
+        size_t keyLength = 0;
+        std::string storedKey;
+        if (in >> keyLength && in.get() == '\n')
+        {
+            storedKey.resize(keyLength);
+            in.read(storedKey.data(), static_cast<std::streamsize>(keyLength));
+        }
+        if (in && storedKey == key)
+        {
+            std::ostringstream rest;
+            rest << in.rdbuf();
+            code = rest.str();
+            hitCount++;
+            return true;
+        }
+    }
+    missCount++;
+    return false;
+}
+
+void CodeCache::store(const std::string &key, const std::string &code) const
+{
+    std::string path = directory + "/" + hashHex(key) + ".s";
+    std::string temp = path + ".tmp" + std::to_string(std::random_device{}());
+    {
+        std::ofstream out(temp, std::ios::binary);
+        if (!out)
+        {
+            return; // the cache is an optimization, failing to write it is not an error
+        }
+        out << key.size() << "\n" << key << code;
+    }
+    std::error_code error;
+    std::filesystem::rename(temp, path, error);
+    if (error)
+    {
+        std::filesystem::remove(temp, error);
+    }
+}
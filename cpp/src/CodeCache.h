@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <map>
+#include "ASTNode.h"
+
+// Persistent per-function assembly cache.
+//
+// The key of a function is a structural serialization of its folded FuncDef
+// (names, operators, literals, and source positions when -g is on), the
+// signatures of the functions it calls, the code generation options and a
+// hash of the back executable itself, so a rebuilt compiler never reuses
+// stale code. Entries are stored under <dir>/<hash>.s and also record the
+// full key, which is compared on lookup to rule out hash collisions.
+// Generated labels are local to their function (see Generator::uniqueLabel),
+// so cached fragments can be stitched together in any combination.
+class CodeCache
+{
+private:
+    std::string directory;
+    std::string options;                            // code generation options and compiler identity
+    std::map<std::string, std::string> signatures;  // function name -> "int(2)" / "void(0)"
+    bool withPositions = false;
+    int hitCount = 0;
+    int missCount = 0;
+
+    static std::string hashHex(const std::string &key);
+    void serialize(const Expr &expr, std::string &out) const;
+    void serialize(const Stmt &stmt, std::string &out) const;
+    void collectCallees(const Stmt &stmt, std::map<std::string, bool> &callees) const;
+
+public:
+    static const int FORMAT_VERSION = 1;
+
+    // options: every backend setting that changes the emitted code
+    CodeCache(const std::string &dir, const std::string &options, bool withPositions);
+
+    // Record the callee signatures of the program being compiled
+    void setProgram(const Program &program);
+
+    std::string key(const FuncDef &func) const;
+    bool lookup(const std::string &key, std::string &code);
+    void store(const std::string &key, const std::string &code) const;
+
+    int hits() const { return hitCount; }
+    int misses() const { return missCount; }
+};
@@ -0,0 +1,215 @@
+#include "CodegenStats.h"
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+InstCategory CodegenStats::categorize(const std::string &mnemonic)
+{
+    static const std::map<std::string, InstCategory> table = {
+        {"add", InstCategory::Alu}, {"addi", InstCategory::Alu}, {"sub", InstCategory::Alu},
+        {"neg", InstCategory::Alu}, {"and", InstCategory::Alu}, {"andi", InstCategory::Alu},
+        {"or", InstCategory::Alu}, {"ori", InstCategory::Alu}, {"xor", InstCategory::Alu},
+        {"xori", InstCategory::Alu}, {"not", InstCategory::Alu}, {"slt", InstCategory::Alu},
+        {"slti", InstCategory::Alu}, {"sltu", InstCategory::Alu}, {"sltiu", InstCategory::Alu},
+        {"seqz", InstCategory::Alu}, {"snez", InstCategory::Alu}, {"sltz", InstCategory::Alu},
+        {"sgtz", InstCategory::Alu}, {"sll", InstCategory::Alu}, {"slli", InstCategory::Alu},
+        {"srl", InstCategory::Alu}, {"srli", InstCategory::Alu}, {"sra", InstCategory::Alu},
+        {"srai", InstCategory::Alu},
+        {"mul", InstCategory::MulDiv}, {"mulh", InstCategory::MulDiv}, {"mulhu", InstCategory::MulDiv},
+        {"div", InstCategory::MulDiv}, {"divu", InstCategory::MulDiv}, {"rem", InstCategory::MulDiv},
+        {"remu", InstCategory::MulDiv},
+        {"lw", InstCategory::Load}, {"sw", InstCategory::Store},
+        {"mv", InstCategory::Move}, {"li", InstCategory::Move}, {"lui", InstCategory::Move},
+        {"beqz", InstCategory::Branch}, {"bnez", InstCategory::Branch}, {"beq", InstCategory::Branch},
+        {"bne", InstCategory::Branch}, {"blt", InstCategory::Branch}, {"bge", InstCategory::Branch},
+        {"bgt", InstCategory::Branch}, {"ble", InstCategory::Branch}, {"bltu", InstCategory::Branch},
+        {"bgeu", InstCategory::Branch}, {"bltz", InstCategory::Branch}, {"bgez", InstCategory::Branch},
+        {"blez", InstCategory::Branch}, {"bgtz", InstCategory::Branch},
+        {"j", InstCategory::Jump}, {"call", InstCategory::Call}, {"ret", InstCategory::Ret}};
+    auto it = table.find(mnemonic);
+    return it == table.end() ? InstCategory::Other : it->second;
+}
+
+const char *CodegenStats::categoryName(InstCategory category)
+{
+    switch (category)
+    {
+    case InstCategory::Alu:
+        return "alu";
+    case InstCategory::MulDiv:
+        return "muldiv";
+    case InstCategory::Load:
+        return "load";
+    case InstCategory::Store:
+        return "store";
+    case InstCategory::Move:
+        return "move";
+    case InstCategory::Branch:
+        return "branch";
+    case InstCategory::Jump:
+        return "jump";
+    case InstCategory::Call:
+        return "call";
+    case InstCategory::Ret:
+        return "ret";
+    default:
+        return "other";
+    }
+}
+
+void CodegenStats::scanAssembly(FunctionStats &func, const std::string &code) const
+{
+    std::istringstream in(code);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '.' || line[start] == '#')
+        {
+            continue; // blank line or directive
+        }
+        size_t end = line.find_last_not_of(" \t\r");
+        if (line[end] == ':')
+        {
+            if (line.substr(start, end - start) != func.name)
+            {
+                func.labels++;
+            }
+            continue;
+        }
+        size_t stop = line.find_first_of(" \t", start);
+        std::string mnemonic = line.substr(start, stop == std::string::npos ? std::string::npos : stop - start);
+        func.instCount[categorize(mnemonic)]++;
+        func.totalInsts++;
+    }
+}
+
+void CodegenStats::addFunction(const FunctionStats &func)
+{
+    indexOf[func.name] = functions.size();
+    functions.push_back(func);
+}
+
+int CodegenStats::stackDepth(const std::string &name, std::map<std::string, int> &memo,
+                             std::set<std::string> &visiting) const
+{
+    auto cached = memo.find(name);
+    if (cached != memo.end())
+    {
+        return cached->second;
+    }
+    auto idx = indexOf.find(name);
+    if (idx == indexOf.end())
+    {
+        return 0; // external callee, its frame is unknown
+    }
+    if (visiting.count(name))
+    {
+        return -1; // back edge in the call graph
+    }
+    visiting.insert(name);
+    const FunctionStats &func = functions[idx->second];
+    int deepest = 0;
+    bool unbounded = false;
+    for (const auto &callee : func.callSites)
+    {
+        int depth = stackDepth(callee, memo, visiting);
+        if (depth < 0)
+        {
+            unbounded = true;
+            break;
+        }
+        deepest = std::max(deepest, depth);
+    }
+    visiting.erase(name);
+    int result = unbounded ? -1 : func.frameSize + deepest;
+    memo[name] = result;
+    return result;
+}
+
+void CodegenStats::report(std::ostream &out) const
+{
+    static const InstCategory categories[] = {
+        InstCategory::Alu, InstCategory::MulDiv, InstCategory::Load, InstCategory::Store,
+        InstCategory::Move, InstCategory::Branch, InstCategory::Jump, InstCategory::Call,
+        InstCategory::Ret, InstCategory::Other};
+
+    std::map<std::string, int> memo;
+    for (const auto &func : functions)
+    {
+        std::set<std::string> visiting;
+        int depth = stackDepth(func.name, memo, visiting);
+
+        out << "function " << func.name << "\n";
+        out << "  instructions " << func.totalInsts << " (";
+        bool first = true;
+        for (InstCategory category : categories)
+        {
+            auto it = func.instCount.find(category);
+            if (it == func.instCount.end())
+            {
+                continue;
+            }
+            out << (first ? "" : ", ") << categoryName(category) << " " << it->second;
+            first = false;
+        }
+        out << ")\n";
+        out << "  lw " << (func.instCount.count(InstCategory::Load) ? func.instCount.at(InstCategory::Load) : 0)
+            << ", sw " << (func.instCount.count(InstCategory::Store) ? func.instCount.at(InstCategory::Store) : 0)
+            << "\n";
+        out << "  spills " << func.spills << ", rematerialized " << func.remats << ", caller-save stores "
+            << func.callerSaveStores << "\n";
+        out << "  frame " << func.frameSize << " bytes";
+        if (func.unsharedFrameSize > func.frameSize)
+        {
+            out << " (" << func.unsharedFrameSize << " without stack slot reuse)";
+        }
+        out << ", labels " << func.labels
+            << ", call sites " << func.callSites.size() << "\n";
+        if (!func.peephole.empty())
+        {
+            out << "  peephole";
+            for (const auto &[rule, count] : func.peephole)
+            {
+                out << " " << rule << " " << count;
+            }
+            out << "\n";
+        }
+        out << "  max stack depth ";
+        if (depth < 0)
+        {
+            out << "unbounded (recursion)\n";
+        }
+        else
+        {
+            out << depth << " bytes\n";
+        }
+    }
+    int frames = 0, unshared = 0;
+    std::map<std::string, int> peephole;
+    for (const auto &func : functions)
+    {
+        frames += func.frameSize;
+        unshared += std::max(func.unsharedFrameSize, func.frameSize);
+        for (const auto &[rule, count] : func.peephole)
+        {
+            peephole[rule] += count;
+        }
+    }
+    if (!peephole.empty())
+    {
+        int total = 0;
+        out << "peephole:";
+        for (const auto &[rule, count] : peephole)
+        {
+            out << " " << rule << " " << count;
+            total += count;
+        }
+        out << " (" << total << " total)\n";
+    }
+    if (unshared > frames)
+    {
+        out << "stack slot reuse: frames " << unshared << " -> " << frames << " bytes (saved " << unshared - frames
+            << ")\n";
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+// Instruction categories used by the per-function report
+enum class InstCategory
+{
+    Alu,    // add/sub/slt/xori/seqz ...
+    MulDiv, // mul/div/rem
+    Load,   // lw
+    Store,  // sw
+    Move,   // mv/li/lui
+    Branch, // beqz/bnez/beq/blt ...
+    Jump,   // j
+    Call,   // call
+    Ret,    // ret
+    Other
+};
+
+// Statistics collected by Generator for a single function
+struct FunctionStats
+{
+    std::string name;
+    std::map<InstCategory, int> instCount; // instructions emitted by category
+    int totalInsts = 0;
+    int spills = 0;           // registers spilled by allocWithSpill
+    int remats = 0;           // spilled values recomputed instead of stored and reloaded
+    int callerSaveStores = 0; // caller-saved registers stored around calls
+    int frameSize = 0;        // final frame size in bytes
+    int unsharedFrameSize = 0; // frame size if no stack slot were reused (0: same as frameSize)
+    int labels = 0;           // labels emitted (excluding the function label)
+    std::map<std::string, int> peephole; // peephole rule -> times it fired
+    std::vector<std::string> callSites; // callee of every call site
+};
+
+class CodegenStats
+{
+private:
+    std::vector<FunctionStats> functions;
+    std::map<std::string, size_t> indexOf;
+
+    // Worst-case stack depth of a function; -1 means unbounded (recursion)
+    int stackDepth(const std::string &name, std::map<std::string, int> &memo,
+                   std::set<std::string> &visiting) const;
+
+public:
+    static InstCategory categorize(const std::string &mnemonic);
+    static const char *categoryName(InstCategory category);
+
+    // Count every instruction and label line of an emitted function body
+    void scanAssembly(FunctionStats &func, const std::string &code) const;
+    void addFunction(const FunctionStats &func);
+    const std::vector<FunctionStats> &getFunctions() const { return functions; }
+
+    void report(std::ostream &out) const;
+};
@@ -0,0 +1,239 @@
+#include "ElfWriter.h"
+#include <map>
+#include <stdexcept>
+
+namespace
+{
+    // Little-endian byte buffer
+    class ByteBuffer
+    {
+    public:
+        std::vector<uint8_t> bytes;
+
+        void u8(uint8_t v) { bytes.push_back(v); }
+        void u16(uint16_t v)
+        {
+            u8(v & 0xff);
+            u8(v >> 8);
+        }
+        void u32(uint32_t v)
+        {
+            u16(v & 0xffff);
+            u16(v >> 16);
+        }
+        void append(const std::vector<uint8_t> &other) { bytes.insert(bytes.end(), other.begin(), other.end()); }
+        void alignTo(size_t alignment)
+        {
+            while (bytes.size() % alignment)
+                u8(0);
+        }
+        uint32_t size() const { return static_cast<uint32_t>(bytes.size()); }
+    };
+
+    class StringTable
+    {
+    public:
+        ByteBuffer buffer;
+        StringTable() { buffer.u8(0); }
+        uint32_t add(const std::string &s)
+        {
+            uint32_t offset = buffer.size();
+            for (char c : s)
+                buffer.u8(static_cast<uint8_t>(c));
+            buffer.u8(0);
+            return offset;
+        }
+    };
+
+    struct SectionHeader
+    {
+        uint32_t name = 0, type = 0, flags = 0, addr = 0, offset = 0, size = 0, link = 0, info = 0, align = 0,
+                 entsize = 0;
+    };
+
+    enum : uint32_t
+    {
+        SHT_PROGBITS = 1,
+        SHT_SYMTAB = 2,
+        SHT_STRTAB = 3,
+        SHT_RELA = 4,
+        SHF_WRITE = 1,
+        SHF_ALLOC = 2,
+        SHF_EXECINSTR = 4,
+        SHF_INFO_LINK = 0x40,
+        EM_RISCV = 243,
+    };
+}
+
+void writeElf(std::ostream &out, const ElfImage &image)
+{
+    // Section indices: 1 .text, 2 .data, 3 .symtab, 4 .strtab, [5 .rela.text], last .shstrtab
+    const bool hasRela = !image.executable && !image.relocations.empty();
+    const uint32_t shnum = hasRela ? 7 : 6;
+    StringTable shstrtab;
+    StringTable strtab;
+
+    ByteBuffer file;
+    uint32_t headerSize = image.executable ? elfExecutableHeaderSize : 52;
+    file.bytes.resize(headerSize, 0);
+
+    uint32_t textOffset = file.size();
+    file.append(image.text);
+    file.alignTo(4);
+    uint32_t dataOffset = file.size();
+    file.append(image.data);
+    uint32_t loadEnd = file.size();
+    file.alignTo(4);
+
+    // Symbol table: null, section symbols, locals, globals
+    std::vector<const ElfSymbol *> ordered;
+    for (const auto &sym : image.symbols)
+        if (!sym.global)
+            ordered.push_back(&sym);
+    uint32_t firstGlobal = 3 + static_cast<uint32_t>(ordered.size());
+    for (const auto &sym : image.symbols)
+        if (sym.global)
+            ordered.push_back(&sym);
+    std::map<std::string, uint32_t> symbolIndex;
+    uint32_t symtabOffset = file.size();
+    for (int i = 0; i < 4; i++)
+        file.u32(0); // null symbol
+    for (uint16_t section : {1, 2})
+    {
+        file.u32(0);
+        file.u32(image.executable ? (section == 1 ? image.textAddress : image.dataAddress) : 0);
+        file.u32(0);
+        file.u8(3); // STB_LOCAL, STT_SECTION
+        file.u8(0);
+        file.u16(section);
+    }
+    uint32_t index = 3;
+    for (const ElfSymbol *sym : ordered)
+    {
+        symbolIndex[sym->name] = index++;
+        file.u32(strtab.add(sym->name));
+        file.u32(sym->value);
+        file.u32(0);
+        uint8_t type = sym->function ? 2 : (sym->section == 2 ? 1 : 0);
+        file.u8(static_cast<uint8_t>((sym->global ? 1 : 0) << 4 | type));
+        file.u8(0);
+        file.u16(static_cast<uint16_t>(sym->section));
+    }
+    uint32_t symtabSize = file.size() - symtabOffset;
+
+    uint32_t strtabOffset = file.size();
+    file.append(strtab.buffer.bytes);
+    file.alignTo(4);
+
+    uint32_t relaOffset = file.size();
+    if (hasRela)
+    {
+        for (const auto &rel : image.relocations)
+        {
+            auto it = symbolIndex.find(rel.symbol);
+            if (it == symbolIndex.end())
+            {
+                throw std::runtime_error("Relocation against unknown symbol " + rel.symbol);
+            }
+            file.u32(rel.offset);
+            file.u32(it->second << 8 | static_cast<uint32_t>(rel.type));
+            file.u32(static_cast<uint32_t>(rel.addend));
+        }
+    }
+    uint32_t relaSize = file.size() - relaOffset;
+
+    std::vector<SectionHeader> headers(shnum);
+    SectionHeader &text = headers[1];
+    text.name = shstrtab.add(".text");
+    text.type = SHT_PROGBITS;
+    text.flags = SHF_ALLOC | SHF_EXECINSTR;
+    text.addr = image.executable ? image.textAddress : 0;
+    text.offset = textOffset;
+    text.size = static_cast<uint32_t>(image.text.size());
+    text.align = 4;
+    SectionHeader &data = headers[2];
+    data.name = shstrtab.add(".data");
+    data.type = SHT_PROGBITS;
+    data.flags = SHF_ALLOC | SHF_WRITE;
+    data.addr = image.executable ? image.dataAddress : 0;
+    data.offset = dataOffset;
+    data.size = static_cast<uint32_t>(image.data.size());
+    data.align = 4;
+    SectionHeader &symtab = headers[3];
+    symtab.name = shstrtab.add(".symtab");
+    symtab.type = SHT_SYMTAB;
+    symtab.offset = symtabOffset;
+    symtab.size = symtabSize;
+    symtab.link = 4;
+    symtab.info = firstGlobal;
+    symtab.align = 4;
+    symtab.entsize = 16;
+    SectionHeader &strings = headers[4];
+    strings.name = shstrtab.add(".strtab");
+    strings.type = SHT_STRTAB;
+    strings.offset = strtabOffset;
+    strings.size = strtab.buffer.size();
+    strings.align = 1;
+    if (hasRela)
+    {
+        SectionHeader &rela = headers[5];
+        rela.name = shstrtab.add(".rela.text");
+        rela.type = SHT_RELA;
+        rela.flags = SHF_INFO_LINK;
+        rela.offset = relaOffset;
+        rela.size = relaSize;
+        rela.link = 3;
+        rela.info = 1;
+        rela.align = 4;
+        rela.entsize = 12;
+    }
+    SectionHeader &names = headers[shnum - 1];
+    names.name = shstrtab.add(".shstrtab");
+    names.type = SHT_STRTAB;
+    names.offset = file.size();
+    names.size = shstrtab.buffer.size();
+    names.align = 1;
+    file.append(shstrtab.buffer.bytes);
+    file.alignTo(4);
+
+    uint32_t shoff = file.size();
+    for (const auto &sh : headers)
+    {
+        for (uint32_t field : {sh.name, sh.type, sh.flags, sh.addr, sh.offset, sh.size, sh.link, sh.info, sh.align,
+                               sh.entsize})
+        {
+            file.u32(field);
+        }
+    }
+
+    // ELF header
+    ByteBuffer header;
+    for (uint8_t b : {0x7f, 0x45, 0x4c, 0x46, 1 /* ELFCLASS32 */, 1 /* little endian */, 1 /* version */})
+        header.u8(b);
+    while (header.size() < 16)
+        header.u8(0);
+    header.u16(image.executable ? 2 : 1); // ET_EXEC / ET_REL
+    header.u16(EM_RISCV);
+    header.u32(1);
+    header.u32(image.executable ? image.entry : 0);
+    header.u32(image.executable ? 52 : 0); // e_phoff
+    header.u32(shoff);
+    header.u32(image.flags);
+    header.u16(52);
+    header.u16(image.executable ? 32 : 0);
+    header.u16(image.executable ? 1 : 0);
+    header.u16(40);
+    header.u16(static_cast<uint16_t>(shnum));
+    header.u16(static_cast<uint16_t>(shnum - 1));
+    if (image.executable)
+    {
+        // One RWX PT_LOAD segment mapping headers, text and data
+        uint32_t base = image.textAddress - elfExecutableHeaderSize;
+        for (uint32_t field : {1u /* PT_LOAD */, 0u, base, base, loadEnd, loadEnd, 7u /* RWX */, 0x1000u})
+        {
+            header.u32(field);
+        }
+    }
+    std::copy(header.bytes.begin(), header.bytes.end(), file.bytes.begin());
+    out.write(reinterpret_cast<const char *>(file.bytes.data()), file.bytes.size());
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// RISC-V relocation types used in relocatable objects
+enum class RelocType : uint32_t
+{
+    Call = 19,       // R_RISCV_CALL_PLT on an auipc+jalr pair
+    PcrelHi20 = 23,  // R_RISCV_PCREL_HI20 on auipc
+    PcrelLo12I = 24, // R_RISCV_PCREL_LO12_I on addi, the symbol labels the auipc
+};
+
+struct Relocation
+{
+    uint32_t offset; // in .text
+    RelocType type;
+    std::string symbol;
+    int32_t addend = 0;
+};
+
+struct ElfSymbol
+{
+    std::string name;
+    int section = 0;    // 0 undefined, 1 .text, 2 .data
+    uint32_t value = 0; // section offset in objects, address in executables
+    bool global = false;
+    bool function = false;
+};
+
+// Contents of an ELF32 little-endian RISC-V file with a .text and a .data section
+struct ElfImage
+{
+    bool executable = false;
+    uint32_t flags = 0;       // e_flags (EF_RISCV_RVC etc.)
+    uint32_t entry = 0;       // executables only
+    uint32_t textAddress = 0; // executables only
+    uint32_t dataAddress = 0;
+    std::vector<uint8_t> text;
+    std::vector<uint8_t> data;
+    std::vector<ElfSymbol> symbols;
+    std::vector<Relocation> relocations; // objects only, all against .text
+};
+
+// Size of the ELF header plus the single program header of an executable;
+// the text of an executable starts right after them
+constexpr uint32_t elfExecutableHeaderSize = 52 + 32;
+
+void writeElf(std::ostream &out, const ElfImage &image);
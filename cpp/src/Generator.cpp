@@ -1,58 +1,109 @@
 #include "Generator.h"
-static int globalLabelCount = 0;
+#include "InstSelect.h"
+#include "Peephole.h"
+#include <algorithm>
+// A then branch is moved out of line when it runs less than 1/COLD_RATIO
+// as often as it is skipped
+static constexpr uint64_t COLD_RATIO = 4;
 Generator::Generator(std::ostream &out) : output(out), regManager(){}
-std::string Generator::uniqueLabel(const std::string &prefix)
+// Labels are numbered per function so a function's code does not depend on
+// the functions generated before it
+std::string Generator::uniqueLabel(FunctionContext &ctx, const std::string &prefix)
 {
-    return prefix + std::to_string(globalLabelCount++);
+    return ctx.name + "_" + prefix + std::to_string(ctx.labelCount++);
 }
-auto Generator::allocWithSpill(RegType type, Stmt *stmt, FunctionContext &ctx) {
-    static std::string lastSpilledReg;
-    try{
-        std::string reg = regManager.alloc(type);
-        return reg;
-    } catch (const std::runtime_error &e) {
-        std::vector<std::string> usedRegs = regManager.getUsedRegisters();
-        std::set<std::string> liveVars;
-        if(stmt && !stmt->liveVars.empty()){
-            liveVars.insert(stmt->liveVars.begin(), stmt->liveVars.end());
-        }
-        std::string spillReg;
-        for (const auto &reg : usedRegs) {
-            if(regManager.getRegType(reg) == type && liveVars.find(reg) == liveVars.end() && reg != lastSpilledReg) {
-                spillReg = reg;
-                break;
-            }
-        }
-        if(spillReg.empty()) {
-            for(const auto &reg : usedRegs) {
-                if(regManager.getRegType(reg) == type && reg != lastSpilledReg) {
-                    spillReg = reg;
-                    break;
-                }
-            }
+auto Generator::allocWithSpill(RegType type, FunctionContext &ctx) {
+    if (!regManager.hasAvailable(type) && !evictPendingOperand(type, ctx)) {
+        throw std::runtime_error("No available register for spilling");
+    }
+    std::string reg = regManager.alloc(type);
+    if (type == RegType::SAVE) {
+        ctx.addSavedReg(reg);
+    }
+    return reg;
+}
+// 寄存器不足时先让出等待中的操作数：常量和变量在使用前用一条 li/lw 重新算出（不需要存），
+// 其余的值才写到溢出槽。越靠外的操作数越晚才用到，优先让出
+bool Generator::evictPendingOperand(RegType type, FunctionContext &ctx)
+{
+    PendingOperand *victim = nullptr;
+    for (auto &operand : pendingOperands) {
+        if (operand.evicted || regManager.getRegType(operand.reg) != type) {
+            continue;
         }
-        if(spillReg.empty()) {
-            for(const auto &reg : usedRegs) {
-                if(regManager.getRegType(reg) == type) {
-                    spillReg = reg;
-                    break;
-                }
-            }
+        bool remat = dynamic_cast<const IntLit *>(operand.expr) || dynamic_cast<const Var *>(operand.expr);
+        if (remat) {
+            victim = &operand;
+            break;
         }
-        if(spillReg.empty()) {
-            throw std::runtime_error("No available register for spilling");
+        if (!victim) {
+            victim = &operand;
         }
-        int offset;
-        offset = ctx.stackSize; 
-        ctx.stackSize += 4; 
-        output<< "sw " << spillReg << ", " << offset << "(sp)\n"; // Store register value to stack
-        regManager.spill(spillReg, offset); // Mark register as spilled
-        regManager.release(spillReg); // Release the register
-        lastSpilledReg = spillReg;
-        std::string newReg = regManager.alloc(type);
-        return newReg; // Allocate a new register
     }
-
+    if (!victim) {
+        return false;
+    }
+    if (dynamic_cast<const IntLit *>(victim->expr) || dynamic_cast<const Var *>(victim->expr)) {
+        ctx.rematCount++;
+    } else {
+        victim->spillOffset = allocateVar(ctx);
+        output << "sw " << victim->reg << ", " << victim->spillOffset << "(sp)\n";
+        ctx.spillCount++;
+    }
+    victim->evicted = true;
+    regManager.release(victim->reg);
+    return true;
+}
+void Generator::reloadOperand(const PendingOperand &operand, FunctionContext &ctx, const std::string &reg)
+{
+    if (operand.spillOffset >= 0) {
+        output << "lw " << reg << ", " << operand.spillOffset << "(sp)\n";
+    } else {
+        generateExpr(*operand.expr, ctx, reg);
+    }
+}
+// Emit a .loc directive mapping the following instructions to a source position
+void Generator::emitLoc(const SourcePos &pos)
+{
+    if (!debugInfo || pos.line <= 0)
+    {
+        return;
+    }
+    if (pos.line == lastLoc.line && pos.col == lastLoc.col)
+    {
+        return;
+    }
+    output << ".loc 1 " << pos.line << " " << pos.col << "\n";
+    lastLoc = pos;
+}
+// Copy code generation options into a helper generator writing to another stream
+void Generator::inheritOptions(const Generator &parent)
+{
+    stats = parent.stats;
+    debugInfo = parent.debugInfo;
+    sourceName = parent.sourceName;
+    profile = parent.profile;
+    instrument = parent.instrument;
+    profileDumpPath = parent.profileDumpPath;
+    slotReuse = parent.slotReuse;
+    ifConversion = parent.ifConversion;
+    peephole = parent.peephole;
+}
+// Increment the 32-bit profile counter of a site
+void Generator::emitCounter(int site)
+{
+    if (!instrument || site < 0)
+    {
+        return;
+    }
+    std::string addrReg = regManager.alloc(RegType::TEMP);
+    std::string valueReg = regManager.alloc(RegType::TEMP);
+    output << "la " << addrReg << ", __toyc_prof+" << site * 4 << "\n";
+    output << "lw " << valueReg << ", 0(" << addrReg << ")\n";
+    output << "addi " << valueReg << ", " << valueReg << ", 1\n";
+    output << "sw " << valueReg << ", 0(" << addrReg << ")\n";
+    regManager.release(valueReg);
+    regManager.release(addrReg);
 }
 // Allocate a variable in the current function context
 int Generator::allocateVar(FunctionContext &ctx, const std::string &name)
@@ -60,19 +111,317 @@ int Generator::allocateVar(FunctionContext &ctx, const std::string &name)
     (void)name;
     int offset = ctx.stackSize;
     ctx.stackSize += 4;
+    ctx.slotBytes += 4;
+    ctx.stackHigh = std::max(ctx.stackHigh, ctx.stackSize);
     return offset;
 }
-void Generator::generateExpr(const Expr &expr, FunctionContext &ctx, const std::string &destReg)
+// 栈槽按作用域和语句回收：块结束后其中声明的变量、语句结束后表达式的溢出槽都不再存活，
+// 之后的兄弟块和语句从同一位置重新分配；帧大小取分配过程中的最高水位
+void Generator::releaseSlots(FunctionContext &ctx, int mark)
+{
+    if (slotReuse && mark < ctx.stackSize)
+    {
+        ctx.stackSize = mark;
+    }
+}
+bool Generator::isZero(const Expr &expr)
+{
+    const auto *lit = dynamic_cast<const IntLit *>(&expr);
+    return lit && lit->value == 0;
+}
+int Generator::registerNeed(const Expr &expr)
+{
+    if (const auto *binop = dynamic_cast<const BinOpExpr *>(&expr))
+    {
+        int left = registerNeed(*binop->left);
+        int right = registerNeed(*binop->right);
+        if (binop->op == BinOp::And || binop->op == BinOp::Or)
+        {
+            return std::max(left, right); // both sides go to the destination in turn
+        }
+        // A constant folded into an immediate takes no register
+        BinOp mirrored = binop->op;
+        const auto *rightLit = dynamic_cast<const IntLit *>(binop->right.get());
+        const auto *leftLit = dynamic_cast<const IntLit *>(binop->left.get());
+        if (rightLit && hasImmediateForm(binop->op, rightLit->value))
+        {
+            return left;
+        }
+        if (leftLit && mirrorOperator(mirrored) && hasImmediateForm(mirrored, leftLit->value))
+        {
+            return right;
+        }
+        // ... and a strength-reduced one needs two scratch registers beside the destination
+        if (rightLit && hasStrengthReduction(binop->op, rightLit->value))
+        {
+            return std::max(left, 3);
+        }
+        if (leftLit && binop->op == BinOp::Mul && hasStrengthReduction(BinOp::Mul, leftLit->value))
+        {
+            return std::max(right, 3);
+        }
+        return left == right ? left + 1 : std::max(left, right);
+    }
+    if (const auto *unop = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        return registerNeed(*unop->right);
+    }
+    if (const auto *call = dynamic_cast<const Call *>(&expr))
+    {
+        int most = 1;
+        for (const auto &arg : call->args)
+        {
+            most = std::max(most, registerNeed(*arg));
+        }
+        return most;
+    }
+    return 1;
+}
+bool Generator::containsCall(const Expr &expr)
+{
+    if (dynamic_cast<const Call *>(&expr))
+    {
+        return true;
+    }
+    if (const auto *binop = dynamic_cast<const BinOpExpr *>(&expr))
+    {
+        return containsCall(*binop->left) || containsCall(*binop->right);
+    }
+    if (const auto *unop = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        return containsCall(*unop->right);
+    }
+    return false;
+}
+size_t Generator::maxStackArgs(const Expr &expr)
 {
-    generateExprWithOffset(expr, ctx, destReg, 0);
+    if (const auto *call = dynamic_cast<const Call *>(&expr))
+    {
+        size_t most = call->args.size() > 8 ? call->args.size() - 8 : 0;
+        for (const auto &arg : call->args)
+        {
+            most = std::max(most, maxStackArgs(*arg));
+        }
+        return most;
+    }
+    if (const auto *binop = dynamic_cast<const BinOpExpr *>(&expr))
+    {
+        return std::max(maxStackArgs(*binop->left), maxStackArgs(*binop->right));
+    }
+    if (const auto *unop = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        return maxStackArgs(*unop->right);
+    }
+    return 0;
+}
+size_t Generator::maxStackArgs(const Stmt &stmt)
+{
+    if (const auto *block = dynamic_cast<const Block *>(&stmt))
+    {
+        size_t most = 0;
+        for (const auto &s : block->stmts)
+        {
+            most = std::max(most, maxStackArgs(*s));
+        }
+        return most;
+    }
+    if (const auto *exprStmt = dynamic_cast<const ExprStmt *>(&stmt))
+    {
+        return maxStackArgs(*exprStmt->expr);
+    }
+    if (const auto *assign = dynamic_cast<const Assign *>(&stmt))
+    {
+        return maxStackArgs(*assign->value);
+    }
+    if (const auto *decl = dynamic_cast<const Decl *>(&stmt))
+    {
+        return decl->value ? maxStackArgs(*decl->value) : 0;
+    }
+    if (const auto *ifStmt = dynamic_cast<const If *>(&stmt))
+    {
+        size_t most = std::max(maxStackArgs(*ifStmt->condition), maxStackArgs(*ifStmt->thenBody));
+        return ifStmt->elseBody ? std::max(most, maxStackArgs(*ifStmt->elseBody)) : most;
+    }
+    if (const auto *whileStmt = dynamic_cast<const While *>(&stmt))
+    {
+        return std::max(maxStackArgs(*whileStmt->condition), maxStackArgs(*whileStmt->body));
+    }
+    if (const auto *returnStmt = dynamic_cast<const Return *>(&stmt))
+    {
+        return returnStmt->returnValue ? maxStackArgs(*returnStmt->returnValue) : 0;
+    }
+    return 0;
 }
 
-// 新增：带sp偏移的表达式生成
-void Generator::generateExprWithOffset(const Expr &expr, FunctionContext &ctx, const std::string &destReg, int extraSpOffset)
+Generator::OperandRegs Generator::generateOperands(const Expr &left, const Expr &right, FunctionContext &ctx,
+                                                   const std::string &destReg)
+{
+    // Sethi-Ullman：两边都不含调用时先求需要寄存器多的一边。先求的一边直接放进目标寄存器，
+    // 只有另一边占一个新寄存器，所以表达式向左还是向右生长不再决定是否溢出
+    bool pure = !containsCall(left) && !containsCall(right);
+    bool rightFirst = pure && registerNeed(right) > registerNeed(left);
+    const Expr &first = rightFirst ? right : left;
+    const Expr &second = rightFirst ? left : right;
+    // 后求的一边含调用时，先求的值要跨过调用存活，放进 s 寄存器（序言中保存一次），调用处无需保存
+    std::string firstReg = destReg;
+    bool ownFirst = containsCall(second) && regManager.hasAvailable(RegType::SAVE);
+    if (ownFirst) {
+        firstReg = allocWithSpill(RegType::SAVE, ctx);
+    }
+    generateExpr(first, ctx, firstReg);
+    pendingOperands.push_back({firstReg, &first});
+    // 先求的一边在 s 寄存器中时，目标寄存器还空着，另一边直接求值到那里
+    std::string secondReg = ownFirst ? destReg : allocWithSpill(RegType::TEMP, ctx);
+    generateExpr(second, ctx, secondReg);
+    PendingOperand held = pendingOperands.back();
+    pendingOperands.pop_back();
+    if (held.evicted) {
+        // 目标寄存器在求另一边时被让出了（s 寄存器只在有空闲时才分配，不会被让出），
+        // 收回它并重新放入先求的值
+        regManager.alloc(destReg);
+        reloadOperand(held, ctx, destReg);
+        firstReg = destReg;
+    }
+    OperandRegs regs;
+    regs.lhs = rightFirst ? secondReg : firstReg;
+    regs.rhs = rightFirst ? firstReg : secondReg;
+    regs.owned = ownFirst ? held.reg : secondReg;
+    return regs;
+}
+const Assign *Generator::singleAssign(const Stmt &stmt)
+{
+    if (const auto *block = dynamic_cast<const Block *>(&stmt))
+    {
+        return block->stmts.size() == 1 ? singleAssign(*block->stmts[0]) : nullptr;
+    }
+    return dynamic_cast<const Assign *>(&stmt);
+}
+// if-conversion：两边都只给同一个变量赋一个便宜、无副作用的值时，两个值都求出来，
+// 用条件得到的掩码（真为全 1，假为 0）选择：x = b + ((a - b) & mask)，没有分支
+bool Generator::generateSelect(const If &ifStmt, FunctionContext &ctx)
+{
+    const Assign *thenAssign = singleAssign(*ifStmt.thenBody);
+    const Assign *elseAssign = ifStmt.elseBody ? singleAssign(*ifStmt.elseBody) : nullptr;
+    if (!thenAssign || (ifStmt.elseBody && (!elseAssign || elseAssign->name != thenAssign->name)))
+    {
+        return false;
+    }
+    int offset = ctx.findVar(thenAssign->name);
+    if (offset == -1)
+    {
+        return false;
+    }
+    Var current(thenAssign->name); // 没有 else 时另一个值就是变量原来的值
+    const Expr &thenValue = *thenAssign->value;
+    const Expr &elseValue = elseAssign ? *elseAssign->value : current;
+    int thenCost = speculationCost(thenValue);
+    int elseCost = speculationCost(elseValue);
+    bool boolean = isBooleanExpr(*ifStmt.condition);
+    if (thenCost < 0 || elseCost < 0 || thenCost + elseCost + SELECT_COST + !boolean > BRANCHLESS_BUDGET)
+    {
+        return false;
+    }
+    int mark = ctx.stackSize;
+    std::string maskReg = allocWithSpill(RegType::TEMP, ctx);
+    generateExpr(*ifStmt.condition, ctx, maskReg);
+    if (!boolean)
+    {
+        output << "snez " << maskReg << ", " << maskReg << "\n";
+    }
+    output << "neg " << maskReg << ", " << maskReg << "\n";
+    pendingOperands.push_back({maskReg, nullptr});
+    std::string valueReg = allocWithSpill(RegType::TEMP, ctx);
+    OperandRegs regs = generateOperands(thenValue, elseValue, ctx, valueReg);
+    PendingOperand held = pendingOperands.back();
+    pendingOperands.pop_back();
+    if (held.evicted)
+    {
+        maskReg = allocWithSpill(RegType::TEMP, ctx);
+        reloadOperand(held, ctx, maskReg);
+    }
+    output << "sub " << regs.lhs << ", " << regs.lhs << ", " << regs.rhs << "\n";
+    output << "and " << regs.lhs << ", " << regs.lhs << ", " << maskReg << "\n";
+    output << "add " << regs.lhs << ", " << regs.lhs << ", " << regs.rhs << "\n";
+    output << "sw " << regs.lhs << ", " << offset << "(sp)\n";
+    regManager.release(regs.owned);
+    regManager.release(valueReg);
+    regManager.release(maskReg);
+    releaseSlots(ctx, mark);
+    return true;
+}
+// 条件直接编译成比较分支：关系运算用 blt/bge/beq/bne（与零比较用 bltz/beqz 等，即 x0），
+// ! 交换真假出口，&& 和 || 逐项跳转，除非条件本身是其他表达式，否则不产生 0/1 值
+void Generator::generateBranch(const Expr &cond, FunctionContext &ctx, const std::string &target, bool jumpIf)
+{
+    if (const auto *lit = dynamic_cast<const IntLit *>(&cond))
+    {
+        if ((lit->value != 0) == jumpIf)
+        {
+            output << "j " << target << "\n";
+        }
+        return;
+    }
+    if (const auto *unop = dynamic_cast<const UnOpExpr *>(&cond); unop && unop->op == UnOp::Not)
+    {
+        generateBranch(*unop->right, ctx, target, !jumpIf);
+        return;
+    }
+    const auto *binop = dynamic_cast<const BinOpExpr *>(&cond);
+    if (binop && (binop->op == BinOp::And || binop->op == BinOp::Or))
+    {
+        bool isAnd = binop->op == BinOp::And;
+        if (isAnd != jumpIf)
+        {
+            // a && b 为假、a || b 为真：任一项成立就跳到目标
+            generateBranch(*binop->left, ctx, target, jumpIf);
+            generateBranch(*binop->right, ctx, target, jumpIf);
+            return;
+        }
+        // 否则第一项不成立时跳过第二项
+        std::string skipLabel = uniqueLabel(ctx, isAnd ? "and_skip_" : "or_skip_");
+        generateBranch(*binop->left, ctx, skipLabel, !jumpIf);
+        generateBranch(*binop->right, ctx, target, jumpIf);
+        output << skipLabel << ":\n";
+        return;
+    }
+    std::string condReg = allocWithSpill(RegType::TEMP, ctx);
+    if (!binop || binop->op < BinOp::Lt || binop->op > BinOp::Ne)
+    {
+        generateExpr(cond, ctx, condReg);
+        output << (jumpIf ? "bnez " : "beqz ") << condReg << ", " << target << "\n";
+        regManager.release(condReg);
+        return;
+    }
+    static const BinOp inverse[] = {BinOp::Ge, BinOp::Le, BinOp::Gt, BinOp::Lt, BinOp::Ne, BinOp::Eq};
+    BinOp op = jumpIf ? binop->op : inverse[static_cast<int>(binop->op) - static_cast<int>(BinOp::Lt)];
+    const Expr *left = binop->left.get();
+    const Expr *right = binop->right.get();
+    if (isZero(*left) && !isZero(*right))
+    {
+        mirrorOperator(op);
+        std::swap(left, right);
+    }
+    static const char *const mnemonic[] = {"blt", "bgt", "ble", "bge", "beq", "bne"};
+    int index = static_cast<int>(op) - static_cast<int>(BinOp::Lt);
+    if (isZero(*right))
+    {
+        generateExpr(*left, ctx, condReg);
+        output << mnemonic[index] << "z " << condReg << ", " << target << "\n";
+    }
+    else
+    {
+        OperandRegs regs = generateOperands(*left, *right, ctx, condReg);
+        output << mnemonic[index] << " " << regs.lhs << ", " << regs.rhs << ", " << target << "\n";
+        regManager.release(regs.owned);
+    }
+    regManager.release(condReg);
+}
+// 栈帧在序言中一次分配完毕（包括出参区），函数体内 sp 不再移动，变量偏移固定
+void Generator::generateExpr(const Expr &expr, FunctionContext &ctx, const std::string &destReg)
 {
     if (const auto intLit = dynamic_cast<const IntLit *>(&expr))
     {
-        output << "li " << destReg << "," << intLit->value << "\n";
+        emitLoadConstant(output, destReg, intLit->value);
     }
     else if (const auto *var = dynamic_cast<const Var *>(&expr))
     {
@@ -81,176 +430,263 @@ void Generator::generateExprWithOffset(const Expr &expr, FunctionContext &ctx, c
         {
             throw std::runtime_error("Variable " + var->name + " not found in context");
         }
-        output << "lw " << destReg << ", " << (offset + extraSpOffset) << "(sp)\n";
+        output << "lw " << destReg << ", " << offset << "(sp)\n";
     }
     else if (const auto *binop = dynamic_cast<const BinOpExpr *>(&expr))
     {
-        RegType regType = (binop->op == BinOp::And || binop->op == BinOp::Or) ? RegType::SAVE : RegType::TEMP;
-        std::string leftReg = allocWithSpill(regType,nullptr, ctx);
-        generateExprWithOffset(*binop->left, ctx, leftReg, extraSpOffset);
-        // short circuit evaluation
-        if (binop->op == BinOp::And)
-        {
-            std::string falseLabel = uniqueLabel("and_false_");
-            std::string endLabel = uniqueLabel("and_end_");
-            output << "beqz " << leftReg << ", " << falseLabel << "\n";
-            std::string rightReg = allocWithSpill(regType,nullptr, ctx);
-            generateExprWithOffset(*binop->right, ctx, rightReg, extraSpOffset);
-            output << "mv " << leftReg << ", " << rightReg << "\n";
-            regManager.release(rightReg);
-            output << "j " << endLabel << "\n";
-            output << falseLabel << ":\n";
-            output << "li " << leftReg << ", 0\n";
+        // 短路求值：两边先后求值到目标寄存器，左边的值在分支之后就不再需要，不必另占寄存器；
+        // 结果规范化为 0/1
+        if (binop->op == BinOp::And || binop->op == BinOp::Or)
+        {
+            bool isAnd = binop->op == BinOp::And;
+            if (ifConversion && isBranchlessLogic(*binop))
+            {
+                // 右边无副作用且足够便宜：两边都求值，用 snez 和 and/or 合成 0/1，不产生分支
+                OperandRegs regs = generateOperands(*binop->left, *binop->right, ctx, destReg);
+                bool leftBoolean = isBooleanExpr(*binop->left);
+                bool rightBoolean = isBooleanExpr(*binop->right);
+                if (isAnd)
+                {
+                    if (!leftBoolean)
+                        output << "snez " << regs.lhs << ", " << regs.lhs << "\n";
+                    if (!rightBoolean)
+                        output << "snez " << regs.rhs << ", " << regs.rhs << "\n";
+                    output << "and " << destReg << ", " << regs.lhs << ", " << regs.rhs << "\n";
+                }
+                else
+                {
+                    output << "or " << destReg << ", " << regs.lhs << ", " << regs.rhs << "\n";
+                    if (!leftBoolean || !rightBoolean)
+                        output << "snez " << destReg << ", " << destReg << "\n";
+                }
+                regManager.release(regs.owned);
+                return;
+            }
+            std::string endLabel = uniqueLabel(ctx, isAnd ? "and_end_" : "or_end_");
+            generateExpr(*binop->left, ctx, destReg);
+            output << (isAnd ? "beqz " : "bnez ") << destReg << ", " << endLabel << "\n";
+            generateExpr(*binop->right, ctx, destReg);
             output << endLabel << ":\n";
-            output << "mv " << destReg << ", " << leftReg << "\n";
-            regManager.release(leftReg);
+            output << "snez " << destReg << ", " << destReg << "\n";
+            return;
+        }
+        // 一边是常量且有立即数形式（addi/slti/xori 等，零用 x0）时，常量不占寄存器：
+        // 另一边求值到目标寄存器后一条（或两条）指令算出结果
+        const auto *rightLit = dynamic_cast<const IntLit *>(binop->right.get());
+        const auto *leftLit = dynamic_cast<const IntLit *>(binop->left.get());
+        BinOp mirrored = binop->op;
+        if (rightLit && hasImmediateForm(binop->op, rightLit->value))
+        {
+            generateExpr(*binop->left, ctx, destReg);
+            emitImmediateOp(output, binop->op, destReg, destReg, rightLit->value);
+            return;
+        }
+        if (leftLit && !rightLit && mirrorOperator(mirrored) && hasImmediateForm(mirrored, leftLit->value))
+        {
+            generateExpr(*binop->right, ctx, destReg);
+            emitImmediateOp(output, mirrored, destReg, destReg, leftLit->value);
+            return;
+        }
+        // 乘、除、取模常量：代价模型认为更便宜时改用移位/加法或乘高位的魔数除法，需要两个临时寄存器
+        const Expr *reduced = nullptr;
+        int32_t factor = 0;
+        if (rightLit && hasStrengthReduction(binop->op, rightLit->value))
+        {
+            reduced = binop->left.get();
+            factor = rightLit->value;
+        }
+        else if (leftLit && !rightLit && binop->op == BinOp::Mul && hasStrengthReduction(BinOp::Mul, leftLit->value))
+        {
+            reduced = binop->right.get();
+            factor = leftLit->value;
+        }
+        if (reduced)
+        {
+            generateExpr(*reduced, ctx, destReg);
+            pendingOperands.push_back({destReg, reduced});
+            std::string scratch1 = allocWithSpill(RegType::TEMP, ctx);
+            std::string scratch2 = allocWithSpill(RegType::TEMP, ctx);
+            PendingOperand held = pendingOperands.back();
+            pendingOperands.pop_back();
+            if (held.evicted) {
+                regManager.alloc(destReg);
+                reloadOperand(held, ctx, destReg);
+            }
+            emitStrengthReduced(output, binop->op, destReg, destReg, factor, scratch1, scratch2);
+            regManager.release(scratch1);
+            regManager.release(scratch2);
             return;
         }
-        std::string rightReg = allocWithSpill(regType,nullptr, ctx);
-        generateExprWithOffset(*binop->right, ctx, rightReg, extraSpOffset);
+        if (leftLit && leftLit->value == 0 && binop->op == BinOp::Sub)
+        {
+            generateExpr(*binop->right, ctx, destReg);
+            output << "neg " << destReg << ", " << destReg << "\n"; // sub rd, x0, rs
+            return;
+        }
+        OperandRegs regs = generateOperands(*binop->left, *binop->right, ctx, destReg);
+        const std::string &lhs = regs.lhs;
+        const std::string &rhs = regs.rhs;
         switch (binop->op)
         {
         case BinOp::Add:
-            output << "add " << destReg << ", " << leftReg << ", " << rightReg << "\n";
+            output << "add " << destReg << ", " << lhs << ", " << rhs << "\n";
             break;
         case BinOp::Sub:
-            output << "sub " << destReg << ", " << leftReg << ", " << rightReg << "\n";
+            output << "sub " << destReg << ", " << lhs << ", " << rhs << "\n";
             break;
         case BinOp::Mul:
-            output << "mul " << destReg << ", " << leftReg << ", " << rightReg << "\n";
+            output << "mul " << destReg << ", " << lhs << ", " << rhs << "\n";
             break;
         case BinOp::Div:
-            output << "div " << destReg << ", " << leftReg << ", " << rightReg << "\n";
+            output << "div " << destReg << ", " << lhs << ", " << rhs << "\n";
             break;
         case BinOp::Mod:
-            output << "rem " << destReg << ", " << leftReg << ", " << rightReg << "\n";
+            output << "rem " << destReg << ", " << lhs << ", " << rhs << "\n";
             break;
         case BinOp::Lt:
-            output << "slt " << destReg << ", " << leftReg << ", " << rightReg << "\n";
+            output << "slt " << destReg << ", " << lhs << ", " << rhs << "\n";
             break;
         case BinOp::Gt:
-            output << "slt " << destReg << ", " << rightReg << ", " << leftReg << "\n";
+            output << "slt " << destReg << ", " << rhs << ", " << lhs << "\n";
             break;
         case BinOp::Le:
-            output << "slt " << destReg << ", " << rightReg << ", " << leftReg << "\n";
+            output << "slt " << destReg << ", " << rhs << ", " << lhs << "\n";
             output << "xori " << destReg << ", " << destReg << ", 1\n";
             break;
         case BinOp::Ge:
-            output << "slt " << destReg << ", " << leftReg << ", " << rightReg << "\n";
+            output << "slt " << destReg << ", " << lhs << ", " << rhs << "\n";
             output << "xori " << destReg << ", " << destReg << ", 1\n";
             break;
         case BinOp::Eq:
-            output << "sub " << destReg << ", " << leftReg << ", " << rightReg << "\n";
+            output << "sub " << destReg << ", " << lhs << ", " << rhs << "\n";
             output << "seqz " << destReg << ", " << destReg << "\n";
             break;
         case BinOp::Ne:
-            output << "sub " << destReg << ", " << leftReg << ", " << rightReg << "\n";
+            output << "sub " << destReg << ", " << lhs << ", " << rhs << "\n";
             output << "snez " << destReg << ", " << destReg << "\n";
             break;
-        case BinOp::And:
-            output << "and " << destReg << ", " << leftReg << ", " << rightReg << "\n";
-            break;
-        case BinOp::Or:
-            output << "or " << destReg << ", " << leftReg << ", " << rightReg << "\n";
-            break;
         default:
             throw std::runtime_error("Unknown binary operator");
         }
-        if (!regManager.isSpilled(leftReg)) regManager.release(leftReg);
-        if (!regManager.isSpilled(rightReg)) regManager.release(rightReg);
+        regManager.release(regs.owned);
     }
     else if (const auto *unop = dynamic_cast<const UnOpExpr *>(&expr))
     {
-        std::string tempReg = allocWithSpill(RegType::TEMP, nullptr, ctx);
-        generateExprWithOffset(*unop->right, ctx, tempReg, extraSpOffset);
+        generateExpr(*unop->right, ctx, destReg);
         switch (unop->op)
         {
         case UnOp::Neg:
-            output << "neg " << destReg << ", " << tempReg << "\n";
+            output << "neg " << destReg << ", " << destReg << "\n";
             break;
         case UnOp::Not:
-            output << "seqz " << destReg << ", " << tempReg << "\n";
+            output << "seqz " << destReg << ", " << destReg << "\n";
             break;
         default:
             throw std::runtime_error("Unknown unary operator");
         }
-        if (!regManager.isSpilled(tempReg)) regManager.release(tempReg);
     }
     else if (const auto *call = dynamic_cast<const Call *>(&expr))
     {
-        // 1. 保存所有 caller-saved 寄存器
-        std::vector<std::string> callerSavedRegs = {
-            "t0", "t1", "t2", "t3", "t4", "t5", "t6",
-            "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7"
-        };
-        int saveCount = 0;
-        std::vector<std::string> actuallySaved;
-        for (const auto &reg : callerSavedRegs) {
-            if (regManager.isRegInUse(reg)) {
-                saveCount++;
-                actuallySaved.push_back(reg);
+        emitLoc(call->pos);
+        // 1. 只保存调用之后仍要使用的 caller-saved 寄存器：已求值、尚未被消费的操作数。
+        //    已分配但还没写入的目标寄存器（包括本次调用的结果寄存器）在调用处是死的，不必保存。
+        //    保存槽和参数暂存槽是帧内的临时槽，调用结束后归还
+        int tempMark = ctx.stackSize;
+        int spillMark = ctx.spillCount;
+        std::vector<std::pair<std::string, int>> actuallySaved;
+        for (const auto &operand : pendingOperands) {
+            const std::string &reg = operand.reg;
+            if (operand.evicted) {
+                continue;
             }
-        }
-        if (saveCount > 0) {
-            output << "addi sp, sp, -" << (saveCount * 4) << "\n";
-            int offset = 0;
-            for (const auto &reg : actuallySaved) {
+            bool callerSaved = reg[0] == 't' || reg[0] == 'a';
+            bool seen = std::any_of(actuallySaved.begin(), actuallySaved.end(),
+                                    [&](const auto &save) { return save.first == reg; });
+            if (callerSaved && !seen) {
+                int offset = allocateVar(ctx);
                 output << "sw " << reg << ", " << offset << "(sp)\n";
-                offset += 4;
+                actuallySaved.push_back({reg, offset});
             }
         }
 
-        // 2. 先为参数区分配空间
+        // 2. ILP32：前 8 个参数放在 a0-a7，其余参数在调用时位于 0(sp) 起的出参区
         size_t argCount = call->args.size();
-        int argAreaSize = argCount * 4;
-        if (argAreaSize > 0) {
-            output << "addi sp, sp, -" << argAreaSize << "\n";
-        }
-        // 3. 依次求值每个参数表达式，计算后立即入栈并释放寄存器
-        for (size_t i = 0; i < argCount; ++i) {
-            std::string tempReg = allocWithSpill(RegType::TEMP, nullptr, ctx);
-            // 参数表达式求值时，参数区尚未写入任何参数，所以偏移为整个参数区大小+caller-saved保存区
-            generateExprWithOffset(*call->args[i], ctx, tempReg, argAreaSize + saveCount * 4);
-            int offset = i * 4;
-            output << "sw " << tempReg << ", " << offset << "(sp)\n";
-            if (!regManager.isSpilled(tempReg)) regManager.release(tempReg);
+        bool argsCall = false;
+        for (const auto &arg : call->args) {
+            argsCall = argsCall || containsCall(*arg);
         }
-        // 4. 调用 call 指令
-        output << "call " << call->name << "\n";
-        // 5. 回收参数区空间
-        if (argAreaSize > 0) {
-            output << "addi sp, sp, " << argAreaSize << "\n";
-        }
-        // 6. 恢复 caller-saved 寄存器
-        if (saveCount > 0) {
-            int offset = 0;
-            for (const auto &reg : actuallySaved) {
-                output << "lw " << reg << ", " << offset << "(sp)\n";
-                offset += 4;
+        // 3. 依次求值每个参数表达式
+        if (!argsCall) {
+            for (size_t i = 0; i < argCount; ++i) {
+                if (i < 8) {
+                    generateExpr(*call->args[i], ctx, "a" + std::to_string(i));
+                    continue;
+                }
+                if (isZero(*call->args[i])) {
+                    output << "sw zero, " << (i - 8) * 4 << "(sp)\n";
+                    continue;
+                }
+                std::string tempReg = allocWithSpill(RegType::TEMP, ctx);
+                generateExpr(*call->args[i], ctx, tempReg);
+                output << "sw " << tempReg << ", " << (i - 8) * 4 << "(sp)\n";
+                regManager.release(tempReg);
+            }
+        } else {
+            // 参数中有调用时 a0-a7 和出参区都会被内层调用覆盖，先把所有参数暂存到帧内临时槽，
+            // 全部求值后再放到 a0-a7 和出参区
+            // 参数直接求值到 a0（调用的结果本来就在 a0），嵌套再深也不占用 t 寄存器
+            std::vector<int> staged;
+            for (size_t i = 0; i < argCount; ++i) {
+                generateExpr(*call->args[i], ctx, "a0");
+                staged.push_back(allocateVar(ctx));
+                output << "sw a0, " << staged.back() << "(sp)\n";
+            }
+            for (size_t i = 8; i < argCount; ++i) {
+                output << "lw t0, " << staged[i] << "(sp)\n";
+                output << "sw t0, " << (i - 8) * 4 << "(sp)\n";
+            }
+            for (size_t i = 0; i < argCount && i < 8; ++i) {
+                output << "lw a" << i << ", " << staged[i] << "(sp)\n";
             }
-            output << "addi sp, sp, " << (saveCount * 4) << "\n";
         }
-        // 7. 返回值处理
+        // 4. 调用 call 指令
+        output << "call " << call->name << "\n";
+        ctx.callerSaveStores += static_cast<int>(actuallySaved.size());
+        ctx.callSites.push_back(call->name);
+        // 5. 返回值处理：先取走 a0，等待中的操作数可能就在 a0 中，恢复时会覆盖它
         if (destReg != "a0") {
             output << "mv " << destReg << ", a0\n";
         }
+        // 6. 恢复 caller-saved 寄存器，归还临时槽（期间发生过溢出时溢出槽仍要保留）
+        for (const auto &[reg, offset] : actuallySaved) {
+            output << "lw " << reg << ", " << offset << "(sp)\n";
+        }
+        if (ctx.spillCount == spillMark) {
+            ctx.stackSize = tempMark;
+        }
     }
     else
     {
         throw std::runtime_error("Unknown expression type");
     }
 }
-void Generator::generateStmt(const Stmt &stmt, FunctionContext &ctx, int extraSpOffset)
+void Generator::generateStmt(const Stmt &stmt, FunctionContext &ctx)
 {
+    if (!dynamic_cast<const Block *>(&stmt) && !dynamic_cast<const While *>(&stmt))
+    {
+        emitLoc(stmt.pos);
+    }
     // same if-else chain
     if (auto block = dynamic_cast<const Block *>(&stmt))
     {
+        int mark = ctx.stackSize;
         ctx.pushScope(); // Enter new scope
         for (const auto &s : block->stmts)
         {
-            generateStmt(*s, ctx, extraSpOffset); // Generate code for each statement in the block
+            generateStmt(*s, ctx); // Generate code for each statement in the block
         }
         ctx.popScope(); // Exit scope
+        releaseSlots(ctx, mark);
     }
     else if (auto empty = dynamic_cast<const EmptyStmt *>(&stmt))
     {
@@ -258,73 +694,166 @@ void Generator::generateStmt(const Stmt &stmt, FunctionContext &ctx, int extraSp
     }
     else if (auto exprStmt = dynamic_cast<const ExprStmt *>(&stmt))
     {
-        std::string tempReg = allocWithSpill(RegType::TEMP, const_cast<Stmt *>(&stmt), ctx);
-        generateExprWithOffset(*exprStmt->expr, ctx, tempReg, extraSpOffset); // Generate code for expression statement
+        int mark = ctx.stackSize;
+        std::string tempReg = allocWithSpill(RegType::TEMP, ctx);
+        generateExpr(*exprStmt->expr, ctx, tempReg); // Generate code for expression statement
         regManager.release(tempReg);                 // Release temporary register
+        releaseSlots(ctx, mark);
     }
     else if (auto assign = dynamic_cast<const Assign *>(&stmt))
     {
-        std::string tempReg = allocWithSpill(RegType::TEMP, const_cast<Stmt *>(&stmt), ctx);
-        generateExprWithOffset(*assign->value, ctx, tempReg, extraSpOffset); // Generate code for value expression
+        int mark = ctx.stackSize;
         int offset = ctx.findVar(assign->name);
         if (offset == -1)
         {
             throw std::runtime_error("Variable " + assign->name + " not found in context");
         }
+        if (isZero(*assign->value))
+        {
+            output << "sw zero, " << offset << "(sp)\n";
+            return;
+        }
+        std::string tempReg = allocWithSpill(RegType::TEMP, ctx);
+        generateExpr(*assign->value, ctx, tempReg); // Generate code for value expression
         // 使用栈指针偏移：sp + (frameSize - 4 - offset)
         output << "sw " << tempReg << ", " << offset << "(sp)\n";
         regManager.release(tempReg); // Release temporary register
+        releaseSlots(ctx, mark);
     }
     else if (auto decl = dynamic_cast<const Decl *>(&stmt))
     {
         int offset = allocateVar(ctx, decl->name); // Allocate variable in the current context
         ctx.addVar(decl->name, offset);            // Add to current scope
-        if (decl->value)
+        if (decl->value && isZero(*decl->value))
         {
-            std::string tempReg = allocWithSpill(RegType::TEMP, const_cast<Stmt *>(&stmt), ctx);
-            generateExprWithOffset(*decl->value, ctx, tempReg, extraSpOffset); // Generate code for initialization value
+            output << "sw zero, " << offset << "(sp)\n";
+        }
+        else if (decl->value)
+        {
+            std::string tempReg = allocWithSpill(RegType::TEMP, ctx);
+            generateExpr(*decl->value, ctx, tempReg); // Generate code for initialization value
             output << "sw " << tempReg << ", " << offset << "(sp)\n";
             regManager.release(tempReg); // Release temporary register
+            releaseSlots(ctx, offset + 4); // the variable itself stays until its scope closes
         }
     }
     else if (auto ifStmt = dynamic_cast<const If *>(&stmt))
     {
-        std::string elseLabel = uniqueLabel("if_else_");
-        std::string condReg = allocWithSpill(RegType::TEMP,const_cast<Stmt *>(&stmt), ctx);
-        generateExprWithOffset(*ifStmt->condition, ctx, condReg, extraSpOffset);            // Generate code for condition expression
-        output << "beqz " << condReg << ", " << elseLabel << "\n"; // If condition is false, jump to else label
-        regManager.release(condReg);                               // Release condition register
-        generateStmt(*ifStmt->thenBody, ctx, extraSpOffset);                      // Generate code for then body
+        int site = profile ? profile->stmtSite(stmt) : -1;
+        uint64_t thenCount = useProfile() ? profile->count(site) : 0;
+        uint64_t elseCount = useProfile() ? profile->count(site + 1) : 0;
+        // 剖析数据显示一边占绝大多数时分支容易预测，保留分支
+        bool biased = thenCount * COLD_RATIO < elseCount || elseCount * COLD_RATIO < thenCount;
+        if (ifConversion && !instrument && !biased && generateSelect(*ifStmt, ctx))
+        {
+            return;
+        }
+        std::string elseLabel = uniqueLabel(ctx, "if_else_");
+        int condMark = ctx.stackSize;
+        auto branch = [&](const std::string &target, bool jumpIf) {
+            generateBranch(*ifStmt->condition, ctx, target, jumpIf); // Jump on the condition, no 0/1 value
+            releaseSlots(ctx, condMark);
+        };
 
-        if (ifStmt->elseBody)
+        if (ifStmt->elseBody && elseCount > thenCount)
         {
-            std::string endLabel = uniqueLabel("if_end_");
-            output << "j " << endLabel << "\n"; // Jump to end label only if there's an else body
-            output << elseLabel << ":\n";
-            generateStmt(*ifStmt->elseBody, ctx, extraSpOffset); // Generate code for else body
-            output << endLabel << ":\n";          // End of if statement
+            // The else branch is hotter: make it the fall-through path
+            std::string thenLabel = uniqueLabel(ctx, "if_then_");
+            std::string endLabel = uniqueLabel(ctx, "if_end_");
+            branch(thenLabel, true);
+            generateStmt(*ifStmt->elseBody, ctx);
+            output << "j " << endLabel << "\n";
+            output << thenLabel << ":\n";
+            generateStmt(*ifStmt->thenBody, ctx);
+            output << endLabel << ":\n";
+        }
+        else if (!ifStmt->elseBody && elseCount > 0 && thenCount * COLD_RATIO < elseCount)
+        {
+            // The then branch is cold: move it after the epilogue
+            std::string coldLabel = uniqueLabel(ctx, "if_cold_");
+            std::string endLabel = uniqueLabel(ctx, "if_end_");
+            branch(coldLabel, true);
+            output << endLabel << ":\n";
+            std::ostringstream coldCode;
+            coldCode << coldLabel << ":\n";
+            Generator coldGenerator(coldCode);
+            coldGenerator.inheritOptions(*this);
+            coldGenerator.generateStmt(*ifStmt->thenBody, ctx);
+            coldCode << "j " << endLabel << "\n";
+            ctx.coldCode += coldCode.str();
         }
         else
         {
-            output << elseLabel << ":\n"; // Just place the else label, no end label needed
+            branch(elseLabel, false); // If condition is false, jump to else label
+            emitCounter(site);
+            generateStmt(*ifStmt->thenBody, ctx);                      // Generate code for then body
+
+            if (ifStmt->elseBody || instrument)
+            {
+                std::string endLabel = uniqueLabel(ctx, "if_end_");
+                output << "j " << endLabel << "\n"; // Jump to end label only if there's an else body
+                output << elseLabel << ":\n";
+                emitCounter(site + 1);
+                if (ifStmt->elseBody)
+                {
+                    generateStmt(*ifStmt->elseBody, ctx); // Generate code for else body
+                }
+                output << endLabel << ":\n";          // End of if statement
+            }
+            else
+            {
+                output << elseLabel << ":\n"; // Just place the else label, no end label needed
+            }
         }
     }
     else if (auto whileStmt = dynamic_cast<const While *>(&stmt))
     {
-        std::string startLabel = uniqueLabel("while_start_");
-        std::string endLabel = uniqueLabel("while_end_");
+        int site = profile ? profile->stmtSite(stmt) : -1;
+        if (useProfile() && profile->count(site) > 0)
+        {
+            // Hot loop: test at the bottom so each iteration takes one branch
+            std::string bodyLabel = uniqueLabel(ctx, "while_body_");
+            std::string condLabel = uniqueLabel(ctx, "while_cond_");
+            std::string endLabel = uniqueLabel(ctx, "while_end_");
+            ctx.loopDepth++;
+            ctx.loopStartLabels.push_back(condLabel);
+            ctx.loopEndLabels.push_back(endLabel);
+            ctx.loopSites.push_back(-1);
+
+            output << "j " << condLabel << "\n";
+            output << bodyLabel << ":\n";
+            generateStmt(*whileStmt->body, ctx);
+            output << condLabel << ":\n";
+            lastLoc = SourcePos();
+            emitLoc(whileStmt->pos);
+            int condMark = ctx.stackSize;
+            generateBranch(*whileStmt->condition, ctx, bodyLabel, true);
+            releaseSlots(ctx, condMark);
+            output << endLabel << ":\n";
+
+            ctx.loopDepth--;
+            ctx.loopStartLabels.pop_back();
+            ctx.loopEndLabels.pop_back();
+            ctx.loopSites.pop_back();
+            return;
+        }
+        std::string startLabel = uniqueLabel(ctx, "while_start_");
+        std::string endLabel = uniqueLabel(ctx, "while_end_");
 
             // Push labels to stack for break/continue
             ctx.loopDepth++;
             ctx.loopStartLabels.push_back(startLabel);
             ctx.loopEndLabels.push_back(endLabel);
+            ctx.loopSites.push_back(site);
 
         output << startLabel << ":\n";
-        std::string condReg = allocWithSpill(RegType::TEMP,const_cast<Stmt *>(&stmt), ctx);
-        generateExprWithOffset(*whileStmt->condition, ctx, condReg, extraSpOffset);
-        output << "beqz " << condReg << ", " << endLabel << "\n";
-        regManager.release(condReg);          // Release condition register
-        generateStmt(*whileStmt->body, ctx, extraSpOffset);  // Generate code for while body
+        lastLoc = SourcePos(); // the back edge reaches here from the end of the body
+        emitLoc(whileStmt->pos);
+        int condMark = ctx.stackSize;
+        generateBranch(*whileStmt->condition, ctx, endLabel, false); // Leave the loop when the condition is false
+        releaseSlots(ctx, condMark);
+        generateStmt(*whileStmt->body, ctx);  // Generate code for while body
+        emitCounter(site);
         output << "j " << startLabel << "\n"; // Jump back to start of while loop
         output << endLabel << ":\n";          // End of while loop
 
@@ -332,6 +861,7 @@ void Generator::generateStmt(const Stmt &stmt, FunctionContext &ctx, int extraSp
         ctx.loopDepth--;
         ctx.loopStartLabels.pop_back();
         ctx.loopEndLabels.pop_back();
+        ctx.loopSites.pop_back();
     }
     else if (auto breakStmt = dynamic_cast<const Break *>(&stmt))
     {
@@ -354,6 +884,7 @@ void Generator::generateStmt(const Stmt &stmt, FunctionContext &ctx, int extraSp
         }
         else
         {
+            emitCounter(ctx.loopSites.back());
             output << "j " << ctx.loopStartLabels.back() << "\n"; // Jump to start of current loop
         }
     }
@@ -361,7 +892,9 @@ void Generator::generateStmt(const Stmt &stmt, FunctionContext &ctx, int extraSp
     {
         if (returnStmt->returnValue)
         {
-            generateExprWithOffset(*returnStmt->returnValue, ctx, "a0", extraSpOffset);
+            int mark = ctx.stackSize;
+            generateExpr(*returnStmt->returnValue, ctx, "a0");
+            releaseSlots(ctx, mark);
         }
         // 所有 return 语句跳转到统一出口
         output << "j " << ctx.name << "_return\n";
@@ -373,48 +906,152 @@ void Generator::generateStmt(const Stmt &stmt, FunctionContext &ctx, int extraSp
 }
 void Generator::generateFunc(const FuncDef &func)
 {
+    std::string cacheKey;
+    if (cache)
+    {
+        cacheKey = cache->key(func);
+        std::string cached;
+        if (cache->lookup(cacheKey, cached))
+        {
+            output << cached;
+            return;
+        }
+    }
     regManager.reset();
     contextStack.push(FunctionContext());
     auto &context = contextStack.top();
     context.name = func.name;
     // Initialize the function scope
     context.pushScope();
-    output << func.name << ":\n";
+    std::ostringstream funcCode;
+    funcCode << func.name << ":\n";
+    if (debugInfo && func.pos.line > 0)
+    {
+        funcCode << ".loc 1 " << func.pos.line << " " << func.pos.col << "\n";
+    }
 
-    // 1. 为每个参数分配栈空间并记录偏移
-    std::vector<int> argOffsets(func.args.size());
-    for (size_t i = 0; i < func.args.size(); i++) {
+    // 1. 帧底部是出参区（第 9 个及以后的参数在调用时位于 0(sp) 起），局部变量从其上开始；
+    //    前 8 个参数在帧内占槽，其余参数直接使用调用者出参区中的位置 sp + frameSize + (i-8)*4
+    context.stackSize = static_cast<int>(maxStackArgs(*func.body)) * 4;
+    context.stackHigh = context.slotBytes = context.stackSize;
+    for (size_t i = 0; i < func.args.size() && i < 8; i++) {
         int offset = allocateVar(context, func.args[i]);
         context.addVar(func.args[i], offset);
-        argOffsets[i] = offset;
     }
 
-    // 2. 先生成函数体，获得最大栈空间
+    // 2. 先生成函数体，获得最大栈空间。栈上参数的偏移依赖帧大小，而帧大小与这些偏移无关，
+    //    所以有栈上参数时用第一遍得到的帧大小再生成一遍
     std::ostringstream bodyCode;
-    Generator tempGenerator(bodyCode);
-    tempGenerator.contextStack = contextStack; // Copy context
-    tempGenerator.generateStmt(*func.body, tempGenerator.contextStack.top(), 0);
-    context.stackSize = tempGenerator.contextStack.top().stackSize;
-    int frameSize = 4 + context.stackSize; // ra(4) + local variables
+    int frameSize = 0;
+    int unsharedFrameSize = 0;
+    int savedBase = 0;
+    bool leaf = false;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 8; i < func.args.size(); i++) {
+            context.addVar(func.args[i], frameSize + static_cast<int>(i - 8) * 4);
+        }
+        bodyCode.str("");
+        Generator tempGenerator(bodyCode);
+        tempGenerator.contextStack = contextStack; // Copy context
+        tempGenerator.inheritOptions(*this);
+        if (profile)
+        {
+            tempGenerator.emitCounter(profile->entrySite(func));
+        }
+        const FunctionContext &body = tempGenerator.contextStack.top();
+        tempGenerator.generateStmt(*func.body, tempGenerator.contextStack.top());
+        context.spillCount = body.spillCount;
+        context.rematCount = body.rematCount;
+        context.callerSaveStores = body.callerSaveStores;
+        context.callSites = body.callSites;
+        context.coldCode = body.coldCode;
+        context.savedRegisters = body.savedRegisters;
+        // local variables + call temporaries + callee-saved s registers + ra(4), 16-byte aligned;
+        // 叶函数（没有调用）不保存 ra，帧为空时不分配
+        savedBase = std::max(body.stackSize, body.stackHigh);
+        leaf = context.callSites.empty() && !(instrument && func.name == "main");
+        int fixedBytes = static_cast<int>(context.savedRegisters.size()) * 4 + (leaf ? 0 : 4);
+        frameSize = (savedBase + fixedBytes + 15) / 16 * 16;
+        unsharedFrameSize = (body.slotBytes + fixedBytes + 15) / 16 * 16;
+        if (func.args.size() <= 8) {
+            break;
+        }
+    }
 
-    // 3. 生成序言，分配栈帧
-    output << "addi sp, sp, -" << frameSize << "\n";
-    output << "sw ra, " << (frameSize - 4) << "(sp)\n";
+    // 3. 生成序言，分配栈帧，保存函数体用到的 s 寄存器
+    if (frameSize > 0) {
+        funcCode << "addi sp, sp, -" << frameSize << "\n";
+    }
+    if (!leaf) {
+        funcCode << "sw ra, " << (frameSize - 4) << "(sp)\n";
+    }
+    int savedOffset = savedBase;
+    for (const auto &reg : context.savedRegisters) {
+        funcCode << "sw " << reg << ", " << savedOffset << "(sp)\n";
+        savedOffset += 4;
+    }
 
-    // 4. 保存参数到栈，全部从 caller 的参数区(sp+frameSize+i*4)读取
-    for (size_t i = 0; i < func.args.size(); i++) {
-        int offset = context.findVar(func.args[i]);
-        // sp 已减 frameSize，caller 的参数区在 sp+frameSize
-        output << "lw t0, " << (frameSize + i * 4) << "(sp)\n";
-        output << "sw t0, " << offset << "(sp)\n";
+    // 4. 前 8 个参数从 a0-a7 存入帧内槽
+    for (size_t i = 0; i < func.args.size() && i < 8; i++) {
+        funcCode << "sw a" << i << ", " << context.findVar(func.args[i]) << "(sp)\n";
     }
 
-    output << bodyCode.str();
+    // 最后一条语句跳到紧随其后的统一出口时省去这条跳转
+    std::string body = bodyCode.str();
+    std::string returnJump = "j " + func.name + "_return\n";
+    if (body.size() >= returnJump.size() && body.compare(body.size() - returnJump.size(), returnJump.size(), returnJump) == 0) {
+        body.resize(body.size() - returnJump.size());
+    }
+    funcCode << body;
     // 统一出口标签
-    output << func.name << "_return:\n";
-    output << "lw ra, " << (frameSize - 4) << "(sp)\n";
-    output << "addi sp, sp, " << frameSize << "\n";
-    output << "ret\n";
+    funcCode << func.name << "_return:\n";
+    if (debugInfo && func.pos.line > 0)
+    {
+        funcCode << ".loc 1 " << func.pos.line << " " << func.pos.col << "\n";
+    }
+    if (instrument && func.name == "main")
+    {
+        funcCode << "call __toyc_prof_dump\n";
+    }
+    savedOffset = savedBase;
+    for (const auto &reg : context.savedRegisters) {
+        funcCode << "lw " << reg << ", " << savedOffset << "(sp)\n";
+        savedOffset += 4;
+    }
+    if (!leaf) {
+        funcCode << "lw ra, " << (frameSize - 4) << "(sp)\n";
+    }
+    if (frameSize > 0) {
+        funcCode << "addi sp, sp, " << frameSize << "\n";
+    }
+    funcCode << "ret\n";
+    funcCode << context.coldCode;
+    std::string code = funcCode.str();
+    std::map<std::string, int> fired;
+    if (peephole)
+    {
+        code = optimizePeephole(code, fired);
+    }
+    output << code;
+    if (cache)
+    {
+        cache->store(cacheKey, code);
+    }
+
+    if (stats)
+    {
+        FunctionStats funcStats;
+        funcStats.name = func.name;
+        funcStats.spills = context.spillCount;
+        funcStats.remats = context.rematCount;
+        funcStats.callerSaveStores = context.callerSaveStores;
+        funcStats.frameSize = frameSize;
+        funcStats.unsharedFrameSize = unsharedFrameSize;
+        funcStats.callSites = context.callSites;
+        funcStats.peephole = fired;
+        stats->scanAssembly(funcStats, code);
+        stats->addFunction(funcStats);
+    }
     contextStack.pop();
 }
 
@@ -427,9 +1064,21 @@ void Generator::generateProg(Program &program)
     // output << "    mv a0, a0\n";
     // output << "    li a7, 93\n";
     // output << "    ecall\n";
+    if (debugInfo)
+    {
+        output << ".file 1 \"" << sourceName << "\"\n";
+    }
     output << ".globl main\n";
+    if (cache)
+    {
+        cache->setProgram(program);
+    }
     for (const auto &func : program.functions)
     {
         generateFunc(*func);
     }
+    if (instrument && profile)
+    {
+        profile->emitRuntime(output, profileDumpPath);
+    }
 }
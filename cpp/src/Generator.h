@@ -8,7 +8,37 @@
 #include <memory>
 #include "ASTNode.h"
 #include "RegManager.h"
+#include "CodegenStats.h"
+#include "Profile.h"
+#include "CodeCache.h"
 
+// -O0 code generator: walks the folded AST and writes RISC-V assembly.
+//
+// Calls follow ILP32 (a0-a7, then the stack from 0(sp); result in a0; sp
+// 16-byte aligned at calls), so the output links with gcc objects.
+// Arguments of a call that contains another call are evaluated into a0
+// and staged in the frame first. Only caller saved registers that still
+// hold pending operands are saved around a call.
+//
+// Binary operators evaluate the side with the larger Sethi-Ullman number
+// first, straight into the destination, so the other side needs only one
+// more register. A value that must survive a later call goes to an s
+// register, saved once in the prologue. When registers run out, a pending
+// left operand is evicted: constants and variables are recomputed with
+// li/lw, other values go to a spill slot.
+//
+// The frame, with the outgoing argument area at its bottom, is allocated
+// once in the prologue and sp does not move inside the body; stack
+// parameters are read from the caller's outgoing area. Slots are
+// released when their scope or statement ends, so the frame is the high
+// water mark. Leaf functions do not save ra, and functions with nothing
+// on the stack get no frame.
+//
+// Conditions of if/while become compare-and-branch instructions
+// (generateBranch). An if that only selects between two cheap values, and
+// && / || with a cheap right side used as a value, are computed without
+// branches (see InstSelect.h), unless the profile shows the branch is
+// predictable.
 class Generator
 {
 private:
@@ -18,14 +48,25 @@ private:
     {
         std::string name;
         int stackSize = 0;
+        int stackHigh = 0;                                  // Highest stackSize reached, released slots included
+        int slotBytes = 0;                                  // Bytes handed out, as if no slot were ever reused
         int partVarCount = 0;                               // Number of variables in the current function
         std::vector<std::map<std::string, int>> scopeStack; // Stack of scopes, each scope maps variable names to offsets
         std::map<std::string, int> args;                    // 参数映射：参数名 -> 位置索引
         int loopDepth = 0;                                  // Depth of nested loops used by break and continue
         std::vector<std::string> loopEndLabels;             // Stack of loop end labels for break
         std::vector<std::string> loopStartLabels;           // Stack of loop start labels for continue
+        std::vector<int> loopSites;                         // Stack of back-edge counter sites (-1 if none)
+        std::string coldCode;                               // Out-of-line blocks placed after the epilogue
+        int labelCount = 0;                                 // Next function-local label number
 
-        std::set<std::string> savedRegisters;
+        std::set<std::string> savedRegisters; // s registers written by the body, saved in the prologue
+
+        // Statistics gathered while generating the body
+        int spillCount = 0;
+        int rematCount = 0;
+        int callerSaveStores = 0;
+        std::vector<std::string> callSites; // callee of every call site
         // 添加参数
         void addArg(const std::string &name, int index)
         {
@@ -85,17 +126,88 @@ private:
         }
     };
     std::stack<FunctionContext> contextStack; // Stack of contexts
+    CodegenStats *stats = nullptr;            // Optional statistics sink
+    bool debugInfo = false;                   // Emit .file/.loc line directives
+    std::string sourceName;                   // File name used in the .file directive
+    SourcePos lastLoc;                        // Last position emitted by .loc
+    const Profile *profile = nullptr;         // Counter sites, and counts when a profile is loaded
+    bool instrument = false;                  // Emit profile counters
+    std::string profileDumpPath;              // File written by the instrumented program
+    CodeCache *cache = nullptr;               // Per-function assembly cache
+    // An evaluated operand waiting in a register for its operator
+    struct PendingOperand
+    {
+        std::string reg;
+        const Expr *expr;      // the operand itself, recomputed if it is a constant or a variable
+        int spillOffset = -1;  // frame slot of a spilled value
+        bool evicted = false;  // reg was given away; reload (or recompute) before use
+    };
+    std::vector<PendingOperand> pendingOperands; // Operands not yet consumed, innermost last
+    // Registers holding both operands of a binary operator; owned is released once the result is computed
+    struct OperandRegs
+    {
+        std::string lhs, rhs, owned;
+    };
+    bool slotReuse = true;                    // Reuse the slots of closed scopes and finished statements
+    bool ifConversion = true;                 // Branchless selects and non-short-circuit && / ||
+    bool peephole = true;                     // Run the peephole optimizer on each finished function
 
 public:
     // Constructor
     Generator(std::ostream &out);
-    std::string uniqueLabel(const std::string &prefix);
+    void setStats(CodegenStats *s) { stats = s; }
+    void setDebugInfo(const std::string &source)
+    {
+        debugInfo = true;
+        sourceName = source;
+    }
+    void emitLoc(const SourcePos &pos);
+    // Emit counters at function entries, If branches and While back edges
+    void setInstrumentation(const Profile *p, const std::string &dumpPath)
+    {
+        profile = p;
+        instrument = true;
+        profileDumpPath = dumpPath;
+    }
+    // Use loaded profile counts for block placement and loop layout
+    void setProfile(const Profile *p) { profile = p; }
+    // Reuse and record per-function assembly
+    void setCache(CodeCache *c) { cache = c; }
+    void setSlotReuse(bool enabled) { slotReuse = enabled; }
+    void setIfConversion(bool enabled) { ifConversion = enabled; }
+    void setPeephole(bool enabled) { peephole = enabled; }
+    bool useProfile() const { return profile && !instrument && profile->loaded(); }
+    void inheritOptions(const Generator &parent);
+    void emitCounter(int site);
+    std::string uniqueLabel(FunctionContext &ctx, const std::string &prefix);
     int allocateVar(FunctionContext &ctx, const std::string &name = "");
+    // Give back the slots above mark once nothing in them is live any more
+    void releaseSlots(FunctionContext &ctx, int mark);
+    // True for the literal 0, which is stored straight from x0
+    static bool isZero(const Expr &expr);
+    // Registers needed to evaluate expr without spilling (its Sethi-Ullman number)
+    static int registerNeed(const Expr &expr);
+    // True if evaluating expr performs a call (and so clobbers a0-a7)
+    static bool containsCall(const Expr &expr);
+    // Largest number of stack-passed arguments (beyond the eighth) of any call
+    static size_t maxStackArgs(const Expr &expr);
+    static size_t maxStackArgs(const Stmt &stmt);
     void generateExpr(const Expr &expr, FunctionContext &ctx, const std::string &destReg = "a0");
-    void generateExprWithOffset(const Expr &expr, FunctionContext &ctx, const std::string &destReg, int extraSpOffset);
-    void generateStmt(const Stmt &stmt, FunctionContext &ctx, int extraSpOffset = 0);
+    // Evaluate left and right for an instruction writing destReg, in Sethi-Ullman order
+    OperandRegs generateOperands(const Expr &left, const Expr &right, FunctionContext &ctx, const std::string &destReg);
+    // Jump to target when cond is jumpIf, fall through otherwise, with compare-and-branch instructions
+    void generateBranch(const Expr &cond, FunctionContext &ctx, const std::string &target, bool jumpIf);
+    // Branchless if: assign one of two cheap values through a mask; false if the if does not qualify
+    bool generateSelect(const If &ifStmt, FunctionContext &ctx);
+    // The assignment that is the whole of stmt (possibly inside a one-statement block), or null
+    static const Assign *singleAssign(const Stmt &stmt);
+    void generateStmt(const Stmt &stmt, FunctionContext &ctx);
     void generateFunc(const FuncDef &func);
     void generateProg(Program &program);
 
-    auto allocWithSpill(RegType type, Stmt *stmt, FunctionContext &ctx);
+    auto allocWithSpill(RegType type, FunctionContext &ctx);
+    // Free a register of the given type held by a pending operand; false if none
+    bool evictPendingOperand(RegType type, FunctionContext &ctx);
+    // Bring an evicted operand back into reg
+    void reloadOperand(const PendingOperand &operand, FunctionContext &ctx, const std::string &reg);
 };
\ No newline at end of file
@@ -0,0 +1,251 @@
+#include "IR.h"
+#include <algorithm>
+
+const char *irOpName(IROp op)
+{
+    static const char *names[] = {"const", "copy", "add", "sub", "mul", "div", "rem", "lt", "gt", "le",
+                                  "ge", "eq", "ne", "and", "or", "neg", "not", "call", "phi", "jump", "br", "ret"};
+    return names[static_cast<int>(op)];
+}
+
+std::vector<int> IRInst::uses() const
+{
+    std::vector<int> result;
+    if (a >= 0)
+        result.push_back(a);
+    if (b >= 0)
+        result.push_back(b);
+    result.insert(result.end(), args.begin(), args.end());
+    return result;
+}
+
+int IRFunction::newVReg(const std::string &varName)
+{
+    vregNames.push_back(varName);
+    return static_cast<int>(vregNames.size() - 1);
+}
+
+int IRFunction::newBlock()
+{
+    IRBlock block;
+    block.id = static_cast<int>(blocks.size());
+    blocks.push_back(std::move(block));
+    return blocks.back().id;
+}
+
+void IRFunction::computeCFG()
+{
+    for (auto &block : blocks)
+    {
+        block.succs.clear();
+        block.preds.clear();
+    }
+    for (auto &block : blocks)
+    {
+        if (block.insts.empty())
+        {
+            continue;
+        }
+        const IRInst &term = block.terminator();
+        if (term.op == IROp::Jump)
+        {
+            block.succs.push_back(term.target);
+        }
+        else if (term.op == IROp::Branch)
+        {
+            block.succs.push_back(term.target);
+            if (term.elseTarget != term.target)
+            {
+                block.succs.push_back(term.elseTarget);
+            }
+        }
+    }
+    for (auto &block : blocks)
+    {
+        for (int succ : block.succs)
+        {
+            blocks[succ].preds.push_back(block.id);
+        }
+    }
+}
+
+std::vector<int> IRFunction::reversePostorder() const
+{
+    std::vector<int> order;
+    std::vector<char> visited(blocks.size(), 0);
+    // Iterative DFS keeping (block, next successor index)
+    std::vector<std::pair<int, size_t>> stack;
+    if (!blocks.empty())
+    {
+        stack.push_back({0, 0});
+        visited[0] = 1;
+    }
+    while (!stack.empty())
+    {
+        auto &[block, next] = stack.back();
+        if (next < blocks[block].succs.size())
+        {
+            int succ = blocks[block].succs[next++];
+            if (!visited[succ])
+            {
+                visited[succ] = 1;
+                stack.push_back({succ, 0});
+            }
+        }
+        else
+        {
+            order.push_back(block);
+            stack.pop_back();
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+bool IRFunction::removeUnreachable()
+{
+    computeCFG();
+    std::vector<int> order = reversePostorder();
+    if (order.size() == blocks.size())
+    {
+        return false;
+    }
+    // Keep the original relative order of the reachable blocks
+    std::vector<char> reachable(blocks.size(), 0);
+    for (int b : order)
+    {
+        reachable[b] = 1;
+    }
+    std::vector<int> newId(blocks.size(), -1);
+    std::vector<IRBlock> kept;
+    for (auto &block : blocks)
+    {
+        if (reachable[block.id])
+        {
+            newId[block.id] = static_cast<int>(kept.size());
+            kept.push_back(std::move(block));
+        }
+    }
+    for (auto &block : kept)
+    {
+        block.id = newId[block.id];
+        for (auto &inst : block.insts)
+        {
+            if (inst.target >= 0)
+                inst.target = newId[inst.target];
+            if (inst.elseTarget >= 0)
+                inst.elseTarget = newId[inst.elseTarget];
+            if (inst.op == IROp::Phi)
+            {
+                // Drop incoming values from removed predecessors
+                std::vector<int> args, phiBlocks;
+                for (size_t i = 0; i < inst.args.size(); i++)
+                {
+                    if (newId[inst.phiBlocks[i]] >= 0)
+                    {
+                        args.push_back(inst.args[i]);
+                        phiBlocks.push_back(newId[inst.phiBlocks[i]]);
+                    }
+                }
+                inst.args = std::move(args);
+                inst.phiBlocks = std::move(phiBlocks);
+            }
+        }
+    }
+    blocks = std::move(kept);
+    computeCFG();
+    return true;
+}
+
+size_t IRFunction::instructionCount() const
+{
+    size_t count = 0;
+    for (const auto &block : blocks)
+    {
+        count += block.insts.size();
+    }
+    return count;
+}
+
+static std::string vregText(const IRFunction &func, int vreg)
+{
+    std::string text = "v" + std::to_string(vreg);
+    if (vreg >= 0 && vreg < func.numVRegs() && !func.vregNames[vreg].empty())
+    {
+        text += "(" + func.vregNames[vreg] + ")";
+    }
+    return text;
+}
+
+void IRFunction::print(std::ostream &out) const
+{
+    out << "function " << name << "(";
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        out << (i ? ", " : "") << vregText(*this, params[i]);
+    }
+    out << ") -> " << (returnsInt ? "int" : "void") << (isSSA ? " [ssa]" : "") << "\n";
+    for (const auto &block : blocks)
+    {
+        out << "bb" << block.id << ":";
+        if (!block.preds.empty())
+        {
+            out << "\t; preds";
+            for (int p : block.preds)
+                out << " bb" << p;
+        }
+        out << "\n";
+        for (const auto &inst : block.insts)
+        {
+            out << "  ";
+            if (inst.dst >= 0)
+            {
+                out << vregText(*this, inst.dst) << " = ";
+            }
+            out << irOpName(inst.op);
+            switch (inst.op)
+            {
+            case IROp::Const:
+                out << " " << inst.imm;
+                break;
+            case IROp::Call:
+                out << " " << inst.callee << "(";
+                for (size_t i = 0; i < inst.args.size(); i++)
+                    out << (i ? ", " : "") << vregText(*this, inst.args[i]);
+                out << ")";
+                break;
+            case IROp::Phi:
+                for (size_t i = 0; i < inst.args.size(); i++)
+                    out << (i ? ", [" : " [") << vregText(*this, inst.args[i]) << ", bb" << inst.phiBlocks[i] << "]";
+                break;
+            case IROp::Jump:
+                out << " bb" << inst.target;
+                break;
+            case IROp::Branch:
+                out << " " << vregText(*this, inst.a) << ", bb" << inst.target << ", bb" << inst.elseTarget;
+                break;
+            case IROp::Ret:
+                if (inst.a >= 0)
+                    out << " " << vregText(*this, inst.a);
+                break;
+            default:
+                out << " " << vregText(*this, inst.a);
+                if (inst.b >= 0)
+                    out << ", " << vregText(*this, inst.b);
+                else if (inst.isBinary())
+                    out << ", " << inst.imm; // immediate operand after selectImmediates
+                break;
+            }
+            out << "\n";
+        }
+    }
+}
+
+void IRProgram::print(std::ostream &out) const
+{
+    for (const auto &func : functions)
+    {
+        func.print(out);
+        out << "\n";
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "ASTNode.h"
+
+// Three-address intermediate representation.
+//
+// A function is a list of basic blocks over an unbounded set of virtual
+// registers (vregs). Every block ends with exactly one terminator (Jump,
+// Branch or Ret); successor/predecessor lists are derived from the
+// terminators by IRFunction::computeCFG(). Outside SSA form a vreg may be
+// assigned several times (ToyC variables are vregs); in SSA form every vreg
+// has a single definition and Phi instructions sit at the top of blocks.
+enum class IROp : uint8_t
+{
+    Const,  // dst = imm
+    Copy,   // dst = a
+    Add,    // dst = a + b
+    Sub,    // dst = a - b
+    Mul,    // dst = a * b
+    Div,    // dst = a / b
+    Rem,    // dst = a % b
+    Lt,     // dst = a < b
+    Gt,     // dst = a > b
+    Le,     // dst = a <= b
+    Ge,     // dst = a >= b
+    Eq,     // dst = a == b
+    Ne,     // dst = a != b
+    And,    // dst = a & b (bitwise; from if-conversion and non-short-circuit && / ||)
+    Or,     // dst = a | b
+    Neg,    // dst = -a
+    Not,    // dst = !a
+    Call,   // dst = callee(args...), dst = -1 when the result is unused
+    Phi,    // dst = args[i] when entered from block phiBlocks[i]
+    Jump,   // goto target
+    Branch, // if a != 0 goto target else goto elseTarget
+    Ret     // return a (a = -1 for void)
+};
+
+struct IRInst
+{
+    IROp op;
+    int dst = -1;
+    int a = -1;
+    int b = -1;
+    int32_t imm = 0;
+    int target = -1;             // Jump/Branch taken block
+    int elseTarget = -1;         // Branch fall-through block
+    std::string callee;          // Call
+    std::vector<int> args;       // Call arguments, Phi incoming values
+    std::vector<int> phiBlocks;  // Phi incoming blocks, parallel to args
+    SourcePos pos;
+
+    bool isTerminator() const { return op == IROp::Jump || op == IROp::Branch || op == IROp::Ret; }
+    bool isBinary() const { return op >= IROp::Add && op <= IROp::Or; }
+    bool isCompare() const { return op >= IROp::Lt && op <= IROp::Ne; }
+    bool hasSideEffects() const { return op == IROp::Call || isTerminator(); }
+    // vregs read by this instruction
+    std::vector<int> uses() const;
+    // Apply f to every used vreg slot, allowing it to be rewritten
+    template <typename F>
+    void forEachUse(F f)
+    {
+        if (a >= 0)
+            f(a);
+        if (b >= 0)
+            f(b);
+        for (int &arg : args)
+            f(arg);
+    }
+};
+
+struct IRBlock
+{
+    int id = 0;
+    std::vector<IRInst> insts;
+    std::vector<int> succs;
+    std::vector<int> preds;
+
+    const IRInst &terminator() const { return insts.back(); }
+    IRInst &terminator() { return insts.back(); }
+};
+
+class IRFunction
+{
+public:
+    std::string name;
+    bool returnsInt = true;
+    std::vector<int> params;             // vregs holding the parameters on entry
+    std::vector<IRBlock> blocks;         // blocks[i].id == i, blocks[0] is the entry
+    std::vector<std::string> vregNames;  // source variable name of each vreg, "" for temporaries
+    bool isSSA = false;
+    SourcePos pos;
+
+    int numVRegs() const { return static_cast<int>(vregNames.size()); }
+    int newVReg(const std::string &varName = "");
+    int newBlock();
+
+    // Rebuild succs/preds from the terminators
+    void computeCFG();
+    // Drop blocks not reachable from the entry and renumber the rest
+    // (jump targets and phi operands are remapped); returns true if any
+    // block was removed
+    bool removeUnreachable();
+    // Blocks in reverse postorder from the entry
+    std::vector<int> reversePostorder() const;
+    std::string blockLabel(int block) const { return name + "_bb" + std::to_string(block); }
+    size_t instructionCount() const;
+
+    void print(std::ostream &out) const;
+};
+
+class IRProgram
+{
+public:
+    std::vector<IRFunction> functions;
+
+    void print(std::ostream &out) const;
+};
+
+const char *irOpName(IROp op);
@@ -0,0 +1,266 @@
+#include "IRAnalysis.h"
+
+DominatorTree::DominatorTree(const IRFunction &func)
+{
+    size_t n = func.blocks.size();
+    idom.assign(n, -1);
+    children.assign(n, {});
+    frontier.assign(n, {});
+    rpoIndex.assign(n, -1);
+    std::vector<int> order = func.reversePostorder();
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        rpoIndex[order[i]] = static_cast<int>(i);
+    }
+    if (order.empty())
+    {
+        return;
+    }
+
+    auto intersect = [&](int a, int b) {
+        while (a != b)
+        {
+            while (rpoIndex[a] > rpoIndex[b])
+                a = idom[a];
+            while (rpoIndex[b] > rpoIndex[a])
+                b = idom[b];
+        }
+        return a;
+    };
+
+    int entry = order[0];
+    idom[entry] = entry;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++)
+        {
+            int block = order[i];
+            int newIdom = -1;
+            for (int pred : func.blocks[block].preds)
+            {
+                if (idom[pred] < 0)
+                {
+                    continue; // not processed yet or unreachable
+                }
+                newIdom = newIdom < 0 ? pred : intersect(pred, newIdom);
+            }
+            if (newIdom >= 0 && idom[block] != newIdom)
+            {
+                idom[block] = newIdom;
+                changed = true;
+            }
+        }
+    }
+    idom[entry] = -1;
+
+    for (int block : order)
+    {
+        if (idom[block] >= 0)
+        {
+            children[idom[block]].push_back(block);
+        }
+    }
+    // Frontiers: walk up from each predecessor of a join point
+    for (int block : order)
+    {
+        const auto &preds = func.blocks[block].preds;
+        if (preds.size() < 2)
+        {
+            continue;
+        }
+        for (int pred : preds)
+        {
+            if (rpoIndex[pred] < 0)
+            {
+                continue;
+            }
+            int runner = pred;
+            while (runner != idom[block] && runner >= 0)
+            {
+                auto &df = frontier[runner];
+                if (df.empty() || df.back() != block)
+                {
+                    df.push_back(block);
+                }
+                runner = idom[runner];
+            }
+        }
+    }
+}
+
+bool DominatorTree::dominates(int a, int b) const
+{
+    while (b >= 0)
+    {
+        if (a == b)
+        {
+            return true;
+        }
+        b = idom[b];
+    }
+    return false;
+}
+
+bool VRegSet::unite(const VRegSet &other)
+{
+    bool changed = false;
+    for (size_t i = 0; i < words.size(); i++)
+    {
+        uint64_t merged = words[i] | other.words[i];
+        if (merged != words[i])
+        {
+            words[i] = merged;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+int VRegSet::count() const
+{
+    int total = 0;
+    for (uint64_t w : words)
+    {
+        total += std::popcount(w);
+    }
+    return total;
+}
+
+Liveness::Liveness(const IRFunction &func)
+{
+    size_t n = func.blocks.size();
+    int vregs = func.numVRegs();
+    std::vector<VRegSet> use(n, VRegSet(vregs));
+    std::vector<VRegSet> def(n, VRegSet(vregs));
+    std::vector<VRegSet> phiUses(n, VRegSet(vregs)); // values a block passes to successor phis
+    liveIn.assign(n, VRegSet(vregs));
+    liveOut.assign(n, VRegSet(vregs));
+
+    for (const auto &block : func.blocks)
+    {
+        for (const auto &inst : block.insts)
+        {
+            if (inst.op == IROp::Phi)
+            {
+                for (size_t i = 0; i < inst.args.size(); i++)
+                {
+                    phiUses[inst.phiBlocks[i]].set(inst.args[i]);
+                }
+            }
+            else
+            {
+                for (int v : inst.uses())
+                {
+                    if (!def[block.id].test(v))
+                    {
+                        use[block.id].set(v);
+                    }
+                }
+            }
+            if (inst.dst >= 0)
+            {
+                def[block.id].set(inst.dst);
+            }
+        }
+    }
+
+    std::vector<int> order = func.reversePostorder();
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto it = order.rbegin(); it != order.rend(); ++it)
+        {
+            int b = *it;
+            VRegSet out = phiUses[b];
+            for (int succ : func.blocks[b].succs)
+            {
+                out.unite(liveIn[succ]);
+            }
+            liveOut[b] = out;
+            VRegSet in = use[b];
+            VRegSet through = out;
+            def[b].forEach([&](int v) { through.reset(v); });
+            in.unite(through);
+            if (liveIn[b].unite(in))
+            {
+                changed = true;
+            }
+        }
+    }
+}
+
+LoopInfo::LoopInfo(const IRFunction &func, const DominatorTree &dom)
+{
+    size_t n = func.blocks.size();
+    depth.assign(n, 0);
+    for (size_t header = 0; header < n; header++)
+    {
+        // Natural loop of all back edges into this header: blocks that reach
+        // a latch without passing the header
+        std::vector<char> inLoop(n, 0);
+        std::vector<int> work;
+        bool isHeader = false;
+        inLoop[header] = 1;
+        for (int latch : func.blocks[header].preds)
+        {
+            if (!dom.dominates(static_cast<int>(header), latch))
+            {
+                continue;
+            }
+            isHeader = true;
+            if (!inLoop[latch])
+            {
+                inLoop[latch] = 1;
+                work.push_back(latch);
+            }
+        }
+        if (!isHeader)
+        {
+            continue;
+        }
+        while (!work.empty())
+        {
+            int x = work.back();
+            work.pop_back();
+            for (int pred : func.blocks[x].preds)
+            {
+                if (!inLoop[pred])
+                {
+                    inLoop[pred] = 1;
+                    work.push_back(pred);
+                }
+            }
+        }
+        for (size_t x = 0; x < n; x++)
+        {
+            depth[x] += inLoop[x];
+        }
+    }
+}
+
+std::vector<char> findConstantVRegs(const IRFunction &func, std::vector<int> &values)
+{
+    int n = func.numVRegs();
+    std::vector<char> constant(n, 0), seen(n, 0);
+    values.assign(n, 0);
+    for (const auto &block : func.blocks)
+    {
+        for (const auto &inst : block.insts)
+        {
+            if (inst.dst < 0)
+                continue;
+            bool same = inst.op == IROp::Const && (!seen[inst.dst] || (constant[inst.dst] && values[inst.dst] == inst.imm));
+            constant[inst.dst] = same;
+            values[inst.dst] = inst.imm;
+            seen[inst.dst] = 1;
+        }
+    }
+    for (int param : func.params)
+    {
+        constant[param] = 0;
+    }
+    return constant;
+}
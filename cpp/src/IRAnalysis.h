@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <bit>
+#include "IR.h"
+
+// Dominator tree (Cooper, Harvey and Kennedy's iterative algorithm) and
+// dominance frontiers of a function whose CFG is up to date.
+class DominatorTree
+{
+public:
+    std::vector<int> idom;                  // immediate dominator, -1 for the entry and unreachable blocks
+    std::vector<std::vector<int>> children; // dominator tree edges
+    std::vector<std::vector<int>> frontier; // dominance frontier of each block
+    std::vector<int> rpoIndex;              // position in reverse postorder, -1 if unreachable
+
+    explicit DominatorTree(const IRFunction &func);
+    bool dominates(int a, int b) const;
+};
+
+// Fixed-size bit set over vregs
+class VRegSet
+{
+private:
+    std::vector<uint64_t> words;
+
+public:
+    VRegSet() = default;
+    explicit VRegSet(int size) : words((size + 63) / 64, 0) {}
+    bool test(int v) const { return (words[v >> 6] >> (v & 63)) & 1; }
+    void set(int v) { words[v >> 6] |= uint64_t(1) << (v & 63); }
+    void reset(int v) { words[v >> 6] &= ~(uint64_t(1) << (v & 63)); }
+    // this |= other, returns true if anything changed
+    bool unite(const VRegSet &other);
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (size_t w = 0; w < words.size(); w++)
+        {
+            uint64_t bits = words[w];
+            while (bits)
+            {
+                int bit = std::countr_zero(bits);
+                f(static_cast<int>(w * 64 + bit));
+                bits &= bits - 1;
+            }
+        }
+    }
+    int count() const;
+};
+
+// Block-level live-in/live-out sets. Phi operands are live out of the
+// corresponding predecessor, not live into the phi's block.
+class Liveness
+{
+public:
+    std::vector<VRegSet> liveIn;
+    std::vector<VRegSet> liveOut;
+
+    explicit Liveness(const IRFunction &func);
+};
+
+// Loop nesting depth of every block, from the natural loops of the back
+// edges (edges whose target dominates their source).
+class LoopInfo
+{
+public:
+    std::vector<int> depth; // 0 outside any loop
+
+    LoopInfo(const IRFunction &func, const DominatorTree &dom);
+};
+
+// Vregs whose every definition is the same constant (parameters aside),
+// with their values. Such a value can be rematerialized with li instead of
+// being spilled, and folded into immediate operands.
+std::vector<char> findConstantVRegs(const IRFunction &func, std::vector<int> &values);
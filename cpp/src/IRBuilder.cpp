@@ -0,0 +1,363 @@
+#include "IRBuilder.h"
+#include "InstSelect.h"
+#include <stdexcept>
+
+IRInst &IRBuilder::emit(IROp op, int dst, int a, int b)
+{
+    IRInst inst;
+    inst.op = op;
+    inst.dst = dst;
+    inst.a = a;
+    inst.b = b;
+    inst.pos = pos;
+    func->blocks[current].insts.push_back(std::move(inst));
+    return func->blocks[current].insts.back();
+}
+
+void IRBuilder::jump(int target)
+{
+    emit(IROp::Jump).target = target;
+}
+
+void IRBuilder::branch(int cond, int target, int elseTarget)
+{
+    IRInst &inst = emit(IROp::Branch, -1, cond);
+    inst.target = target;
+    inst.elseTarget = elseTarget;
+}
+
+bool IRBuilder::terminated() const
+{
+    const auto &insts = func->blocks[current].insts;
+    return !insts.empty() && insts.back().isTerminator();
+}
+
+int IRBuilder::lookup(const std::string &name) const
+{
+    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
+    {
+        auto found = it->find(name);
+        if (found != it->end())
+        {
+            return found->second;
+        }
+    }
+    throw std::runtime_error("Variable " + name + " not found in context");
+}
+
+// Store value into a variable vreg; when value is a temporary just computed
+// by the last instruction, that instruction writes the variable directly
+void IRBuilder::assignTo(int var, int value, int firstTemp)
+{
+    auto &insts = func->blocks[current].insts;
+    if (value >= firstTemp && !insts.empty() && insts.back().dst == value && insts.back().op != IROp::Phi)
+    {
+        insts.back().dst = var;
+        return;
+    }
+    emit(IROp::Copy, var, value);
+}
+
+int IRBuilder::lowerExpr(const Expr &expr)
+{
+    if (auto lit = dynamic_cast<const IntLit *>(&expr))
+    {
+        int dst = func->newVReg();
+        emit(IROp::Const, dst).imm = lit->value;
+        return dst;
+    }
+    if (auto var = dynamic_cast<const Var *>(&expr))
+    {
+        return lookup(var->name);
+    }
+    if (auto bin = dynamic_cast<const BinOpExpr *>(&expr))
+    {
+        if ((bin->op == BinOp::And || bin->op == BinOp::Or) && flattenLogic && isBranchlessLogic(*bin))
+        {
+            return lowerBranchlessLogic(*bin);
+        }
+        if (bin->op == BinOp::And || bin->op == BinOp::Or)
+        {
+            // result = 1 on the true path, 0 on the false path
+            int result = func->newVReg();
+            int trueBlock = func->newBlock();
+            int falseBlock = func->newBlock();
+            int join = func->newBlock();
+            lowerCond(expr, trueBlock, falseBlock);
+            setBlock(trueBlock);
+            emit(IROp::Const, result).imm = 1;
+            jump(join);
+            setBlock(falseBlock);
+            emit(IROp::Const, result).imm = 0;
+            jump(join);
+            setBlock(join);
+            return result;
+        }
+        static const IROp ops[] = {IROp::Add, IROp::Sub, IROp::Mul, IROp::Div, IROp::Rem, IROp::Lt, IROp::Gt,
+                                   IROp::Le, IROp::Ge, IROp::Eq, IROp::Ne};
+        int left = lowerExpr(*bin->left);
+        int right = lowerExpr(*bin->right);
+        int dst = func->newVReg();
+        emit(ops[static_cast<int>(bin->op)], dst, left, right);
+        return dst;
+    }
+    if (auto un = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        int operand = lowerExpr(*un->right);
+        int dst = func->newVReg();
+        emit(un->op == UnOp::Neg ? IROp::Neg : IROp::Not, dst, operand);
+        return dst;
+    }
+    if (auto call = dynamic_cast<const Call *>(&expr))
+    {
+        auto it = funcParams.find(call->name);
+        if (it != funcParams.end() && it->second != call->args.size())
+        {
+            throw std::runtime_error("Wrong number of arguments in call to " + call->name);
+        }
+        std::vector<int> args;
+        for (const auto &arg : call->args)
+        {
+            args.push_back(lowerExpr(*arg));
+        }
+        int dst = func->newVReg();
+        IRInst &inst = emit(IROp::Call, dst);
+        inst.callee = call->name;
+        inst.args = std::move(args);
+        inst.pos = call->pos;
+        return dst;
+    }
+    throw std::runtime_error("Unknown expression type");
+}
+
+// Both operands evaluated: a && b is (a != 0) & (b != 0), a || b is (a | b) != 0
+int IRBuilder::lowerBranchlessLogic(const BinOpExpr &logic)
+{
+    int zero = -1;
+    auto normalize = [&](int value) {
+        if (zero < 0)
+        {
+            zero = func->newVReg();
+            emit(IROp::Const, zero).imm = 0;
+        }
+        int dst = func->newVReg();
+        emit(IROp::Ne, dst, value, zero);
+        return dst;
+    };
+    bool leftBoolean = isBooleanExpr(*logic.left);
+    bool rightBoolean = isBooleanExpr(*logic.right);
+    int left = lowerExpr(*logic.left);
+    int right = lowerExpr(*logic.right);
+    int dst = func->newVReg();
+    if (logic.op == BinOp::And)
+    {
+        emit(IROp::And, dst, leftBoolean ? left : normalize(left), rightBoolean ? right : normalize(right));
+        return dst;
+    }
+    emit(IROp::Or, dst, left, right);
+    return leftBoolean && rightBoolean ? dst : normalize(dst);
+}
+
+void IRBuilder::lowerCond(const Expr &expr, int trueBlock, int falseBlock)
+{
+    if (auto lit = dynamic_cast<const IntLit *>(&expr))
+    {
+        jump(lit->value != 0 ? trueBlock : falseBlock);
+        return;
+    }
+    if (auto un = dynamic_cast<const UnOpExpr *>(&expr); un && un->op == UnOp::Not)
+    {
+        lowerCond(*un->right, falseBlock, trueBlock);
+        return;
+    }
+    if (auto bin = dynamic_cast<const BinOpExpr *>(&expr); bin && (bin->op == BinOp::And || bin->op == BinOp::Or))
+    {
+        int rhs = func->newBlock();
+        if (bin->op == BinOp::And)
+        {
+            lowerCond(*bin->left, rhs, falseBlock);
+        }
+        else
+        {
+            lowerCond(*bin->left, trueBlock, rhs);
+        }
+        setBlock(rhs);
+        lowerCond(*bin->right, trueBlock, falseBlock);
+        return;
+    }
+    branch(lowerExpr(expr), trueBlock, falseBlock);
+}
+
+void IRBuilder::lowerStmt(const Stmt &stmt)
+{
+    pos = stmt.pos;
+    int firstTemp = func->numVRegs();
+    if (auto block = dynamic_cast<const Block *>(&stmt))
+    {
+        scopes.emplace_back();
+        for (const auto &s : block->stmts)
+        {
+            lowerStmt(*s);
+        }
+        scopes.pop_back();
+    }
+    else if (dynamic_cast<const EmptyStmt *>(&stmt))
+    {
+    }
+    else if (auto exprStmt = dynamic_cast<const ExprStmt *>(&stmt))
+    {
+        int value = lowerExpr(*exprStmt->expr);
+        auto &insts = func->blocks[current].insts;
+        if (!insts.empty() && insts.back().op == IROp::Call && insts.back().dst == value)
+        {
+            insts.back().dst = -1; // result unused
+        }
+    }
+    else if (auto assign = dynamic_cast<const Assign *>(&stmt))
+    {
+        int value = lowerExpr(*assign->value);
+        assignTo(lookup(assign->name), value, firstTemp);
+    }
+    else if (auto decl = dynamic_cast<const Decl *>(&stmt))
+    {
+        // The initializer still sees an outer variable of the same name
+        int value = -1;
+        if (decl->value)
+        {
+            value = lowerExpr(*decl->value);
+        }
+        int var = func->newVReg(decl->name);
+        if (value >= 0)
+        {
+            assignTo(var, value, firstTemp);
+        }
+        else
+        {
+            emit(IROp::Const, var).imm = 0;
+        }
+        scopes.back()[decl->name] = var;
+    }
+    else if (auto ifStmt = dynamic_cast<const If *>(&stmt))
+    {
+        int thenBlock = func->newBlock();
+        int elseBlock = ifStmt->elseBody ? func->newBlock() : -1;
+        int join = func->newBlock();
+        lowerCond(*ifStmt->condition, thenBlock, ifStmt->elseBody ? elseBlock : join);
+        setBlock(thenBlock);
+        lowerStmt(*ifStmt->thenBody);
+        if (!terminated())
+        {
+            jump(join);
+        }
+        if (ifStmt->elseBody)
+        {
+            setBlock(elseBlock);
+            lowerStmt(*ifStmt->elseBody);
+            if (!terminated())
+            {
+                jump(join);
+            }
+        }
+        setBlock(join);
+    }
+    else if (auto whileStmt = dynamic_cast<const While *>(&stmt))
+    {
+        int header = func->newBlock();
+        int body = func->newBlock();
+        int exit = func->newBlock();
+        jump(header);
+        setBlock(header);
+        pos = stmt.pos;
+        lowerCond(*whileStmt->condition, body, exit);
+        setBlock(body);
+        loops.push_back({exit, header});
+        lowerStmt(*whileStmt->body);
+        loops.pop_back();
+        if (!terminated())
+        {
+            jump(header);
+        }
+        setBlock(exit);
+    }
+    else if (dynamic_cast<const Break *>(&stmt))
+    {
+        if (loops.empty())
+        {
+            throw std::runtime_error("Break statement not within a loop");
+        }
+        jump(loops.back().breakBlock);
+        setBlock(func->newBlock()); // following code is unreachable
+    }
+    else if (dynamic_cast<const Continue *>(&stmt))
+    {
+        if (loops.empty())
+        {
+            throw std::runtime_error("Continue statement not within a loop");
+        }
+        jump(loops.back().continueBlock);
+        setBlock(func->newBlock());
+    }
+    else if (auto ret = dynamic_cast<const Return *>(&stmt))
+    {
+        int value = ret->returnValue ? lowerExpr(*ret->returnValue) : -1;
+        emit(IROp::Ret, -1, value);
+        setBlock(func->newBlock());
+    }
+    else
+    {
+        throw std::runtime_error("Unknown statement type");
+    }
+}
+
+void IRBuilder::lowerFunc(const FuncDef &def, IRFunction &out)
+{
+    func = &out;
+    out.name = def.name;
+    out.returnsInt = def.rtype == RetType::Int;
+    out.pos = def.pos;
+    scopes.clear();
+    scopes.emplace_back();
+    loops.clear();
+    current = out.newBlock();
+    pos = def.pos;
+    for (const auto &arg : def.args)
+    {
+        int vreg = out.newVReg(arg);
+        out.params.push_back(vreg);
+        scopes.back()[arg] = vreg;
+    }
+    if (def.body)
+    {
+        lowerStmt(*def.body);
+    }
+    if (!terminated())
+    {
+        // Falling off the end returns 0 from an int function
+        pos = def.pos;
+        int value = -1;
+        if (out.returnsInt)
+        {
+            value = out.newVReg();
+            emit(IROp::Const, value).imm = 0;
+        }
+        emit(IROp::Ret, -1, value);
+    }
+    out.removeUnreachable();
+    func = nullptr;
+}
+
+IRProgram IRBuilder::build(const Program &program)
+{
+    IRProgram result;
+    funcParams.clear();
+    for (const auto &def : program.functions)
+    {
+        funcParams[def->name] = def->args.size();
+    }
+    result.functions.resize(program.functions.size());
+    for (size_t i = 0; i < program.functions.size(); i++)
+    {
+        lowerFunc(*program.functions[i], result.functions[i]);
+    }
+    return result;
+}
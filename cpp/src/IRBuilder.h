@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include "ASTNode.h"
+#include "IR.h"
+
+// Lowers the folded AST to IR. Every ToyC variable becomes one vreg
+// (assigned by Copy or directly by the instruction computing its value),
+// && / || and conditions of If/While become control flow, except a
+// && / || value whose right operand is cheap and pure (isBranchlessLogic),
+// which is computed without branches.
+class IRBuilder
+{
+private:
+    struct LoopTargets
+    {
+        int breakBlock;
+        int continueBlock;
+    };
+
+    IRFunction *func = nullptr;
+    int current = 0; // block receiving new instructions
+    std::vector<std::map<std::string, int>> scopes;
+    std::vector<LoopTargets> loops;
+    std::map<std::string, size_t> funcParams;
+    SourcePos pos; // position of the statement being lowered
+    bool flattenLogic = true;
+
+    IRInst &emit(IROp op, int dst = -1, int a = -1, int b = -1);
+    void jump(int target);
+    void branch(int cond, int target, int elseTarget);
+    bool terminated() const;
+    void setBlock(int block) { current = block; }
+    int lookup(const std::string &name) const;
+    void assignTo(int var, int value, int firstTemp);
+
+    int lowerExpr(const Expr &expr);
+    int lowerBranchlessLogic(const BinOpExpr &logic);
+    void lowerCond(const Expr &expr, int trueBlock, int falseBlock);
+    void lowerStmt(const Stmt &stmt);
+    void lowerFunc(const FuncDef &def, IRFunction &out);
+
+public:
+    void setFlattenLogic(bool enabled) { flattenLogic = enabled; }
+    IRProgram build(const Program &program);
+};
@@ -0,0 +1,825 @@
+#include "IREmitter.h"
+#include "IRAnalysis.h"
+#include "InstSelect.h"
+#include "Peephole.h"
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
+RegisterAssignment RegisterAssignment::allStack(const IRFunction &func)
+{
+    RegisterAssignment result;
+    result.locations.resize(func.numVRegs());
+    for (auto &loc : result.locations)
+    {
+        loc.slot = result.slotCount++;
+    }
+    return result;
+}
+
+const CallingConvention &CallingConvention::ilp32()
+{
+    static const CallingConvention standard = [] {
+        CallingConvention conv;
+        for (int i = 0; i < 7; i++)
+            conv.clobbers.insert("t" + std::to_string(i));
+        for (int i = 0; i < 8; i++)
+            conv.clobbers.insert("a" + std::to_string(i));
+        return conv;
+    }();
+    return standard;
+}
+
+const CallingConvention &CallingConvention::lookup(const std::map<std::string, CallingConvention> *conventions,
+                                                   const std::string &name)
+{
+    if (conventions)
+    {
+        auto it = conventions->find(name);
+        if (it != conventions->end())
+            return it->second;
+    }
+    return ilp32();
+}
+
+// Source-level operator of a binary IR instruction
+static BinOp binOpOf(IROp op)
+{
+    static const BinOp ops[] = {BinOp::Add, BinOp::Sub, BinOp::Mul, BinOp::Div, BinOp::Mod, BinOp::Lt,
+                                BinOp::Gt,  BinOp::Le,  BinOp::Ge,  BinOp::Eq,  BinOp::Ne};
+    return ops[static_cast<int>(op) - static_cast<int>(IROp::Add)];
+}
+
+static IROp irOpOf(BinOp op)
+{
+    static const IROp ops[] = {IROp::Add, IROp::Sub, IROp::Mul, IROp::Div, IROp::Rem, IROp::Lt,
+                               IROp::Gt,  IROp::Le,  IROp::Ge,  IROp::Eq,  IROp::Ne};
+    return ops[static_cast<int>(op)];
+}
+
+void selectImmediates(IRProgram &program)
+{
+    for (auto &func : program.functions)
+    {
+        std::vector<int> values;
+        std::vector<char> constant = findConstantVRegs(func, values);
+        for (auto &block : func.blocks)
+        {
+            for (auto &inst : block.insts)
+            {
+                // The bitwise And/Or have no source operator and keep both operands
+                if (!inst.isBinary() || inst.b < 0 || inst.op == IROp::And || inst.op == IROp::Or)
+                    continue;
+                BinOp op = binOpOf(inst.op);
+                if (constant[inst.b] && (hasImmediateForm(op, values[inst.b]) || hasStrengthReduction(op, values[inst.b])))
+                {
+                    inst.imm = values[inst.b];
+                    inst.b = -1;
+                }
+                else if (constant[inst.a] && !constant[inst.b] && mirrorOperator(op) &&
+                         (hasImmediateForm(op, values[inst.a]) || hasStrengthReduction(op, values[inst.a])))
+                {
+                    inst.op = irOpOf(op);
+                    inst.imm = values[inst.a];
+                    inst.a = inst.b;
+                    inst.b = -1;
+                }
+                else if (constant[inst.a] && values[inst.a] == 0 && inst.op == IROp::Sub)
+                {
+                    // 0 - x (sub rd, x0, x)
+                    inst.op = IROp::Neg;
+                    inst.a = inst.b;
+                    inst.b = -1;
+                }
+            }
+        }
+    }
+}
+
+std::string CallingConvention::argumentPlace(size_t i) const
+{
+    if (i < paramRegs.size() && !paramRegs[i].empty())
+        return paramRegs[i];
+    return i < 8 ? "a" + std::to_string(i) : "";
+}
+
+void IREmitter::emitLoc(const SourcePos &pos)
+{
+    if (!debugInfo || pos.line <= 0)
+    {
+        return;
+    }
+    if (pos.line == lastLoc.line && pos.col == lastLoc.col)
+    {
+        return;
+    }
+    code << ".loc 1 " << pos.line << " " << pos.col << "\n";
+    lastLoc = pos;
+}
+
+std::string IREmitter::load(int v, const char *scratch)
+{
+    const VRegLocation &loc = assignment->locations[v];
+    if (!loc.reg.empty())
+    {
+        return loc.reg;
+    }
+    if (loc.remat)
+    {
+        emitLoadConstant(code, scratch, loc.constant);
+        return scratch;
+    }
+    if (!loc.inMemory())
+    {
+        throw std::runtime_error("IR value v" + std::to_string(v) + " used without a location in " + func->name);
+    }
+    code << "lw " << scratch << ", " << memoryOffset(loc) << "(sp)\n";
+    return scratch;
+}
+
+std::string IREmitter::target(int v, const char *scratch) const
+{
+    if (v >= 0 && !assignment->locations[v].reg.empty())
+    {
+        return assignment->locations[v].reg;
+    }
+    return scratch;
+}
+
+void IREmitter::store(int v, const std::string &reg)
+{
+    if (v < 0)
+    {
+        return;
+    }
+    const VRegLocation &loc = assignment->locations[v];
+    if (loc.inMemory())
+    {
+        code << "sw " << reg << ", " << memoryOffset(loc) << "(sp)\n";
+    }
+}
+
+void IREmitter::emitCopy(int dst, int src)
+{
+    const VRegLocation &to = assignment->locations[dst];
+    if (to.reg.empty() && !to.inMemory())
+    {
+        return; // dead value
+    }
+    const VRegLocation &from = assignment->locations[src];
+    if (!to.reg.empty() && !from.reg.empty())
+    {
+        if (to.reg != from.reg)
+        {
+            code << "mv " << to.reg << ", " << from.reg << "\n";
+        }
+        return;
+    }
+    if (to.reg.empty() && from.reg.empty() && to.outgoing < 0 && to.slot == from.slot)
+    {
+        return;
+    }
+    if (to.reg.empty() && from.remat && from.constant == 0)
+    {
+        code << "sw zero, " << memoryOffset(to) << "(sp)\n";
+        return;
+    }
+    std::string value = load(src, to.reg.empty() ? "t0" : to.reg.c_str());
+    store(dst, value);
+}
+
+void IREmitter::emitArgumentMoves(std::vector<std::pair<std::string, int>> moves)
+{
+    // Register sources first, as a parallel copy: a move may go once no other
+    // pending move still reads its destination, a cycle is broken through t0
+    std::vector<std::pair<std::string, std::string>> pending;
+    std::vector<std::pair<std::string, int>> loads;
+    for (const auto &[dst, v] : moves)
+    {
+        const std::string &src = assignment->locations[v].reg;
+        if (src.empty())
+            loads.push_back({dst, v});
+        else if (src != dst)
+            pending.push_back({dst, src});
+    }
+    while (!pending.empty())
+    {
+        auto ready = std::find_if(pending.begin(), pending.end(), [&](const auto &move) {
+            return std::none_of(pending.begin(), pending.end(),
+                                [&](const auto &other) { return other.second == move.first; });
+        });
+        if (ready == pending.end())
+        {
+            std::string parked = pending.front().second;
+            code << "mv t0, " << parked << "\n";
+            for (auto &move : pending)
+            {
+                if (move.second == parked)
+                    move.second = "t0";
+            }
+            continue;
+        }
+        code << "mv " << ready->first << ", " << ready->second << "\n";
+        pending.erase(ready);
+    }
+    // Stack sources overwrite nothing that is still to be read
+    for (const auto &[dst, v] : loads)
+    {
+        load(v, dst.c_str());
+    }
+}
+
+void IREmitter::emitInst(const IRInst &inst, const std::vector<int> &liveAcross)
+{
+    switch (inst.op)
+    {
+    case IROp::Const:
+    {
+        const VRegLocation &loc = assignment->locations[inst.dst];
+        if (loc.reg.empty() && !loc.inMemory())
+        {
+            break; // dead, or rematerialized at its uses
+        }
+        if (loc.reg.empty() && inst.imm == 0)
+        {
+            code << "sw zero, " << memoryOffset(loc) << "(sp)\n";
+            break;
+        }
+        std::string d = target(inst.dst, "t0");
+        emitLoadConstant(code, d, inst.imm);
+        store(inst.dst, d);
+        break;
+    }
+    case IROp::Copy:
+        emitCopy(inst.dst, inst.a);
+        break;
+    case IROp::Neg:
+    case IROp::Not:
+    {
+        std::string a = load(inst.a, "t0");
+        std::string d = target(inst.dst, "t0");
+        code << (inst.op == IROp::Neg ? "neg " : "seqz ") << d << ", " << a << "\n";
+        store(inst.dst, d);
+        break;
+    }
+    case IROp::Add:
+    case IROp::Sub:
+    case IROp::Mul:
+    case IROp::Div:
+    case IROp::Rem:
+    case IROp::Lt:
+    case IROp::Gt:
+    case IROp::Le:
+    case IROp::Ge:
+    case IROp::Eq:
+    case IROp::Ne:
+    case IROp::And:
+    case IROp::Or:
+    {
+        std::string a = load(inst.a, "t0");
+        if (inst.b < 0)
+        {
+            // Right operand folded into an immediate by selectImmediates; t1 and t2 are free
+            // scratch for a strength-reduced multiply or divide
+            std::string d = target(inst.dst, "t0");
+            BinOp op = binOpOf(inst.op);
+            if (hasImmediateForm(op, inst.imm))
+                emitImmediateOp(code, op, d, a, inst.imm);
+            else
+                emitStrengthReduced(code, op, d, a, inst.imm, "t1", "t2");
+            store(inst.dst, d);
+            break;
+        }
+        std::string b = load(inst.b, "t1");
+        std::string d = target(inst.dst, "t0");
+        switch (inst.op)
+        {
+        case IROp::Add:
+            code << "add " << d << ", " << a << ", " << b << "\n";
+            break;
+        case IROp::Sub:
+            code << "sub " << d << ", " << a << ", " << b << "\n";
+            break;
+        case IROp::Mul:
+            code << "mul " << d << ", " << a << ", " << b << "\n";
+            break;
+        case IROp::Div:
+            code << "div " << d << ", " << a << ", " << b << "\n";
+            break;
+        case IROp::Rem:
+            code << "rem " << d << ", " << a << ", " << b << "\n";
+            break;
+        case IROp::And:
+            code << "and " << d << ", " << a << ", " << b << "\n";
+            break;
+        case IROp::Or:
+            code << "or " << d << ", " << a << ", " << b << "\n";
+            break;
+        case IROp::Lt:
+            code << "slt " << d << ", " << a << ", " << b << "\n";
+            break;
+        case IROp::Gt:
+            code << "slt " << d << ", " << b << ", " << a << "\n";
+            break;
+        case IROp::Le:
+            code << "slt " << d << ", " << b << ", " << a << "\n";
+            code << "xori " << d << ", " << d << ", 1\n";
+            break;
+        case IROp::Ge:
+            code << "slt " << d << ", " << a << ", " << b << "\n";
+            code << "xori " << d << ", " << d << ", 1\n";
+            break;
+        case IROp::Eq:
+            code << "sub " << d << ", " << a << ", " << b << "\n";
+            code << "seqz " << d << ", " << d << "\n";
+            break;
+        default:
+            code << "sub " << d << ", " << a << ", " << b << "\n";
+            code << "snez " << d << ", " << d << "\n";
+            break;
+        }
+        store(inst.dst, d);
+        break;
+    }
+    case IROp::Call:
+    {
+        emitLoc(inst.pos);
+        // Save the registers the callee clobbers whose values survive the call
+        const CallingConvention &conv = CallingConvention::lookup(conventions, inst.callee);
+        std::vector<std::string> saved;
+        for (int v : liveAcross)
+        {
+            const std::string &reg = assignment->locations[v].reg;
+            if (conv.clobbers.count(reg) && std::find(saved.begin(), saved.end(), reg) == saved.end())
+            {
+                saved.push_back(reg);
+            }
+        }
+        auto saveOffset = [&](const std::string &reg) {
+            size_t index = std::find(callSaveRegs.begin(), callSaveRegs.end(), reg) - callSaveRegs.begin();
+            return callSaveBase + static_cast<int>(index) * 4;
+        };
+        for (const auto &reg : saved)
+        {
+            code << "sw " << reg << ", " << saveOffset(reg) << "(sp)\n";
+            callerSaveStores++;
+        }
+        // ILP32 places: the first eight arguments in a0-a7, the rest in the
+        // outgoing area at 0(sp) upwards; an internal callee may take any
+        // argument in a register of its own instead. A value the allocator
+        // placed in its outgoing slot is already there.
+        for (size_t i = 8; i < inst.args.size(); i++)
+        {
+            if (!conv.argumentPlace(i).empty() ||
+                assignment->locations[inst.args[i]].outgoing == static_cast<int>(i - 8) * 4)
+                continue;
+            std::string arg = load(inst.args[i], "t0");
+            code << "sw " << arg << ", " << (i - 8) * 4 << "(sp)\n";
+        }
+        std::vector<std::pair<std::string, int>> argMoves;
+        for (size_t i = 0; i < inst.args.size(); i++)
+        {
+            std::string place = conv.argumentPlace(i);
+            if (!place.empty())
+                argMoves.push_back({place, inst.args[i]});
+        }
+        emitArgumentMoves(argMoves);
+        code << "call " << inst.callee << "\n";
+        callSites.push_back(inst.callee);
+        if (inst.dst >= 0)
+        {
+            std::string d = target(inst.dst, "a0");
+            if (d != "a0")
+            {
+                code << "mv " << d << ", a0\n";
+            }
+            store(inst.dst, d);
+        }
+        for (const auto &reg : saved)
+        {
+            code << "lw " << reg << ", " << saveOffset(reg) << "(sp)\n";
+        }
+        break;
+    }
+    default:
+        throw std::runtime_error(std::string("Unexpected IR instruction ") + irOpName(inst.op));
+    }
+}
+
+void IREmitter::emitBranch(const IRInst &inst, int next, const IRInst *compare)
+{
+    // Without a fused comparison the condition is tested against zero
+    IROp op = IROp::Ne;
+    std::string lhs, rhs = "zero";
+    if (compare == nullptr)
+    {
+        lhs = load(inst.a, "t0");
+    }
+    else
+    {
+        op = compare->op == IROp::Not ? IROp::Eq : compare->op;
+        lhs = load(compare->a, "t0");
+        if (compare->b >= 0)
+        {
+            rhs = load(compare->b, "t1");
+        }
+        else if (compare->op != IROp::Not && compare->imm != 0)
+        {
+            emitLoadConstant(code, "t1", compare->imm);
+            rhs = "t1";
+        }
+    }
+    static const IROp inverse[] = {IROp::Ge, IROp::Le, IROp::Gt, IROp::Lt, IROp::Ne, IROp::Eq};
+    static const char *const mnemonic[] = {"blt", "bgt", "ble", "bge", "beq", "bne"};
+    int label = inst.target;
+    if (inst.target == next)
+    {
+        op = inverse[static_cast<int>(op) - static_cast<int>(IROp::Lt)];
+        label = inst.elseTarget;
+    }
+    const char *branch = mnemonic[static_cast<int>(op) - static_cast<int>(IROp::Lt)];
+    if (rhs == "zero")
+    {
+        code << branch << "z " << lhs << ", " << func->blockLabel(label) << "\n";
+    }
+    else
+    {
+        code << branch << " " << lhs << ", " << rhs << ", " << func->blockLabel(label) << "\n";
+    }
+    if (inst.target != next && inst.elseTarget != next)
+    {
+        code << "j " << func->blockLabel(inst.elseTarget) << "\n";
+    }
+}
+
+void IREmitter::emitHeader()
+{
+    output << ".text\n";
+    if (debugInfo)
+    {
+        output << ".file 1 \"" << sourceName << "\"\n";
+    }
+    output << ".globl main\n";
+}
+
+void IREmitter::emitFunction(const IRFunction &f, const RegisterAssignment &assign)
+{
+    if (f.isSSA)
+    {
+        throw std::runtime_error("Function " + f.name + " must leave SSA form before emission");
+    }
+    func = &f;
+    assignment = &assign;
+    code.str("");
+    code.clear();
+    outgoingSize = 0;
+    callerSaveStores = 0;
+    callSites.clear();
+    callSaveRegs.clear();
+    lastLoc = SourcePos();
+
+    // Values live across each call, found by a backward scan of every block
+    Liveness live(f);
+    size_t n = f.blocks.size();
+    std::set<std::string> calleeClobbers;
+    std::vector<std::vector<std::vector<int>>> liveAcross(n);
+    for (size_t b = 0; b < n; b++)
+    {
+        const auto &insts = f.blocks[b].insts;
+        liveAcross[b].resize(insts.size());
+        VRegSet current = live.liveOut[b];
+        for (size_t i = insts.size(); i-- > 0;)
+        {
+            const IRInst &inst = insts[i];
+            if (inst.dst >= 0)
+            {
+                current.reset(inst.dst);
+            }
+            if (inst.op == IROp::Call)
+            {
+                const CallingConvention &conv = CallingConvention::lookup(conventions, inst.callee);
+                calleeClobbers.insert(conv.clobbers.begin(), conv.clobbers.end());
+                for (size_t a = 8; a < inst.args.size(); a++)
+                {
+                    if (conv.argumentPlace(a).empty())
+                        outgoingSize = std::max(outgoingSize, static_cast<int>(a - 7) * 4);
+                }
+                current.forEach([&](int v) {
+                    liveAcross[b][i].push_back(v);
+                    const std::string &reg = assign.locations[v].reg;
+                    if (conv.clobbers.count(reg) &&
+                        std::find(callSaveRegs.begin(), callSaveRegs.end(), reg) == callSaveRegs.end())
+                    {
+                        callSaveRegs.push_back(reg);
+                    }
+                });
+            }
+            for (int v : inst.uses())
+            {
+                current.set(v);
+            }
+        }
+    }
+    // An ILP32 function preserves the s registers it or its callees write;
+    // an internal one leaves that to its callers
+    const CallingConvention &own = CallingConvention::lookup(conventions, f.name);
+    std::set<std::string> calleeSaved;
+    if (own.standard)
+    {
+        for (const auto &loc : assign.locations)
+        {
+            if (!loc.reg.empty() && loc.reg[0] == 's')
+                calleeSaved.insert(loc.reg);
+        }
+        for (const auto &reg : calleeClobbers)
+        {
+            if (reg[0] == 's')
+                calleeSaved.insert(reg);
+        }
+    }
+    bool hasCalls = std::any_of(f.blocks.begin(), f.blocks.end(), [](const IRBlock &block) {
+        return std::any_of(block.insts.begin(), block.insts.end(),
+                           [](const IRInst &inst) { return inst.op == IROp::Call; });
+    });
+    callSaveBase = outgoingSize + assign.slotCount * 4;
+    int calleeBase = callSaveBase + static_cast<int>(callSaveRegs.size()) * 4;
+    int raOffset = calleeBase + static_cast<int>(calleeSaved.size()) * 4;
+    // A leaf keeps ra in place; a frame with nothing in it is not allocated
+    frameSize = (raOffset + (hasCalls ? 4 : 0) + 15) / 16 * 16;
+
+    // Shrink-wrapping: the prologue goes to the nearest block dominating
+    // every block that touches the frame (calls, stack slots, writes to
+    // saved s registers), moved out of any loop. Blocks it dominates return
+    // through the epilogue, the others (early exits) return directly. Until
+    // then parameters homed in saved registers are read from a0-a7.
+    DominatorTree dom(f);
+    int savePoint = -1;
+    if (frameSize > 0)
+    {
+        auto needsFrame = [&](const IRInst &inst) {
+            if (inst.op == IROp::Call)
+                return true;
+            auto touches = [&](int v) {
+                const VRegLocation &loc = assign.locations[v];
+                if (loc.reg.empty())
+                    return loc.inMemory();
+                bool isParam = std::find(f.params.begin(), f.params.end(), v) != f.params.end();
+                return calleeSaved.count(loc.reg) && (!isParam || v == inst.dst);
+            };
+            std::vector<int> uses = inst.uses();
+            return (inst.dst >= 0 && touches(inst.dst)) || std::any_of(uses.begin(), uses.end(), touches);
+        };
+        auto commonDominator = [&](int a, int b) {
+            std::vector<char> above(n, 0);
+            for (int x = a; x >= 0; x = dom.idom[x])
+                above[x] = 1;
+            while (b >= 0 && !above[b])
+                b = dom.idom[b];
+            return b < 0 ? 0 : b;
+        };
+        for (size_t i = 0; i < f.params.size(); i++)
+        {
+            const VRegLocation &loc = assign.locations[f.params[i]];
+            bool ownReg = i < own.paramRegs.size() && !own.paramRegs[i].empty();
+            if ((loc.reg.empty() && loc.slot >= 0) || (i >= 8 && !ownReg))
+                savePoint = 0; // stored to, or loaded from, the stack on entry
+        }
+        for (size_t b = 0; b < n && savePoint != 0; b++)
+        {
+            const auto &insts = f.blocks[b].insts;
+            if (std::any_of(insts.begin(), insts.end(), needsFrame))
+                savePoint = savePoint < 0 ? static_cast<int>(b) : commonDominator(savePoint, static_cast<int>(b));
+        }
+        if (savePoint < 0)
+        {
+            savePoint = 0;
+        }
+        LoopInfo loops(f, dom);
+        while (savePoint > 0 && loops.depth[savePoint] > 0)
+        {
+            savePoint = dom.idom[savePoint];
+        }
+        // Every path from the save point must stay in its region until it returns
+        for (size_t b = 0; b < n && savePoint > 0; b++)
+        {
+            if (!dom.dominates(savePoint, static_cast<int>(b)))
+                continue;
+            for (int succ : f.blocks[b].succs)
+            {
+                if (!dom.dominates(savePoint, succ))
+                    savePoint = 0;
+            }
+        }
+    }
+    auto wrapped = [&](int b) { return savePoint >= 0 && dom.dominates(savePoint, b); };
+    RegisterAssignment early = assign;
+    for (size_t i = 0; i < f.params.size() && i < 8; i++)
+    {
+        VRegLocation &loc = early.locations[f.params[i]];
+        if (calleeSaved.count(loc.reg))
+            loc.reg = "a" + std::to_string(i);
+    }
+
+    // Labels are only needed for blocks reached by an emitted jump
+    std::vector<char> needsLabel(n, 0);
+    bool needsReturnLabel = false;
+    for (size_t b = 0; b < n; b++)
+    {
+        const IRInst &term = f.blocks[b].terminator();
+        int next = static_cast<int>(b) + 1;
+        if (term.op == IROp::Jump && term.target != next)
+        {
+            needsLabel[term.target] = 1;
+        }
+        else if (term.op == IROp::Branch)
+        {
+            if (term.target != next)
+                needsLabel[term.target] = 1;
+            if (term.elseTarget != next || term.target == next)
+                needsLabel[term.elseTarget] = 1;
+        }
+        else if (term.op == IROp::Ret && b + 1 != n && wrapped(static_cast<int>(b)))
+        {
+            needsReturnLabel = true;
+        }
+    }
+
+    code << f.name << ":\n";
+    emitLoc(f.pos);
+    // Parameters arrive in a0-a7, the ones after the eighth just above the
+    // frame, unless the convention passes them in their own register
+    auto moveParams = [&](bool saved) {
+        for (size_t i = 0; i < f.params.size(); i++)
+        {
+            int param = f.params[i];
+            const VRegLocation &loc = assign.locations[param];
+            if ((loc.reg.empty() && loc.slot < 0) || (i < own.paramRegs.size() && !own.paramRegs[i].empty()) ||
+                (i < 8 && calleeSaved.count(loc.reg) != static_cast<size_t>(saved)))
+            {
+                continue;
+            }
+            if (i < 8)
+            {
+                std::string argReg = "a" + std::to_string(i);
+                if (!loc.reg.empty())
+                    code << "mv " << loc.reg << ", " << argReg << "\n";
+                else
+                    store(param, argReg);
+                continue;
+            }
+            if (saved != (savePoint >= 0))
+                continue;
+            std::string reg = loc.reg.empty() ? "t0" : loc.reg;
+            int above = savePoint >= 0 ? frameSize : 0;
+            code << "lw " << reg << ", " << above + static_cast<int>(i - 8) * 4 << "(sp)\n";
+            store(param, reg);
+        }
+    };
+    auto emitPrologue = [&] {
+        code << "addi sp, sp, -" << frameSize << "\n";
+        if (hasCalls)
+            code << "sw ra, " << raOffset << "(sp)\n";
+        int offset = calleeBase;
+        for (const auto &reg : calleeSaved)
+        {
+            code << "sw " << reg << ", " << offset << "(sp)\n";
+            offset += 4;
+        }
+        moveParams(true);
+    };
+    if (savePoint == 0)
+    {
+        emitPrologue();
+    }
+    moveParams(false);
+
+    bool epilogueUsed = false;
+    for (size_t b = 0; b < n; b++)
+    {
+        if (needsLabel[b])
+        {
+            code << f.blockLabel(static_cast<int>(b)) << ":\n";
+        }
+        if (savePoint > 0 && static_cast<int>(b) == savePoint)
+        {
+            emitPrologue();
+        }
+        assignment = wrapped(static_cast<int>(b)) ? &assign : &early;
+        const auto &insts = f.blocks[b].insts;
+        int next = b + 1 < n ? static_cast<int>(b) + 1 : -1;
+        // A comparison that only feeds the block's branch becomes a compare-and-branch
+        const IRInst *compare = nullptr;
+        if (insts.size() >= 2 && insts.back().op == IROp::Branch)
+        {
+            const IRInst &last = insts[insts.size() - 2];
+            bool comparison = (last.op >= IROp::Lt && last.op <= IROp::Ne) || last.op == IROp::Not;
+            if (comparison && last.dst == insts.back().a && !live.liveOut[b].test(last.dst))
+            {
+                compare = &last;
+            }
+        }
+        for (size_t i = 0; i < insts.size(); i++)
+        {
+            const IRInst &inst = insts[i];
+            if (&inst == compare)
+            {
+                continue;
+            }
+            emitLoc(inst.pos);
+            if (inst.op == IROp::Jump)
+            {
+                if (inst.target != next)
+                {
+                    code << "j " << f.blockLabel(inst.target) << "\n";
+                }
+            }
+            else if (inst.op == IROp::Branch)
+            {
+                emitBranch(inst, next, compare);
+            }
+            else if (inst.op == IROp::Ret)
+            {
+                if (inst.a >= 0)
+                {
+                    std::string value = load(inst.a, "a0");
+                    if (value != "a0")
+                    {
+                        code << "mv a0, " << value << "\n";
+                    }
+                }
+                if (!wrapped(static_cast<int>(b)))
+                {
+                    code << "ret\n";
+                }
+                else if (next >= 0)
+                {
+                    code << "j " << f.name << "_return\n";
+                    epilogueUsed = true;
+                }
+                else
+                {
+                    epilogueUsed = true;
+                }
+            }
+            else
+            {
+                emitInst(inst, liveAcross[b][i]);
+            }
+        }
+    }
+    assignment = &assign;
+
+    if (epilogueUsed)
+    {
+        if (needsReturnLabel)
+        {
+            code << f.name << "_return:\n";
+        }
+        emitLoc(f.pos);
+        int offset = calleeBase;
+        for (const auto &reg : calleeSaved)
+        {
+            code << "lw " << reg << ", " << offset << "(sp)\n";
+            offset += 4;
+        }
+        if (hasCalls)
+            code << "lw ra, " << raOffset << "(sp)\n";
+        if (frameSize > 0)
+            code << "addi sp, sp, " << frameSize << "\n";
+        code << "ret\n";
+    }
+    std::string text = code.str();
+    std::map<std::string, int> fired;
+    if (peephole)
+    {
+        text = optimizePeephole(text, fired, conventions);
+    }
+    output << text;
+
+    if (stats)
+    {
+        FunctionStats funcStats;
+        funcStats.name = f.name;
+        funcStats.spills = assign.spills;
+        funcStats.remats = assign.remats;
+        funcStats.callerSaveStores = callerSaveStores;
+        funcStats.frameSize = frameSize;
+        int extraSlots = std::max(assign.unsharedSlots - assign.slotCount, 0);
+        funcStats.unsharedFrameSize = (raOffset + (hasCalls ? 4 : 0) + extraSlots * 4 + 15) / 16 * 16;
+        funcStats.callSites = callSites;
+        funcStats.peephole = fired;
+        stats->scanAssembly(funcStats, text);
+        stats->addFunction(funcStats);
+    }
+    func = nullptr;
+    assignment = nullptr;
+}
+
+void IREmitter::emitProgram(const IRProgram &program)
+{
+    emitHeader();
+    for (const auto &f : program.functions)
+    {
+        emitFunction(f, RegisterAssignment::allStack(f));
+    }
+}
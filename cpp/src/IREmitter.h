@@ -0,0 +1,147 @@
+#pragma once
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "IR.h"
+#include "CodegenStats.h"
+
+// Storage of a vreg for its whole lifetime
+struct VRegLocation
+{
+    std::string reg;     // physical register, empty when the vreg lives in a stack slot
+    int slot = -1;       // 4-byte stack slot index when reg is empty; -1 for a vreg that is never stored
+    bool remat = false;  // a constant recomputed with li at every use instead of being stored
+    int constant = 0;    // its value
+    int outgoing = -1;   // byte offset in the outgoing area: a value only passed on the stack to one call
+    int incoming = -1;   // byte offset above the frame: a stack parameter left where the caller put it
+
+    bool inMemory() const { return reg.empty() && (slot >= 0 || outgoing >= 0 || incoming >= 0); }
+};
+
+// Result of register allocation for one function
+struct RegisterAssignment
+{
+    std::vector<VRegLocation> locations; // indexed by vreg
+    int slotCount = 0;                   // stack slots used by locations
+    int unsharedSlots = 0;               // slotCount before stack-slot coloring (0: not colored)
+    int spills = 0;                      // vregs the allocator wanted in a register but left in a slot
+    int remats = 0;                      // vregs it left to rematerialization instead
+
+    // Every vreg in its own stack slot (no allocation)
+    static RegisterAssignment allStack(const IRFunction &func);
+};
+
+// Register contract of a function as seen by its callers
+struct CallingConvention
+{
+    bool standard = true;               // ILP32: a0-a7/stack arguments, s registers preserved
+    std::vector<std::string> paramRegs; // register each parameter arrives in; empty means the ILP32 place
+    std::set<std::string> clobbers;     // registers a call may change
+
+    // t0-t6 and a0-a7
+    static const CallingConvention &ilp32();
+    // Convention of a function, ILP32 when conventions is null or has no entry for it
+    static const CallingConvention &lookup(const std::map<std::string, CallingConvention> *conventions,
+                                           const std::string &name);
+    // Register argument i of a call goes in, "" for the outgoing area at (i-8)*4
+    std::string argumentPlace(size_t i) const;
+};
+
+// Instruction selection on the final IR, after the optimization passes:
+// a binary instruction with a constant operand that has an RV32I
+// immediate form or a strength-reduced sequence (see InstSelect.h) gets
+// it folded into imm, leaving b = -1, so the constant needs no register;
+// 0 - x becomes Neg. Commutative and mirrored comparisons are swapped to
+// put the constant on the right.
+// Passes do not understand the folded form, so this runs just before
+// register allocation.
+void selectImmediates(IRProgram &program);
+
+// Emits RISC-V assembly from (non-SSA) IR and a register assignment.
+//
+// The calling convention is ILP32, as in Generator: the first eight
+// arguments are passed in a0-a7 and the rest on the stack at 0(sp) upwards,
+// the result comes back in a0. t0-t2 are reserved as scratch registers
+// for stack operands; caller saved registers (t*, a*) holding values live
+// across a call are saved in the frame around it, and callee saved
+// registers (s*) named by the assignment are saved in the prologue.
+//
+// With calling conventions from interprocedural allocation, a call to an
+// internal function places arguments straight into the registers the
+// callee keeps its parameters in and saves only the live registers the
+// callee clobbers; an internal function saves no s registers itself.
+//
+// Frame layout from sp upwards: outgoing stack arguments, vreg slots,
+// caller-save area, callee saved registers, ra; the frame is padded to 16
+// bytes and sp does not move between prologue and epilogue.
+//
+// Leaf functions do not save ra and an empty frame is not allocated. The
+// prologue is shrink-wrapped: it goes to the nearest block outside loops
+// that dominates every block needing the frame, and returns on other
+// paths (such as the base case of a recursion) skip it. A comparison used
+// only by the Branch right after it is fused into one compare-and-branch
+// instruction.
+class IREmitter
+{
+private:
+    std::ostream &output;
+    CodegenStats *stats = nullptr;
+    bool debugInfo = false;
+    bool peephole = true;
+    std::string sourceName;
+
+    // State of the function being emitted
+    std::ostringstream code;
+    const IRFunction *func = nullptr;
+    const RegisterAssignment *assignment = nullptr;
+    const std::map<std::string, CallingConvention> *conventions = nullptr;
+    int outgoingSize = 0;                     // outgoing stack-argument area at the bottom of the frame
+    int frameSize = 0;
+    std::vector<std::string> callSaveRegs;    // caller saved registers with a save slot
+    int callSaveBase = 0;                     // offset of the caller-save area
+    int callerSaveStores = 0;
+    std::vector<std::string> callSites;
+    SourcePos lastLoc;
+
+    void emitLoc(const SourcePos &pos);
+    int slotOffset(int slot) const { return outgoingSize + slot * 4; }
+    // sp offset of a vreg that lives in memory (a slot, its outgoing
+    // argument place or its incoming place above the frame)
+    int memoryOffset(const VRegLocation &loc) const
+    {
+        if (loc.incoming >= 0)
+            return frameSize + loc.incoming;
+        return loc.outgoing >= 0 ? loc.outgoing : slotOffset(loc.slot);
+    }
+    // Register holding v, loading it into scratch if it lives on the stack
+    std::string load(int v, const char *scratch);
+    // Register to compute v into; store() writes it back if v lives on the stack
+    std::string target(int v, const char *scratch) const;
+    void store(int v, const std::string &reg);
+    void emitCopy(int dst, int src);
+    // Move call arguments into the registers the callee expects, breaking cycles through t0
+    void emitArgumentMoves(std::vector<std::pair<std::string, int>> moves);
+    void emitInst(const IRInst &inst, const std::vector<int> &liveAcross);
+    // Branch on inst.a, or on the comparison compare computing it, without materializing its value
+    void emitBranch(const IRInst &inst, int next, const IRInst *compare = nullptr);
+
+public:
+    IREmitter(std::ostream &out) : output(out) {}
+    void setStats(CodegenStats *s) { stats = s; }
+    void setPeephole(bool enabled) { peephole = enabled; }
+    // Per-function conventions; functions not in the map use ILP32
+    void setConventions(const std::map<std::string, CallingConvention> *c) { conventions = c; }
+    void setDebugInfo(const std::string &source)
+    {
+        debugInfo = true;
+        sourceName = source;
+    }
+    // .text/.file/.globl header of the assembly file
+    void emitHeader();
+    void emitFunction(const IRFunction &f, const RegisterAssignment &assign);
+    // Header and every function with stack-only storage
+    void emitProgram(const IRProgram &program);
+};
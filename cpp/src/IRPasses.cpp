@@ -0,0 +1,744 @@
+#include "IRPasses.h"
+#include "IRAnalysis.h"
+#include "SSA.h"
+#include "InstSelect.h"
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <tuple>
+
+// Evaluate a binary operation like the RISC-V instructions emitted for it
+static bool foldBinary(IROp op, int32_t a, int32_t b, int32_t &result)
+{
+    uint32_t ua = static_cast<uint32_t>(a), ub = static_cast<uint32_t>(b);
+    switch (op)
+    {
+    case IROp::Add:
+        result = static_cast<int32_t>(ua + ub);
+        return true;
+    case IROp::Sub:
+        result = static_cast<int32_t>(ua - ub);
+        return true;
+    case IROp::Mul:
+        result = static_cast<int32_t>(ua * ub);
+        return true;
+    case IROp::Div:
+    case IROp::Rem:
+        if (b == 0)
+        {
+            return false;
+        }
+        if (a == INT32_MIN && b == -1)
+        {
+            result = op == IROp::Div ? INT32_MIN : 0;
+            return true;
+        }
+        result = op == IROp::Div ? a / b : a % b;
+        return true;
+    case IROp::Lt:
+        result = a < b;
+        return true;
+    case IROp::Gt:
+        result = a > b;
+        return true;
+    case IROp::Le:
+        result = a <= b;
+        return true;
+    case IROp::Ge:
+        result = a >= b;
+        return true;
+    case IROp::Eq:
+        result = a == b;
+        return true;
+    case IROp::Ne:
+        result = a != b;
+        return true;
+    case IROp::And:
+        result = a & b;
+        return true;
+    case IROp::Or:
+        result = a | b;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void makeConst(IRInst &inst, int32_t value)
+{
+    inst.op = IROp::Const;
+    inst.imm = value;
+    inst.a = inst.b = -1;
+    inst.args.clear();
+    inst.phiBlocks.clear();
+}
+
+static void makeCopy(IRInst &inst, int src)
+{
+    inst.op = IROp::Copy;
+    inst.a = src;
+    inst.b = -1;
+    inst.args.clear();
+    inst.phiBlocks.clear();
+}
+
+// A phi at index i was turned into an ordinary instruction: move it below
+// the remaining phis of the block
+static void movePastPhis(IRBlock &block, size_t index)
+{
+    size_t end = index + 1;
+    while (end < block.insts.size() && block.insts[end].op == IROp::Phi)
+    {
+        end++;
+    }
+    std::rotate(block.insts.begin() + index, block.insts.begin() + index + 1, block.insts.begin() + end);
+}
+
+static void removePhiIncoming(IRBlock &block, int pred)
+{
+    for (auto &inst : block.insts)
+    {
+        if (inst.op != IROp::Phi)
+            break;
+        for (size_t i = 0; i < inst.phiBlocks.size();)
+        {
+            if (inst.phiBlocks[i] == pred)
+            {
+                inst.phiBlocks.erase(inst.phiBlocks.begin() + i);
+                inst.args.erase(inst.args.begin() + i);
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+}
+
+static bool hasPhis(const IRBlock &block)
+{
+    return !block.insts.empty() && block.insts.front().op == IROp::Phi;
+}
+
+int SimplifyCFGPass::run(IRFunction &func)
+{
+    int changes = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        func.computeCFG();
+        for (auto &block : func.blocks)
+        {
+            IRInst &term = block.terminator();
+            if (term.op == IROp::Branch && term.target == term.elseTarget)
+            {
+                term.op = IROp::Jump;
+                term.a = -1;
+                term.elseTarget = -1;
+                changed = true;
+            }
+        }
+        func.computeCFG();
+        // Thread jumps through blocks that only jump on
+        for (auto &block : func.blocks)
+        {
+            if (block.id == 0 || block.insts.size() != 1 || block.insts[0].op != IROp::Jump)
+            {
+                continue;
+            }
+            int target = block.insts[0].target;
+            if (target == block.id || hasPhis(func.blocks[target]))
+            {
+                continue;
+            }
+            for (int pred : block.preds)
+            {
+                IRInst &term = func.blocks[pred].terminator();
+                if (term.target == block.id)
+                    term.target = target;
+                if (term.elseTarget == block.id)
+                    term.elseTarget = target;
+                changed = true;
+            }
+            if (changed)
+            {
+                break; // preds are stale now
+            }
+        }
+        if (changed)
+        {
+            changes++;
+            func.removeUnreachable();
+            continue;
+        }
+        // Merge a block into its only predecessor
+        for (auto &block : func.blocks)
+        {
+            IRInst &term = block.terminator();
+            if (term.op != IROp::Jump)
+            {
+                continue;
+            }
+            int target = term.target;
+            IRBlock &next = func.blocks[target];
+            if (target == 0 || target == block.id || next.preds.size() != 1)
+            {
+                continue;
+            }
+            block.insts.pop_back();
+            for (auto &inst : next.insts)
+            {
+                if (inst.op == IROp::Phi)
+                {
+                    makeCopy(inst, inst.args[0]);
+                }
+                block.insts.push_back(std::move(inst));
+            }
+            next.insts.clear();
+            IRInst self;
+            self.op = IROp::Jump;
+            self.target = target;
+            next.insts.push_back(self); // unreachable now, removed below
+            // Successors of the merged block now come from this block
+            const IRInst &newTerm = block.terminator();
+            for (int succ : {newTerm.target, newTerm.elseTarget})
+            {
+                if (succ < 0)
+                    continue;
+                for (auto &inst : func.blocks[succ].insts)
+                {
+                    if (inst.op != IROp::Phi)
+                        break;
+                    for (auto &from : inst.phiBlocks)
+                    {
+                        if (from == target)
+                            from = block.id;
+                    }
+                }
+            }
+            changed = true;
+            break;
+        }
+        if (changed)
+        {
+            changes++;
+            func.removeUnreachable();
+        }
+    }
+    return changes;
+}
+
+int DeadCodeEliminationPass::run(IRFunction &func)
+{
+    int changes = 0;
+    while (true)
+    {
+        func.computeCFG();
+        Liveness live(func);
+        int removed = 0;
+        for (auto &block : func.blocks)
+        {
+            VRegSet current = live.liveOut[block.id];
+            auto &insts = block.insts;
+            for (size_t i = insts.size(); i-- > 0;)
+            {
+                IRInst &inst = insts[i];
+                if (inst.dst >= 0 && !current.test(inst.dst))
+                {
+                    if (inst.op == IROp::Call)
+                    {
+                        inst.dst = -1;
+                        removed++;
+                    }
+                    else if (!inst.hasSideEffects())
+                    {
+                        insts.erase(insts.begin() + i);
+                        removed++;
+                        continue;
+                    }
+                }
+                if (inst.dst >= 0)
+                {
+                    current.reset(inst.dst);
+                }
+                if (inst.op != IROp::Phi)
+                {
+                    for (int v : inst.uses())
+                    {
+                        current.set(v);
+                    }
+                }
+            }
+        }
+        if (removed == 0)
+        {
+            break;
+        }
+        changes += removed;
+    }
+    return changes;
+}
+
+static int countPhis(const IRFunction &func)
+{
+    int count = 0;
+    for (const auto &block : func.blocks)
+    {
+        for (const auto &inst : block.insts)
+        {
+            if (inst.op == IROp::Phi)
+                count++;
+        }
+    }
+    return count;
+}
+
+int SSAConstructionPass::run(IRFunction &func)
+{
+    if (func.isSSA)
+    {
+        return 0;
+    }
+    constructSSA(func);
+    return countPhis(func);
+}
+
+int SSADestructionPass::run(IRFunction &func)
+{
+    if (!func.isSSA)
+    {
+        return 0;
+    }
+    int phis = countPhis(func);
+    destructSSA(func);
+    return phis;
+}
+
+int ConstantPropagationPass::run(IRFunction &func)
+{
+    if (!func.isSSA)
+    {
+        return 0;
+    }
+    int changes = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        int n = func.numVRegs();
+        std::vector<char> known(n, 0);
+        std::vector<int32_t> value(n, 0);
+        for (const auto &block : func.blocks)
+        {
+            for (const auto &inst : block.insts)
+            {
+                if (inst.op == IROp::Const)
+                {
+                    known[inst.dst] = 1;
+                    value[inst.dst] = inst.imm;
+                }
+            }
+        }
+        bool cfgChanged = false;
+        for (int b : func.reversePostorder())
+        {
+            IRBlock &block = func.blocks[b];
+            for (size_t i = 0; i < block.insts.size(); i++)
+            {
+                IRInst &inst = block.insts[i];
+                int32_t result = 0;
+                bool folded = false;
+                if (inst.op == IROp::Phi)
+                {
+                    bool same = true;
+                    bool any = false;
+                    for (int arg : inst.args)
+                    {
+                        if (arg == inst.dst)
+                            continue;
+                        if (!known[arg] || (any && value[arg] != result))
+                        {
+                            same = false;
+                            break;
+                        }
+                        result = value[arg];
+                        any = true;
+                    }
+                    if (same && any)
+                    {
+                        makeConst(inst, result);
+                        known[inst.dst] = 1;
+                        value[inst.dst] = result;
+                        movePastPhis(block, i);
+                        changed = true;
+                        changes++;
+                        i--;
+                    }
+                    continue;
+                }
+                if (inst.isBinary() && known[inst.a] && known[inst.b])
+                {
+                    folded = foldBinary(inst.op, value[inst.a], value[inst.b], result);
+                }
+                else if ((inst.op == IROp::Neg || inst.op == IROp::Not || inst.op == IROp::Copy) && known[inst.a])
+                {
+                    int32_t a = value[inst.a];
+                    result = inst.op == IROp::Neg ? static_cast<int32_t>(0u - static_cast<uint32_t>(a))
+                             : inst.op == IROp::Not ? (a == 0)
+                                                    : a;
+                    folded = true;
+                }
+                else if (inst.op == IROp::Branch && known[inst.a])
+                {
+                    int taken = value[inst.a] != 0 ? inst.target : inst.elseTarget;
+                    int dropped = value[inst.a] != 0 ? inst.elseTarget : inst.target;
+                    inst.op = IROp::Jump;
+                    inst.a = -1;
+                    inst.target = taken;
+                    inst.elseTarget = -1;
+                    if (dropped != taken)
+                    {
+                        removePhiIncoming(func.blocks[dropped], b);
+                    }
+                    cfgChanged = true;
+                    changed = true;
+                    changes++;
+                    continue;
+                }
+                if (folded)
+                {
+                    makeConst(inst, result);
+                    known[inst.dst] = 1;
+                    value[inst.dst] = result;
+                    changed = true;
+                    changes++;
+                }
+            }
+        }
+        if (cfgChanged)
+        {
+            func.removeUnreachable();
+        }
+    }
+    return changes;
+}
+
+int CopyPropagationPass::run(IRFunction &func)
+{
+    if (!func.isSSA)
+    {
+        return 0;
+    }
+    int n = func.numVRegs();
+    std::vector<int> replacement(n);
+    for (int v = 0; v < n; v++)
+    {
+        replacement[v] = v;
+    }
+    for (const auto &block : func.blocks)
+    {
+        for (const auto &inst : block.insts)
+        {
+            if (inst.op == IROp::Copy)
+            {
+                replacement[inst.dst] = inst.a;
+            }
+            else if (inst.op == IROp::Phi)
+            {
+                int source = -1;
+                bool same = true;
+                for (int arg : inst.args)
+                {
+                    if (arg == inst.dst || arg == source)
+                        continue;
+                    if (source >= 0)
+                    {
+                        same = false;
+                        break;
+                    }
+                    source = arg;
+                }
+                if (same && source >= 0)
+                {
+                    replacement[inst.dst] = source;
+                }
+            }
+        }
+    }
+    // Resolve chains; a cycle of copies (only possible in dead code) is left alone
+    auto resolve = [&](int v) {
+        int steps = 0;
+        int r = v;
+        while (replacement[r] != r && steps <= n)
+        {
+            r = replacement[r];
+            steps++;
+        }
+        return steps > n ? v : r;
+    };
+    std::vector<int> resolved(n);
+    for (int v = 0; v < n; v++)
+    {
+        resolved[v] = resolve(v);
+    }
+    int changes = 0;
+    for (auto &block : func.blocks)
+    {
+        std::vector<IRInst> kept;
+        kept.reserve(block.insts.size());
+        for (auto &inst : block.insts)
+        {
+            if ((inst.op == IROp::Copy || inst.op == IROp::Phi) && resolved[inst.dst] != inst.dst)
+            {
+                changes++;
+                continue; // every use is redirected below
+            }
+            inst.forEachUse([&](int &v) {
+                if (resolved[v] != v)
+                {
+                    v = resolved[v];
+                    changes++;
+                }
+            });
+            kept.push_back(std::move(inst));
+        }
+        block.insts = std::move(kept);
+    }
+    return changes;
+}
+
+namespace
+{
+    // Instructions an arm block costs when run unconditionally, -1 if it cannot be speculated
+    int armCost(const IRBlock &arm)
+    {
+        int cost = 0;
+        for (size_t i = 0; i + 1 < arm.insts.size(); i++)
+        {
+            const IRInst &inst = arm.insts[i];
+            if (inst.op == IROp::Const)
+                cost += fitsImmediate(inst.imm) ? 1 : 2;
+            else if (inst.op == IROp::Mul)
+                cost += MUL_CYCLES;
+            else if (inst.op == IROp::Div || inst.op == IROp::Rem)
+                cost += DIV_CYCLES;
+            else if (inst.op == IROp::Copy || inst.op == IROp::Neg || inst.op == IROp::Not || inst.isBinary())
+                cost += 1;
+            else
+                return -1; // phi or call
+        }
+        return cost;
+    }
+}
+
+int IfConversionPass::run(IRFunction &func)
+{
+    if (!func.isSSA)
+    {
+        return 0;
+    }
+    int changes = 0;
+    func.computeCFG();
+    // Conditions already 0/1 need no snez before the mask
+    std::vector<char> boolean(func.numVRegs(), 0);
+    for (const auto &block : func.blocks)
+    {
+        for (const auto &inst : block.insts)
+        {
+            if (inst.dst >= 0)
+                boolean[inst.dst] = inst.isCompare() || inst.op == IROp::Not ||
+                                    (inst.op == IROp::Const && (inst.imm == 0 || inst.imm == 1));
+        }
+    }
+    for (auto &head : func.blocks)
+    {
+        const IRInst term = head.terminator(); // a copy: the terminator is removed below
+        if (term.op != IROp::Branch || term.target == term.elseTarget)
+        {
+            continue;
+        }
+        // Each side is an arm (only entered from head, straight to the join) or the join itself
+        int join = -1;
+        bool shape = true;
+        int cost = 0;
+        for (int side : {term.target, term.elseTarget})
+        {
+            const IRBlock &block = func.blocks[side];
+            bool arm = block.preds.size() == 1 && block.terminator().op == IROp::Jump && side != head.id;
+            int to = arm ? block.terminator().target : side;
+            int armCostValue = arm ? armCost(block) : 0;
+            if ((join >= 0 && join != to) || armCostValue < 0)
+            {
+                shape = false;
+                break;
+            }
+            join = to;
+            cost += armCostValue;
+        }
+        if (!shape || join == head.id || func.blocks[join].preds.size() != 2 ||
+            (term.target == join && term.elseTarget == join))
+        {
+            continue;
+        }
+        IRBlock &joinBlock = func.blocks[join];
+        int fromTrue = term.target == join ? head.id : term.target;
+        // (value on the true edge, value on the false edge) of each phi
+        std::vector<std::pair<int, int>> incoming;
+        size_t phis = 0;
+        for (; phis < joinBlock.insts.size() && joinBlock.insts[phis].op == IROp::Phi; phis++)
+        {
+            const IRInst &phi = joinBlock.insts[phis];
+            int onTrue = -1, onFalse = -1;
+            for (size_t i = 0; i < phi.args.size(); i++)
+            {
+                (phi.phiBlocks[i] == fromTrue ? onTrue : onFalse) = phi.args[i];
+            }
+            incoming.push_back({onTrue, onFalse});
+            if (onTrue != onFalse)
+                cost += SELECT_COST - 1;
+        }
+        int cond = term.a;
+        cost += 1 + !boolean[cond]; // neg (and snez) for the mask
+        if (cost > BRANCHLESS_BUDGET)
+        {
+            continue;
+        }
+        SourcePos pos = term.pos;
+        head.insts.pop_back();
+        for (int side : {term.target, term.elseTarget})
+        {
+            if (side == join)
+                continue;
+            auto &arm = func.blocks[side].insts;
+            head.insts.insert(head.insts.end(), std::make_move_iterator(arm.begin()),
+                              std::make_move_iterator(arm.end() - 1));
+            arm.erase(arm.begin(), arm.end() - 1); // left unreachable
+        }
+        auto add = [&](IROp op, int dst, int a = -1, int b = -1) {
+            IRInst inst;
+            inst.op = op;
+            inst.dst = dst;
+            inst.a = a;
+            inst.b = b;
+            inst.pos = pos;
+            head.insts.push_back(inst);
+        };
+        int mask = -1;
+        for (size_t i = 0; i < phis; i++)
+        {
+            int dst = joinBlock.insts[i].dst;
+            auto [onTrue, onFalse] = incoming[i];
+            if (onTrue == onFalse)
+            {
+                add(IROp::Copy, dst, onTrue);
+                continue;
+            }
+            if (mask < 0)
+            {
+                if (!boolean[cond])
+                {
+                    int zero = func.newVReg();
+                    add(IROp::Const, zero);
+                    int normalized = func.newVReg();
+                    add(IROp::Ne, normalized, cond, zero);
+                    cond = normalized;
+                }
+                mask = func.newVReg();
+                add(IROp::Neg, mask, cond);
+            }
+            int difference = func.newVReg();
+            add(IROp::Sub, difference, onTrue, onFalse);
+            int masked = func.newVReg();
+            add(IROp::And, masked, difference, mask);
+            add(IROp::Add, dst, onFalse, masked);
+        }
+        joinBlock.insts.erase(joinBlock.insts.begin(), joinBlock.insts.begin() + phis);
+        IRInst jump;
+        jump.op = IROp::Jump;
+        jump.target = join;
+        jump.pos = pos;
+        head.insts.push_back(jump);
+        func.computeCFG();
+        boolean.resize(func.numVRegs(), 0);
+        changes++;
+    }
+    if (changes > 0)
+    {
+        func.removeUnreachable();
+    }
+    return changes;
+}
+
+namespace
+{
+    // Scoped value table walked along the dominator tree
+    class ValueNumbering
+    {
+    public:
+        using Key = std::tuple<IROp, int, int, int32_t>;
+        IRFunction &func;
+        const DominatorTree &dom;
+        std::map<Key, int> table;
+        int changes = 0;
+
+        ValueNumbering(IRFunction &f, const DominatorTree &d) : func(f), dom(d) {}
+
+        static bool commutative(IROp op)
+        {
+            return op == IROp::Add || op == IROp::Mul || op == IROp::Eq || op == IROp::Ne || op == IROp::And ||
+                   op == IROp::Or;
+        }
+
+        void visit(int block)
+        {
+            std::vector<Key> added;
+            for (auto &inst : func.blocks[block].insts)
+            {
+                bool pure = inst.op == IROp::Const || inst.isBinary() || inst.op == IROp::Neg || inst.op == IROp::Not;
+                if (!pure || inst.dst < 0)
+                {
+                    continue;
+                }
+                int a = inst.a, b = inst.b;
+                if (commutative(inst.op) && a > b)
+                {
+                    std::swap(a, b);
+                }
+                Key key{inst.op, a, b, inst.op == IROp::Const ? inst.imm : 0};
+                auto found = table.find(key);
+                if (found != table.end())
+                {
+                    makeCopy(inst, found->second);
+                    changes++;
+                }
+                else
+                {
+                    table[key] = inst.dst;
+                    added.push_back(key);
+                }
+            }
+            for (int child : dom.children[block])
+            {
+                visit(child);
+            }
+            for (const auto &key : added)
+            {
+                table.erase(key);
+            }
+        }
+    };
+}
+
+int GlobalValueNumberingPass::run(IRFunction &func)
+{
+    if (!func.isSSA || func.blocks.empty())
+    {
+        return 0;
+    }
+    func.computeCFG();
+    DominatorTree dom(func);
+    ValueNumbering numbering(func, dom);
+    numbering.visit(0);
+    return numbering.changes;
+}
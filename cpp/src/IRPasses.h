@@ -0,0 +1,77 @@
+#pragma once
+#include "PassManager.h"
+
+// Cleans up the CFG: branches with equal targets become jumps, jumps to
+// empty blocks are threaded, a block is merged into its only predecessor
+// and unreachable blocks are removed. Works in and out of SSA form.
+class SimplifyCFGPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "simplifycfg"; }
+    int run(IRFunction &func) override;
+};
+
+// Removes instructions whose result is never used (liveness based, so it
+// works in and out of SSA form); unused call results are dropped.
+class DeadCodeEliminationPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "dce"; }
+    int run(IRFunction &func) override;
+};
+
+// Enters SSA form; the change count is the number of phis placed
+class SSAConstructionPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "ssa"; }
+    int run(IRFunction &func) override;
+};
+
+// Leaves SSA form; the change count is the number of phis removed
+class SSADestructionPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "out-of-ssa"; }
+    int run(IRFunction &func) override;
+};
+
+// Folds operations on constants (32-bit wrap-around, RISC-V division
+// semantics, division by zero is left alone) and branches on constants.
+// SSA form only.
+class ConstantPropagationPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "constprop"; }
+    int run(IRFunction &func) override;
+};
+
+// Replaces uses of copies and of phis whose incoming values are all the
+// same by the original value. SSA form only.
+class CopyPropagationPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "copyprop"; }
+    int run(IRFunction &func) override;
+};
+
+// If-conversion: a diamond or triangle whose arms only compute cheap pure
+// values for the phis of the join block is flattened into the branching
+// block. Both arms run unconditionally and each phi becomes a select
+// through a mask, b + ((a - b) & -cond), with no branch, when the cost
+// model of InstSelect.h allows it. SSA form only.
+class IfConversionPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "ifconvert"; }
+    int run(IRFunction &func) override;
+};
+
+// Dominator-based value numbering: a pure instruction recomputing a value
+// already available in a dominating block becomes a copy of it. SSA form only.
+class GlobalValueNumberingPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "gvn"; }
+    int run(IRFunction &func) override;
+};
@@ -0,0 +1,446 @@
+#include "InstSelect.h"
+#include <bit>
+#include <stdexcept>
+
+bool fitsImmediate(int64_t value)
+{
+    return value >= -2048 && value <= 2047;
+}
+
+void emitLoadConstant(std::ostream &out, const std::string &rd, int32_t value)
+{
+    if (fitsImmediate(value))
+    {
+        out << "li " << rd << ", " << value << "\n";
+        return;
+    }
+    // addi sign-extends its 12 bits, so round the upper part up when bit 11 is set
+    uint32_t hi = (static_cast<uint32_t>(value) + 0x800) >> 12;
+    int32_t lo = static_cast<int32_t>(static_cast<uint32_t>(value) - (hi << 12));
+    out << "lui " << rd << ", " << (hi & 0xfffff) << "\n";
+    if (lo != 0)
+    {
+        out << "addi " << rd << ", " << rd << ", " << lo << "\n";
+    }
+}
+
+bool mirrorOperator(BinOp &op)
+{
+    switch (op)
+    {
+    case BinOp::Add:
+    case BinOp::Mul:
+    case BinOp::Eq:
+    case BinOp::Ne:
+        return true;
+    case BinOp::Lt:
+        op = BinOp::Gt;
+        return true;
+    case BinOp::Gt:
+        op = BinOp::Lt;
+        return true;
+    case BinOp::Le:
+        op = BinOp::Ge;
+        return true;
+    case BinOp::Ge:
+        op = BinOp::Le;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool hasImmediateForm(BinOp op, int32_t imm)
+{
+    int64_t value = imm;
+    switch (op)
+    {
+    case BinOp::Add:
+    case BinOp::Lt:
+    case BinOp::Ge:
+    case BinOp::Eq:
+    case BinOp::Ne:
+        return fitsImmediate(value);
+    case BinOp::Sub:
+        return fitsImmediate(-value);
+    case BinOp::Le:
+    case BinOp::Gt:
+        // x <= c is x < c + 1
+        return fitsImmediate(value + 1);
+    case BinOp::Mul:
+        return value == 0 || value == 1;
+    case BinOp::Div:
+        return value == 1;
+    case BinOp::Mod:
+        return value == 1 || value == -1;
+    default:
+        return false;
+    }
+}
+
+void emitImmediateOp(std::ostream &out, BinOp op, const std::string &rd, const std::string &rs, int32_t imm)
+{
+    auto move = [&] {
+        if (rd != rs)
+            out << "mv " << rd << ", " << rs << "\n";
+    };
+    switch (op)
+    {
+    case BinOp::Add:
+        if (imm == 0)
+            move();
+        else
+            out << "addi " << rd << ", " << rs << ", " << imm << "\n";
+        break;
+    case BinOp::Sub:
+        if (imm == 0)
+            move();
+        else
+            out << "addi " << rd << ", " << rs << ", " << -imm << "\n";
+        break;
+    case BinOp::Mul:
+    case BinOp::Div:
+    case BinOp::Mod:
+        // x * 0 and x % ±1 are 0, x * 1 and x / 1 are x
+        if ((op == BinOp::Mul && imm == 0) || op == BinOp::Mod)
+            out << "mv " << rd << ", zero\n";
+        else
+            move();
+        break;
+    case BinOp::Lt:
+        out << "slti " << rd << ", " << rs << ", " << imm << "\n";
+        break;
+    case BinOp::Ge:
+        out << "slti " << rd << ", " << rs << ", " << imm << "\n";
+        out << "xori " << rd << ", " << rd << ", 1\n";
+        break;
+    case BinOp::Le:
+        out << "slti " << rd << ", " << rs << ", " << imm + 1 << "\n";
+        break;
+    case BinOp::Gt:
+        if (imm == 0)
+        {
+            out << "sgtz " << rd << ", " << rs << "\n"; // slt rd, x0, rs
+        }
+        else
+        {
+            out << "slti " << rd << ", " << rs << ", " << imm + 1 << "\n";
+            out << "xori " << rd << ", " << rd << ", 1\n";
+        }
+        break;
+    case BinOp::Eq:
+    case BinOp::Ne:
+    {
+        // seqz/snez are sltiu rd, rs, 1 and sltu rd, x0, rs
+        const char *test = op == BinOp::Eq ? "seqz " : "snez ";
+        if (imm == 0)
+        {
+            out << test << rd << ", " << rs << "\n";
+        }
+        else
+        {
+            out << "xori " << rd << ", " << rs << ", " << imm << "\n";
+            out << test << rd << ", " << rd << "\n";
+        }
+        break;
+    }
+    default:
+        throw std::runtime_error("No immediate form for this operator");
+    }
+}
+
+namespace
+{
+// Magic multiplier and shift for signed division by d, 2 <= |d| < 2^31
+struct Magic
+{
+    int32_t multiplier;
+    int shift;
+};
+
+Magic signedMagic(int32_t d)
+{
+    const uint32_t two31 = 0x80000000u;
+    uint32_t ad = d < 0 ? 0u - static_cast<uint32_t>(d) : static_cast<uint32_t>(d);
+    uint32_t t = two31 + (static_cast<uint32_t>(d) >> 31);
+    uint32_t anc = t - 1 - t % ad; // |nc|
+    int p = 31;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+    uint32_t delta;
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    int32_t m = static_cast<int32_t>(q2 + 1);
+    return {d < 0 ? -m : m, p - 32};
+}
+
+uint32_t magnitude(int32_t value)
+{
+    return value < 0 ? 0u - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+}
+
+int constantCost(int32_t value)
+{
+    return fitsImmediate(value) ? 1 : 2;
+}
+
+// Shift/add form of a product by c: c = ±2^a, or ±(2^a ± 2^b)
+struct ProductForm
+{
+    int high = -1, low = -1; // shift amounts; low < 0 for a single power of two
+    bool subtract = false;    // 2^high - 2^low
+    bool negate = false;
+    int cost() const { return 1 + (low >= 0 ? 1 + (low > 0) : 0) + negate; }
+};
+
+bool productForm(int32_t c, ProductForm &form)
+{
+    uint32_t m = magnitude(c);
+    if (m == 0)
+        return false;
+    form.negate = c < 0;
+    if (std::has_single_bit(m))
+    {
+        form.high = std::countr_zero(m);
+        return true;
+    }
+    int low = std::countr_zero(m);
+    uint32_t rest = m - (1u << low);
+    if (std::has_single_bit(rest))
+    {
+        form.high = std::countr_zero(rest);
+        form.low = low;
+        return true;
+    }
+    // 2^high - 2^low: m + 2^low is a power of two
+    uint64_t sum = static_cast<uint64_t>(m) + (1u << low);
+    if (sum < (1ull << 32) && std::has_single_bit(static_cast<uint32_t>(sum)))
+    {
+        form.high = std::countr_zero(static_cast<uint32_t>(sum));
+        form.low = low;
+        form.subtract = true;
+        return true;
+    }
+    return false;
+}
+
+// Instructions of the replacement, -1 if there is none
+int reducedCost(BinOp op, int32_t imm)
+{
+    uint32_t m = magnitude(imm);
+    if (op == BinOp::Mul)
+    {
+        ProductForm form;
+        return productForm(imm, form) ? form.cost() : -1;
+    }
+    if ((op != BinOp::Div && op != BinOp::Mod) || m < 2 || imm == INT32_MIN)
+        return -1;
+    if (std::has_single_bit(m))
+    {
+        int k = std::countr_zero(m);
+        int bias = k == 1 ? 2 : 3;
+        if (op == BinOp::Div)
+            return bias + 1 + (imm < 0);
+        return bias + (k <= 11 ? 1 : 2) + 1;
+    }
+    Magic magic = signedMagic(op == BinOp::Div ? imm : static_cast<int32_t>(m));
+    bool fixup = (imm > 0 && magic.multiplier < 0) || (imm < 0 && magic.multiplier > 0);
+    int cost = constantCost(magic.multiplier) + 1 + fixup + (magic.shift > 0) + 2;
+    if (op == BinOp::Mod)
+        cost += constantCost(static_cast<int32_t>(m)) + MUL_CYCLES + 1;
+    return cost;
+}
+} // namespace
+
+bool hasStrengthReduction(BinOp op, int32_t imm)
+{
+    int cost = reducedCost(op, imm);
+    if (cost < 0)
+        return false;
+    int native = constantCost(imm) + (op == BinOp::Mul ? MUL_CYCLES : DIV_CYCLES);
+    return cost < native;
+}
+
+void emitStrengthReduced(std::ostream &out, BinOp op, const std::string &rd, const std::string &rs, int32_t imm,
+                         const std::string &scratch1, const std::string &scratch2)
+{
+    uint32_t m = magnitude(imm);
+    if (op == BinOp::Mul)
+    {
+        ProductForm form;
+        productForm(imm, form);
+        if (form.low < 0 && form.high == 0)
+        {
+            if (form.negate)
+                out << "neg " << rd << ", " << rs << "\n"; // x * -1
+            else if (rd != rs)
+                out << "mv " << rd << ", " << rs << "\n"; // x * 1
+            return;
+        }
+        if (form.low < 0)
+        {
+            out << "slli " << rd << ", " << rs << ", " << form.high << "\n";
+        }
+        else
+        {
+            out << "slli " << scratch1 << ", " << rs << ", " << form.high << "\n";
+            std::string low = rs;
+            if (form.low > 0)
+            {
+                out << "slli " << scratch2 << ", " << rs << ", " << form.low << "\n";
+                low = scratch2;
+            }
+            out << (form.subtract ? "sub " : "add ") << rd << ", " << scratch1 << ", " << low << "\n";
+        }
+        if (form.negate)
+            out << "neg " << rd << ", " << rd << "\n";
+        return;
+    }
+    if (std::has_single_bit(m))
+    {
+        // Round toward zero: add 2^k - 1 to a negative dividend before shifting
+        int k = std::countr_zero(m);
+        if (k == 1)
+        {
+            out << "srli " << scratch1 << ", " << rs << ", 31\n";
+        }
+        else
+        {
+            out << "srai " << scratch1 << ", " << rs << ", 31\n";
+            out << "srli " << scratch1 << ", " << scratch1 << ", " << 32 - k << "\n";
+        }
+        out << "add " << scratch1 << ", " << rs << ", " << scratch1 << "\n";
+        if (op == BinOp::Div)
+        {
+            out << "srai " << rd << ", " << scratch1 << ", " << k << "\n";
+            if (imm < 0)
+                out << "neg " << rd << ", " << rd << "\n";
+            return;
+        }
+        // x % 2^k = x - (biased x rounded down to a multiple of 2^k); the sign of d does not matter
+        if (k <= 11)
+        {
+            out << "andi " << scratch1 << ", " << scratch1 << ", " << -(1 << k) << "\n";
+        }
+        else
+        {
+            out << "srai " << scratch1 << ", " << scratch1 << ", " << k << "\n";
+            out << "slli " << scratch1 << ", " << scratch1 << ", " << k << "\n";
+        }
+        out << "sub " << rd << ", " << rs << ", " << scratch1 << "\n";
+        return;
+    }
+    // q = mulh(x, M) (+/- x) >> s, plus one when q is negative; x % d = x - q * |d|
+    int32_t divisor = op == BinOp::Div ? imm : static_cast<int32_t>(m);
+    Magic magic = signedMagic(divisor);
+    emitLoadConstant(out, scratch1, magic.multiplier);
+    out << "mulh " << scratch1 << ", " << rs << ", " << scratch1 << "\n";
+    if (divisor > 0 && magic.multiplier < 0)
+        out << "add " << scratch1 << ", " << scratch1 << ", " << rs << "\n";
+    else if (divisor < 0 && magic.multiplier > 0)
+        out << "sub " << scratch1 << ", " << scratch1 << ", " << rs << "\n";
+    if (magic.shift > 0)
+        out << "srai " << scratch1 << ", " << scratch1 << ", " << magic.shift << "\n";
+    out << "srli " << scratch2 << ", " << scratch1 << ", 31\n";
+    if (op == BinOp::Div)
+    {
+        out << "add " << rd << ", " << scratch1 << ", " << scratch2 << "\n";
+        return;
+    }
+    out << "add " << scratch1 << ", " << scratch1 << ", " << scratch2 << "\n";
+    emitLoadConstant(out, scratch2, divisor);
+    out << "mul " << scratch1 << ", " << scratch1 << ", " << scratch2 << "\n";
+    out << "sub " << rd << ", " << rs << ", " << scratch1 << "\n";
+}
+
+int speculationCost(const Expr &expr)
+{
+    if (const auto *lit = dynamic_cast<const IntLit *>(&expr))
+    {
+        return constantCost(lit->value);
+    }
+    if (dynamic_cast<const Var *>(&expr))
+    {
+        return 1;
+    }
+    if (const auto *unop = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        int operand = speculationCost(*unop->right);
+        return operand < 0 ? -1 : operand + 1;
+    }
+    const auto *binop = dynamic_cast<const BinOpExpr *>(&expr);
+    if (!binop)
+    {
+        return -1; // a call
+    }
+    int left = speculationCost(*binop->left);
+    int right = speculationCost(*binop->right);
+    if (left < 0 || right < 0)
+    {
+        return -1;
+    }
+    const auto *rightLit = dynamic_cast<const IntLit *>(binop->right.get());
+    if (rightLit && hasImmediateForm(binop->op, rightLit->value))
+    {
+        // slti/xori pairs for >= and >, xori/seqz for == and != except against zero
+        bool pair = binop->op == BinOp::Ge || ((binop->op == BinOp::Gt || binop->op == BinOp::Eq ||
+                                                binop->op == BinOp::Ne) && rightLit->value != 0);
+        return left + 1 + pair;
+    }
+    switch (binop->op)
+    {
+    case BinOp::Mul:
+    case BinOp::Div:
+    case BinOp::Mod:
+        if (rightLit && hasStrengthReduction(binop->op, rightLit->value))
+            return left + reducedCost(binop->op, rightLit->value);
+        return left + right + (binop->op == BinOp::Mul ? MUL_CYCLES : DIV_CYCLES);
+    case BinOp::Le:
+    case BinOp::Ge:
+    case BinOp::Eq:
+    case BinOp::Ne:
+        return left + right + 2;
+    case BinOp::And:
+    case BinOp::Or:
+        return left + right + 3;
+    default:
+        return left + right + 1;
+    }
+}
+
+bool isBooleanExpr(const Expr &expr)
+{
+    if (const auto *lit = dynamic_cast<const IntLit *>(&expr))
+    {
+        return lit->value == 0 || lit->value == 1;
+    }
+    if (const auto *unop = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        return unop->op == UnOp::Not;
+    }
+    const auto *binop = dynamic_cast<const BinOpExpr *>(&expr);
+    return binop && binop->op >= BinOp::Lt;
+}
+
+bool isBranchlessLogic(const BinOpExpr &logic)
+{
+    int cost = speculationCost(*logic.right);
+    return cost >= 0 && cost + 2 <= BRANCHLESS_BUDGET;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include "ASTNode.h"
+
+// Instruction selection helpers shared by Generator and IREmitter: the
+// RV32I immediate forms (addi/slti/sltiu/xori), x0 for zero operands, and
+// lui+addi for constants outside the 12-bit range.
+
+// True if value fits the signed 12-bit immediate of an I-type instruction
+bool fitsImmediate(int64_t value);
+
+// rd = value: one li (addi rd, x0, value) in the 12-bit range, else lui plus an addi for the low part
+void emitLoadConstant(std::ostream &out, const std::string &rd, int32_t value);
+
+// Rewrite op so that a op b == b op' a; false if op is not symmetric that way (Sub, Div, Mod)
+bool mirrorOperator(BinOp &op);
+
+// True if rd = rs op imm has an immediate-operand lowering
+bool hasImmediateForm(BinOp op, int32_t imm);
+
+// Emit rd = rs op imm; requires hasImmediateForm(op, imm). rd may equal rs.
+void emitImmediateOp(std::ostream &out, BinOp op, const std::string &rd, const std::string &rs, int32_t imm);
+
+// Strength reduction of multiplication, division and modulo by a constant:
+// shift/add sequences for products, sign-corrected shifts for powers of two
+// and a multiply-high by a magic number (Granlund and Montgomery, as in
+// Hacker's Delight) for other divisors. Each is used only when its
+// instruction count beats loading the constant and a mul (MUL_CYCLES) or
+// div/rem (DIV_CYCLES) on a simple in-order core.
+constexpr int MUL_CYCLES = 3;
+constexpr int DIV_CYCLES = 35;
+
+// True if rd = rs op imm (Mul, Div or Mod) has a cheaper replacement
+bool hasStrengthReduction(BinOp op, int32_t imm);
+
+// Emit the replacement; requires hasStrengthReduction(op, imm). rd may
+// equal rs; scratch1 and scratch2 must differ from both.
+void emitStrengthReduced(std::ostream &out, BinOp op, const std::string &rd, const std::string &rs, int32_t imm,
+                         const std::string &scratch1, const std::string &scratch2);
+
+// If-conversion: an if that only selects between two values, or the right
+// operand of && / ||, is computed unconditionally and combined with
+// slt/snez and mask arithmetic (x = b + ((a - b) & -cond)) instead of
+// branching, when the speculated work plus the select costs at most
+// BRANCHLESS_BUDGET instructions -- about what a mispredicted
+// data-dependent branch costs.
+constexpr int BRANCHLESS_BUDGET = 6;
+// Instructions of the mask and the select: neg, sub, and, add (plus a snez for a condition that is not 0/1)
+constexpr int SELECT_COST = 4;
+
+// Instructions to evaluate expr unconditionally, -1 if it has side effects (a call)
+int speculationCost(const Expr &expr);
+
+// True if expr always evaluates to 0 or 1
+bool isBooleanExpr(const Expr &expr);
+
+// True if && / || is cheap enough to evaluate both operands (snez and
+// and/or) instead of short-circuiting; only the right operand is speculated
+bool isBranchlessLogic(const BinOpExpr &logic);
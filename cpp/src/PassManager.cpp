@@ -0,0 +1,149 @@
+#include "PassManager.h"
+#include "IRPasses.h"
+#include "ASTPrinter.h"
+#include <iomanip>
+#include <stdexcept>
+
+std::unique_ptr<FunctionPass> PassManager::createPass(const std::string &name)
+{
+    if (name == "simplifycfg")
+        return std::make_unique<SimplifyCFGPass>();
+    if (name == "dce")
+        return std::make_unique<DeadCodeEliminationPass>();
+    if (name == "ssa")
+        return std::make_unique<SSAConstructionPass>();
+    if (name == "out-of-ssa")
+        return std::make_unique<SSADestructionPass>();
+    if (name == "constprop")
+        return std::make_unique<ConstantPropagationPass>();
+    if (name == "copyprop")
+        return std::make_unique<CopyPropagationPass>();
+    if (name == "gvn")
+        return std::make_unique<GlobalValueNumberingPass>();
+    if (name == "ifconvert")
+        return std::make_unique<IfConversionPass>();
+    return nullptr;
+}
+
+std::vector<std::string> PassManager::passNames()
+{
+    return {"simplifycfg", "dce", "ssa", "out-of-ssa", "constprop", "copyprop", "gvn", "ifconvert"};
+}
+
+std::vector<std::string> PassManager::pipelineFor(int optLevel)
+{
+    if (optLevel <= 0)
+    {
+        return {};
+    }
+    if (optLevel == 1)
+    {
+        // Cheap cleanups only, keeping compile latency low
+        return {"simplifycfg", "dce"};
+    }
+    return {"simplifycfg", "ssa",         "constprop",  "copyprop",   "gvn", "copyprop", "dce",
+            "simplifycfg", "ifconvert",   "simplifycfg", "out-of-ssa", "simplifycfg"};
+}
+
+void PassManager::setPipeline(const std::vector<std::string> &names)
+{
+    pipeline.clear();
+    for (const auto &name : names)
+    {
+        auto pass = createPass(name);
+        if (!pass)
+        {
+            throw std::runtime_error("Unknown pass: " + name);
+        }
+        pipeline.push_back(std::move(pass));
+    }
+}
+
+PassRecord &PassManager::record(const std::string &name)
+{
+    auto it = recordIndex.find(name);
+    if (it != recordIndex.end())
+    {
+        return records[it->second];
+    }
+    recordIndex[name] = records.size();
+    records.push_back(PassRecord());
+    records.back().name = name;
+    return records.back();
+}
+
+static double elapsedMs(PassManager::Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(PassManager::Clock::now() - start).count();
+}
+
+std::unique_ptr<Program> PassManager::runProgramPass(const std::string &name,
+                                                     const std::function<std::unique_ptr<Program>()> &transform)
+{
+    auto start = Clock::now();
+    auto result = transform();
+    PassRecord &rec = record(name);
+    rec.runs++;
+    rec.ms += elapsedMs(start);
+    if (result && shouldPrint(name))
+    {
+        *dump << "*** AST after " << name << " ***\n";
+        ASTPrinter(*dump).print(*result);
+    }
+    return result;
+}
+
+void PassManager::timePhase(const std::string &name, const std::function<void()> &phase, const IRProgram *ir)
+{
+    auto start = Clock::now();
+    phase();
+    PassRecord &rec = record(name);
+    rec.runs++;
+    rec.ms += elapsedMs(start);
+    if (ir && shouldPrint(name))
+    {
+        *dump << "*** IR after " << name << " ***\n";
+        ir->print(*dump);
+    }
+}
+
+void PassManager::run(IRProgram &program)
+{
+    for (auto &pass : pipeline)
+    {
+        auto start = Clock::now();
+        long changes = 0;
+        for (auto &func : program.functions)
+        {
+            changes += pass->run(func);
+        }
+        PassRecord &rec = record(pass->name());
+        rec.runs++;
+        rec.ms += elapsedMs(start);
+        rec.changes = (rec.changes < 0 ? 0 : rec.changes) + changes;
+        if (shouldPrint(pass->name()))
+        {
+            *dump << "*** IR after " << pass->name() << " ***\n";
+            program.print(*dump);
+        }
+    }
+}
+
+void PassManager::report(std::ostream &out) const
+{
+    double total = 0;
+    out << std::left << std::setw(14) << "pass" << std::right << std::setw(6) << "runs" << std::setw(10) << "changes"
+        << std::setw(12) << "time(ms)" << "\n";
+    for (const auto &rec : records)
+    {
+        out << std::left << std::setw(14) << rec.name << std::right << std::setw(6) << rec.runs << std::setw(10);
+        if (rec.changes < 0)
+            out << "-";
+        else
+            out << rec.changes;
+        out << std::setw(12) << std::fixed << std::setprecision(3) << rec.ms << "\n";
+        total += rec.ms;
+    }
+    out << std::left << std::setw(30) << "total" << std::right << std::setw(12) << std::fixed << std::setprecision(3)
+        << total << std::endl;
+}
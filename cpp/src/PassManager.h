@@ -0,0 +1,77 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include "ASTNode.h"
+#include "IR.h"
+
+// A transform (or analysis) run on each IR function. run() returns the
+// number of changes it made, 0 when the function is left untouched.
+class FunctionPass
+{
+public:
+    virtual ~FunctionPass() = default;
+    virtual const char *name() const = 0;
+    virtual int run(IRFunction &func) = 0;
+};
+
+// Timing and change count of one pass or compilation phase
+struct PassRecord
+{
+    std::string name;
+    int runs = 0;
+    long changes = -1; // -1 for phases that do not count changes
+    double ms = 0;
+};
+
+// Runs the optimization pipeline and keeps per-pass statistics.
+//
+// IR passes run pass by pass over all functions of the program, so the
+// program can be printed as a whole after any pass. Other phases (AST
+// folding, lowering, register allocation, emission) are timed through
+// runProgramPass()/timePhase() and appear in the same report.
+class PassManager
+{
+private:
+    std::vector<std::unique_ptr<FunctionPass>> pipeline;
+    std::vector<PassRecord> records;
+    std::map<std::string, size_t> recordIndex;
+    bool printAll = false;
+    std::set<std::string> printAfter;
+    std::ostream *dump = &std::cerr;
+
+    PassRecord &record(const std::string &name);
+    bool shouldPrint(const std::string &name) const { return printAll || printAfter.count(name); }
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Pass by name, nullptr if there is no such pass
+    static std::unique_ptr<FunctionPass> createPass(const std::string &name);
+    // Default IR pipeline of an optimization level (empty for -O0)
+    static std::vector<std::string> pipelineFor(int optLevel);
+    static std::vector<std::string> passNames();
+
+    void addPass(std::unique_ptr<FunctionPass> pass) { pipeline.push_back(std::move(pass)); }
+    // Replace the pipeline; throws for unknown pass names
+    void setPipeline(const std::vector<std::string> &names);
+    void setPrintAfterAll(bool enabled) { printAll = enabled; }
+    void addPrintAfter(const std::string &name) { printAfter.insert(name); }
+    void setDumpStream(std::ostream &out) { dump = &out; }
+
+    // Run an AST-level transform, timing it and printing the result if requested
+    std::unique_ptr<Program> runProgramPass(const std::string &name,
+                                            const std::function<std::unique_ptr<Program>()> &transform);
+    // Time a phase that is not a pass; the IR is printed after it if requested
+    void timePhase(const std::string &name, const std::function<void()> &phase, const IRProgram *ir = nullptr);
+    // Run every pass of the pipeline over every function
+    void run(IRProgram &program);
+
+    const std::vector<PassRecord> &getRecords() const { return records; }
+    void report(std::ostream &out) const;
+};
@@ -0,0 +1,494 @@
+#include "Peephole.h"
+#include "IREmitter.h"
+#include "InstSelect.h"
+#include <algorithm>
+#include <cctype>
+#include <set>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+struct Line
+{
+    enum Kind
+    {
+        Instruction,
+        Label,
+        Directive, // ends a block
+        Note       // .loc, comments and blank lines, ignored by the rules
+    } kind;
+    std::string text; // original text of everything but instructions
+    std::string op;
+    std::vector<std::string> args;
+    const CallingConvention *callee = nullptr; // convention of the target of a call
+};
+using Lines = std::vector<Line>;
+
+std::string trim(const std::string &s)
+{
+    size_t start = s.find_first_not_of(" \t\r");
+    if (start == std::string::npos)
+        return "";
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(start, end - start + 1);
+}
+
+Lines parse(const std::string &code)
+{
+    Lines lines;
+    std::istringstream in(code);
+    std::string raw;
+    while (std::getline(in, raw))
+    {
+        Line line;
+        line.text = raw;
+        std::string s = trim(raw);
+        if (s.empty() || s[0] == '#' || s.rfind(".loc", 0) == 0)
+        {
+            line.kind = Line::Note;
+        }
+        else if (s[0] == '.')
+        {
+            line.kind = Line::Directive;
+        }
+        else if (s.back() == ':')
+        {
+            line.kind = Line::Label;
+            line.op = s.substr(0, s.size() - 1);
+        }
+        else
+        {
+            line.kind = Line::Instruction;
+            size_t space = s.find_first_of(" \t");
+            line.op = s.substr(0, space);
+            if (space != std::string::npos)
+            {
+                std::string rest = s.substr(space + 1);
+                size_t start = 0;
+                while (true)
+                {
+                    size_t comma = rest.find(',', start);
+                    line.args.push_back(trim(rest.substr(start, comma == std::string::npos ? std::string::npos
+                                                                                            : comma - start)));
+                    if (comma == std::string::npos)
+                        break;
+                    start = comma + 1;
+                }
+            }
+        }
+        lines.push_back(std::move(line));
+    }
+    return lines;
+}
+
+std::string render(const Lines &lines)
+{
+    std::string out;
+    for (const auto &line : lines)
+    {
+        if (line.kind != Line::Instruction)
+        {
+            out += line.text;
+        }
+        else
+        {
+            out += line.op;
+            for (size_t i = 0; i < line.args.size(); i++)
+            {
+                out += (i == 0 ? " " : ", ") + line.args[i];
+            }
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+// ABI name of a register operand, "" for anything else
+std::string registerName(const std::string &operand)
+{
+    static const char *const abi[] = {"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0",
+                                      "a1",   "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4", "s5",
+                                      "s6",   "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+    if (operand == "fp")
+        return "s0";
+    if (operand.size() >= 2 && operand[0] == 'x' && std::all_of(operand.begin() + 1, operand.end(), ::isdigit))
+    {
+        int index = std::stoi(operand.substr(1));
+        return index < 32 ? abi[index] : "";
+    }
+    for (const char *name : abi)
+    {
+        if (operand == name)
+            return operand;
+    }
+    return "";
+}
+
+// Base register of a memory operand such as 12(sp)
+std::string baseOf(const std::string &address)
+{
+    size_t open = address.find('(');
+    size_t close = address.find(')');
+    if (open == std::string::npos || close == std::string::npos || close < open)
+        return "";
+    return registerName(address.substr(open + 1, close - open - 1));
+}
+
+bool isBranch(const std::string &op)
+{
+    static const std::set<std::string> branches = {"beq",  "bne",  "blt",  "bge",  "bltu", "bgeu", "bgt",
+                                                   "ble",  "bgtu", "bleu", "beqz", "bnez", "bltz", "bgez",
+                                                   "blez", "bgtz"};
+    return branches.count(op) > 0;
+}
+
+// Register effects of an instruction
+struct Effects
+{
+    std::string def;                   // register written, "" if none
+    std::vector<std::string> uses;     // registers read
+    std::vector<std::string> clobbers; // registers left undefined (by a call)
+    bool pure = false;                 // only writes def: removable when def is dead
+    bool barrier = false;              // unknown effects (ecall, ...): everything is live
+};
+
+bool contains(const std::vector<std::string> &regs, const std::string &reg)
+{
+    return std::find(regs.begin(), regs.end(), reg) != regs.end();
+}
+
+Effects effectsOf(const Line &line)
+{
+    // Instructions writing their first operand and reading the registers among the rest
+    static const std::set<std::string> computes = {
+        "add",  "sub",  "mul",  "mulh", "mulhsu", "mulhu", "div",  "divu", "rem",  "remu", "slt",  "sltu",
+        "and",  "or",   "xor",  "sll",  "srl",    "sra",   "addi", "slti", "sltiu", "andi", "ori", "xori",
+        "slli", "srli", "srai", "mv",   "neg",    "not",   "seqz", "snez", "sltz", "sgtz", "li",   "lui", "la"};
+    Effects effects;
+    const std::string &op = line.op;
+    const auto &args = line.args;
+    if ((computes.count(op) || op == "lw") && !args.empty())
+    {
+        effects.def = registerName(args[0]);
+        effects.pure = !effects.def.empty();
+        for (size_t i = 1; i < args.size(); i++)
+        {
+            std::string reg = op == "lw" ? baseOf(args[i]) : registerName(args[i]);
+            if (!reg.empty())
+                effects.uses.push_back(reg);
+        }
+    }
+    else if (op == "sw" && args.size() == 2)
+    {
+        effects.uses = {registerName(args[0]), baseOf(args[1])};
+    }
+    else if (isBranch(op))
+    {
+        for (size_t i = 0; i + 1 < args.size(); i++)
+            effects.uses.push_back(registerName(args[i]));
+    }
+    else if (op == "call" && line.callee)
+    {
+        // A call reads its argument registers and clobbers what its convention allows
+        const CallingConvention &conv = *line.callee;
+        size_t count = conv.standard ? 8 : conv.paramRegs.size();
+        for (size_t i = 0; i < count; i++)
+        {
+            std::string place = conv.argumentPlace(i);
+            if (!place.empty())
+                effects.uses.push_back(place);
+        }
+        effects.clobbers.assign(conv.clobbers.begin(), conv.clobbers.end());
+        effects.clobbers.push_back("ra");
+    }
+    else if (op != "j" && op != "ret" && op != "nop")
+    {
+        effects.barrier = true;
+    }
+    return effects;
+}
+
+// Control transfers, calls and barriers end a basic block
+bool endsBlock(const Line &line)
+{
+    return line.op == "j" || line.op == "ret" || line.op == "call" || isBranch(line.op) || effectsOf(line).barrier;
+}
+
+// Registers that still matter after ret
+bool liveAtReturn(const std::string &reg)
+{
+    return reg == "a0" || reg == "ra" || reg == "sp" || reg == "gp" || reg == "tp" || reg[0] == 's';
+}
+
+size_t nextInstruction(const Lines &block, size_t i)
+{
+    for (size_t k = i + 1; k < block.size(); k++)
+    {
+        if (block[k].kind == Line::Instruction)
+            return k;
+    }
+    return block.size();
+}
+
+// True if reg is written again, or the function returns, before anything after position i reads it
+bool deadAfter(const Lines &block, size_t i, const std::string &reg)
+{
+    if (reg.empty() || reg == "zero")
+    {
+        return false;
+    }
+    for (size_t k = i + 1; k < block.size(); k++)
+    {
+        if (block[k].kind != Line::Instruction)
+            continue;
+        Effects effects = effectsOf(block[k]);
+        if (effects.barrier || contains(effects.uses, reg))
+            return false;
+        if (block[k].op == "ret")
+            return !liveAtReturn(reg);
+        if (effects.def == reg || contains(effects.clobbers, reg))
+            return true;
+    }
+    return false; // live out of the block
+}
+
+bool isMove(const Line &line)
+{
+    return line.kind == Line::Instruction && line.op == "mv" && line.args.size() == 2;
+}
+
+// mv r, r
+bool moveSelf(Lines &block, size_t i)
+{
+    if (!isMove(block[i]) || registerName(block[i].args[0]) != registerName(block[i].args[1]))
+        return false;
+    block.erase(block.begin() + i);
+    return true;
+}
+
+// mv a, b; mv c, a -> mv a, b; mv c, b
+bool moveChain(Lines &block, size_t i)
+{
+    size_t k = nextInstruction(block, i);
+    if (!isMove(block[i]) || k == block.size() || !isMove(block[k]))
+        return false;
+    std::string a = registerName(block[i].args[0]);
+    std::string b = registerName(block[i].args[1]);
+    if (a.empty() || a == b || registerName(block[k].args[1]) != a)
+        return false;
+    if (registerName(block[k].args[0]) == b)
+        block.erase(block.begin() + k); // b already holds the value
+    else
+        block[k].args[1] = block[i].args[1];
+    return true;
+}
+
+// op r, ...; mv d, r with r dead afterwards -> op d, ...
+bool copyForward(Lines &block, size_t i)
+{
+    size_t k = nextInstruction(block, i);
+    if (k == block.size() || !isMove(block[k]))
+        return false;
+    Effects effects = effectsOf(block[i]);
+    std::string r = effects.def;
+    if (!effects.pure || r == "zero" || registerName(block[k].args[1]) != r ||
+        registerName(block[k].args[0]) == r || !deadAfter(block, k, r))
+        return false;
+    block[i].args[0] = block[k].args[0];
+    block.erase(block.begin() + k);
+    return true;
+}
+
+// sw r, N(sp) ... lw q, N(sp) -> sw r, N(sp) ... mv q, r, while neither r, sp nor the slot change
+bool storeLoad(Lines &block, size_t i)
+{
+    const Line &store = block[i];
+    if (store.op != "sw" || store.args.size() != 2 || baseOf(store.args[1]) != "sp")
+        return false;
+    std::string r = registerName(store.args[0]);
+    for (size_t k = i + 1; k < block.size(); k++)
+    {
+        Line &line = block[k];
+        if (line.kind != Line::Instruction)
+            continue;
+        if (line.op == "lw" && line.args.size() == 2 && line.args[1] == store.args[1])
+        {
+            if (registerName(line.args[0]) == r)
+            {
+                block.erase(block.begin() + k);
+            }
+            else
+            {
+                line.op = "mv";
+                line.args[1] = store.args[0];
+            }
+            return true;
+        }
+        if (line.op == "sw" && (baseOf(line.args[1]) != "sp" || line.args[1] == store.args[1]))
+            return false;
+        Effects effects = effectsOf(line);
+        if (effects.barrier || effects.def == r || effects.def == "sp" || contains(effects.clobbers, r))
+            return false;
+    }
+    return false;
+}
+
+// lw r, N(sp); sw r, N(sp) -> lw r, N(sp)
+bool loadStore(Lines &block, size_t i)
+{
+    size_t k = nextInstruction(block, i);
+    const Line &load = block[i];
+    if (load.op != "lw" || load.args.size() != 2 || k == block.size())
+        return false;
+    const Line &store = block[k];
+    if (store.op != "sw" || store.args.size() != 2 || store.args[1] != load.args[1] ||
+        registerName(store.args[0]) != registerName(load.args[0]) || baseOf(load.args[1]) == registerName(load.args[0]))
+        return false;
+    block.erase(block.begin() + k);
+    return true;
+}
+
+bool deadDefinition(Lines &block, size_t i)
+{
+    Effects effects = effectsOf(block[i]);
+    if (!effects.pure || !deadAfter(block, i, effects.def))
+        return false;
+    block.erase(block.begin() + i);
+    return true;
+}
+
+// addi sp, sp, a; addi sp, sp, b -> addi sp, sp, a+b
+bool stackAdjust(Lines &block, size_t i)
+{
+    auto isAdjust = [](const Line &line) {
+        return line.op == "addi" && line.args.size() == 3 && registerName(line.args[0]) == "sp" &&
+               registerName(line.args[1]) == "sp";
+    };
+    size_t k = nextInstruction(block, i);
+    if (!isAdjust(block[i]) || k == block.size() || !isAdjust(block[k]))
+        return false;
+    long long sum = std::stoll(block[i].args[2]) + std::stoll(block[k].args[2]);
+    if (!fitsImmediate(sum))
+        return false;
+    block.erase(block.begin() + k);
+    if (sum == 0)
+        block.erase(block.begin() + i);
+    else
+        block[i].args[2] = std::to_string(sum);
+    return true;
+}
+
+// j L or a branch to L right before L:
+bool jumpToNext(Lines &lines, size_t i)
+{
+    if ((lines[i].op != "j" && !isBranch(lines[i].op)) || lines[i].args.empty())
+        return false;
+    for (size_t k = i + 1; k < lines.size() && lines[k].kind != Line::Instruction && lines[k].kind != Line::Directive;
+         k++)
+    {
+        if (lines[k].kind == Line::Label && lines[k].op == lines[i].args.back())
+        {
+            lines.erase(lines.begin() + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Instructions after j or ret that no label makes reachable
+bool unreachable(Lines &lines, size_t i)
+{
+    if (lines[i].op != "j" && lines[i].op != "ret")
+        return false;
+    size_t k = i + 1;
+    while (k < lines.size() && lines[k].kind == Line::Note)
+        k++;
+    if (k == lines.size() || lines[k].kind != Line::Instruction)
+        return false;
+    lines.erase(lines.begin() + k);
+    return true;
+}
+
+struct Rule
+{
+    const char *name;
+    bool (*apply)(Lines &lines, size_t i);
+};
+
+// Tried in order at every instruction; the first that applies fires
+const Rule localRules[] = {
+    {"mv-self", moveSelf},       {"sp-adjust", stackAdjust}, {"store-load", storeLoad}, {"load-store", loadStore},
+    {"mv-chain", moveChain},     {"copy-forward", copyForward}, {"dead-def", deadDefinition},
+};
+const Rule crossRules[] = {
+    {"jump-next", jumpToNext},
+    {"unreachable", unreachable},
+};
+
+// Apply rules until none fires
+template <size_t N>
+bool applyRules(const Rule (&rules)[N], Lines &lines, std::map<std::string, int> &fired)
+{
+    bool any = false;
+    bool again = true;
+    while (again)
+    {
+        again = false;
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            if (lines[i].kind != Line::Instruction)
+                continue;
+            for (const Rule &rule : rules)
+            {
+                if (rule.apply(lines, i))
+                {
+                    fired[rule.name]++;
+                    again = any = true;
+                    break;
+                }
+            }
+        }
+    }
+    return any;
+}
+} // namespace
+
+std::string optimizePeephole(const std::string &code, std::map<std::string, int> &fired,
+                             const std::map<std::string, CallingConvention> *conventions)
+{
+    Lines lines = parse(code);
+    for (auto &line : lines)
+    {
+        if (line.kind == Line::Instruction && line.op == "call" && line.args.size() == 1)
+            line.callee = &CallingConvention::lookup(conventions, line.args[0]);
+    }
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        Lines result;
+        size_t i = 0;
+        while (i < lines.size())
+        {
+            if (lines[i].kind == Line::Label || lines[i].kind == Line::Directive)
+            {
+                result.push_back(std::move(lines[i++]));
+                continue;
+            }
+            Lines block;
+            while (i < lines.size() && (lines[i].kind == Line::Instruction || lines[i].kind == Line::Note))
+            {
+                bool last = lines[i].kind == Line::Instruction && endsBlock(lines[i]);
+                block.push_back(std::move(lines[i++]));
+                if (last)
+                    break;
+            }
+            changed |= applyRules(localRules, block, fired);
+            std::move(block.begin(), block.end(), std::back_inserter(result));
+        }
+        lines = std::move(result);
+        changed |= applyRules(crossRules, lines, fired);
+    }
+    return render(lines);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <map>
+#include <string>
+
+struct CallingConvention;
+
+// Peephole optimizer over the RISC-V assembly of one function, run by
+// Generator and IREmitter just before a function is written out.
+//
+// The text is split into basic blocks at labels, branches, jumps, calls
+// and directives other than .loc. A table of local rules is applied to
+// each block until none fires; then the rules that look across block
+// boundaries (a jump to the next line, code after an unconditional jump)
+// run over the whole function, and the two alternate until nothing
+// changes. Liveness is local: a register is dead when the block writes it
+// again before reading it, when the block returns and the register is
+// neither a0 nor preserved (ra, sp, gp, tp, s0-s11), or when the call that
+// ends the block clobbers it without taking it as an argument. A call
+// reads a0-a7, or the parameter registers of its callee's convention
+// under interprocedural allocation. No rule adds a write to a register
+// the code did not already write, so the clobber sets of interprocedural
+// allocation stay valid.
+//
+// Local rules:
+//   mv-self       mv r, r                        -> (deleted)
+//   mv-chain      mv a, b; mv c, a               -> mv a, b; mv c, b
+//   copy-forward  op r, ...; mv d, r (r dead)    -> op d, ...   (li+mv, lw+mv, alu+mv;
+//                 li t3, 5; mv a0, t3; call f    -> li a0, 5; call f)
+//   store-load    sw r, N(sp) ... lw q, N(sp)    -> sw r, N(sp) ... mv q, r
+//   load-store    lw r, N(sp); sw r, N(sp)       -> lw r, N(sp)
+//   dead-def      a pure instruction whose result is dead -> (deleted)
+//   sp-adjust     addi sp, sp, a; addi sp, sp, b -> addi sp, sp, a+b (deleted when 0)
+// Rules across blocks:
+//   jump-next     j L / b<cond> ..., L directly before L: -> (deleted)
+//   unreachable   instructions after j/ret up to the next label -> (deleted)
+//
+// Returns the optimized text; fired counts how often each rule applied.
+// conventions gives the callees' register contracts (ILP32 when null or
+// missing, see CallingConvention::lookup).
+std::string optimizePeephole(const std::string &code, std::map<std::string, int> &fired,
+                             const std::map<std::string, CallingConvention> *conventions = nullptr);
@@ -0,0 +1,58 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include "ASTNode.h"
+
+// Profile counter sites and profile feedback.
+//
+// Sites are numbered by a fixed walk of the folded AST, so an instrumented
+// build and a later profile-use build agree on the numbering no matter how
+// the code is laid out:
+//   - one site per function entry
+//   - two sites per If: then branch taken, else path taken
+//   - one site per While: back edges (end of body and continue)
+//
+// Profile file (written by the instrumented program when main returns),
+// all fields are 32-bit little-endian words:
+//   magic "TCPF" (0x46504354), version (1), site count N, checksum of the
+//   site table, then N counters in site order.
+class Profile
+{
+private:
+    std::map<const FuncDef *, int> funcSites;
+    std::map<const Stmt *, int> stmtSites;
+    std::map<std::string, int> funcSiteByName;
+    std::vector<std::string> siteNames; // "func:entry", "func:if3.then", ...
+    std::vector<uint32_t> counters;     // empty unless a profile was loaded
+
+    void assignStmtSites(const std::string &func, const Stmt &stmt, int &ifCount, int &whileCount);
+
+public:
+    static constexpr uint32_t MAGIC = 0x46504354;
+    static constexpr uint32_t VERSION = 1;
+
+    // Number every counter site of the program
+    void assignSites(const Program &program);
+    int siteCount() const { return static_cast<int>(siteNames.size()); }
+    uint32_t checksum() const;
+
+    int entrySite(const FuncDef &func) const;
+    int stmtSite(const Stmt &stmt) const; // first site of an If/While, -1 if none
+
+    // Load counters written by an instrumented run; returns false and
+    // leaves the profile empty when the file is missing or stale
+    bool load(const std::string &path, std::string &error);
+    bool loaded() const { return !counters.empty(); }
+    uint32_t count(int site) const;
+    uint32_t entryCount(const std::string &funcName) const;
+
+    // Emit the counter storage and the dump routine called before main returns
+    void emitRuntime(std::ostream &out, const std::string &dumpPath) const;
+
+    // Inline calls to hot functions whose body is a single return of a
+    // call-free expression; returns the number of call sites replaced
+    int inlineHotCalls(Program &program) const;
+};
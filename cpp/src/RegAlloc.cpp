@@ -0,0 +1,1005 @@
+#include "RegAlloc.h"
+#include "IRAnalysis.h"
+#include <algorithm>
+#include <iomanip>
+
+const std::vector<std::string> allocatableTemps = {"t3", "t4", "t5", "t6"};
+const std::vector<std::string> allocatableSaved = {"s0", "s1", "s2", "s3", "s4",  "s5",
+                                                   "s6", "s7", "s8", "s9", "s10", "s11"};
+
+// Spill cost of a use of a rematerializable constant relative to a reload
+static const double REMAT_USE_COST = 0.5;
+// A register saved and restored once: the first use of a callee-saved
+// register in the prologue and epilogue, a caller-saved one around a call
+static const double SAVE_RESTORE_COST = 2;
+
+// Bit per allocatable register, in the temps-then-saved order the allocators use
+static uint32_t registerMask(const std::set<std::string> &clobbers)
+{
+    uint32_t mask = 0;
+    int bit = 0;
+    for (const auto *group : {&allocatableTemps, &allocatableSaved})
+    {
+        for (const auto &reg : *group)
+        {
+            if (clobbers.count(reg))
+                mask |= 1u << bit;
+            bit++;
+        }
+    }
+    return mask;
+}
+
+// First free register outside avoid, else the first free one; -1 if none
+static int pickRegister(const std::vector<char> &free, uint32_t avoid)
+{
+    for (uint32_t pass = 0; pass < 2; pass++)
+    {
+        for (size_t r = 0; r < free.size(); r++)
+        {
+            if (free[r] && (avoid >> r & 1) == pass)
+                return static_cast<int>(r);
+        }
+    }
+    return -1;
+}
+
+std::vector<int> findStackArguments(const IRFunction &func,
+                                    const std::map<std::string, CallingConvention> *conventions)
+{
+    int n = func.numVRegs();
+    std::vector<int> defs(n, 0), uses(n, 0), offset(n, -1);
+    for (const auto &block : func.blocks)
+    {
+        for (const auto &inst : block.insts)
+        {
+            if (inst.dst >= 0)
+                defs[inst.dst]++;
+            for (int v : inst.uses())
+                uses[v]++;
+        }
+    }
+    for (int param : func.params)
+    {
+        defs[param]++;
+    }
+    for (const auto &block : func.blocks)
+    {
+        // Vregs defined since the last call of the block
+        std::set<int> sinceCall;
+        for (const auto &inst : block.insts)
+        {
+            if (inst.op == IROp::Call)
+            {
+                const CallingConvention &conv = CallingConvention::lookup(conventions, inst.callee);
+                for (size_t i = 8; i < inst.args.size(); i++)
+                {
+                    int v = inst.args[i];
+                    if (conv.argumentPlace(i).empty() && defs[v] == 1 && uses[v] == 1 && sinceCall.count(v))
+                        offset[v] = static_cast<int>(i - 8) * 4;
+                }
+                sinceCall.clear();
+            }
+            if (inst.dst >= 0)
+                sinceCall.insert(inst.dst);
+        }
+    }
+    return offset;
+}
+
+// Vregs read inside a loop
+static std::vector<char> findLoopUses(const IRFunction &func)
+{
+    DominatorTree dom(func);
+    LoopInfo loops(func, dom);
+    std::vector<char> usedInLoop(func.numVRegs(), 0);
+    for (size_t b = 0; b < func.blocks.size(); b++)
+    {
+        if (loops.depth[b] == 0)
+            continue;
+        for (const auto &inst : func.blocks[b].insts)
+        {
+            for (int v : inst.uses())
+                usedInLoop[v] = 1;
+        }
+    }
+    return usedInLoop;
+}
+
+// Give the values that need no register their place in memory: stack
+// arguments are computed straight into their outgoing place, and
+// parameters passed on the stack that are never reassigned and are read
+// outside loops only stay where the caller put them
+static void placeStackValues(const IRFunction &func, const std::vector<LiveInterval> &intervals,
+                             const std::vector<char> &usedInLoop,
+                             const std::map<std::string, CallingConvention> *conventions, RegisterAssignment &result)
+{
+    std::vector<char> assigned(func.numVRegs(), 0);
+    for (const auto &block : func.blocks)
+    {
+        for (const auto &inst : block.insts)
+        {
+            if (inst.dst >= 0)
+                assigned[inst.dst] = 1;
+        }
+    }
+    for (size_t i = 8; i < func.params.size(); i++)
+    {
+        int param = func.params[i];
+        if (!assigned[param] && !usedInLoop[param])
+            result.locations[param].incoming = static_cast<int>(i - 8) * 4;
+    }
+    std::vector<int> stackArgs = findStackArguments(func, conventions);
+    for (const auto &interval : intervals)
+    {
+        if (!interval.empty() && stackArgs[interval.vreg] >= 0)
+            result.locations[interval.vreg].outgoing = stackArgs[interval.vreg];
+    }
+}
+
+std::vector<LiveInterval> computeLiveIntervals(const IRFunction &func,
+                                               const std::map<std::string, CallingConvention> *conventions)
+{
+    int numVRegs = func.numVRegs();
+    std::vector<LiveInterval> intervals(numVRegs);
+    for (int v = 0; v < numVRegs; v++)
+    {
+        intervals[v].vreg = v;
+    }
+    auto extend = [&](int v, int pos) {
+        LiveInterval &interval = intervals[v];
+        if (interval.start < 0 || pos < interval.start)
+            interval.start = pos;
+        if (pos > interval.end)
+            interval.end = pos;
+    };
+    // Parameters are defined by the prologue, before the first instruction
+    for (int param : func.params)
+    {
+        extend(param, 0);
+    }
+
+    Liveness live(func);
+    int index = 0;
+    for (size_t b = 0; b < func.blocks.size(); b++)
+    {
+        const auto &insts = func.blocks[b].insts;
+        if (insts.empty())
+        {
+            continue;
+        }
+        int first = index;
+        int last = index + static_cast<int>(insts.size()) - 1;
+        index = last + 1;
+        live.liveIn[b].forEach([&](int v) { extend(v, 2 * first); });
+        live.liveOut[b].forEach([&](int v) { extend(v, 2 * last + 1); });
+
+        VRegSet current = live.liveOut[b];
+        for (int i = static_cast<int>(insts.size()) - 1; i >= 0; i--)
+        {
+            const IRInst &inst = insts[i];
+            int pos = first + i;
+            if (inst.dst >= 0)
+            {
+                extend(inst.dst, 2 * pos + 1);
+                current.reset(inst.dst);
+            }
+            if (inst.op == IROp::Call)
+            {
+                uint32_t clobbers = registerMask(CallingConvention::lookup(conventions, inst.callee).clobbers);
+                current.forEach([&](int v) {
+                    intervals[v].crossesCall = true;
+                    intervals[v].callClobbers |= clobbers;
+                });
+            }
+            for (int v : inst.uses())
+            {
+                extend(v, 2 * pos);
+                intervals[v].uses++;
+                current.set(v);
+            }
+        }
+    }
+    return intervals;
+}
+
+RegisterAssignment LinearScanAllocator::allocate(const IRFunction &func,
+                                                 const std::map<std::string, CallingConvention> *conventions)
+{
+    RegisterAssignment result;
+    result.locations.resize(func.numVRegs());
+    std::vector<LiveInterval> intervals = computeLiveIntervals(func, conventions);
+
+    // Constants and stack parameters read inside a loop are worth a register
+    std::vector<char> usedInLoop = findLoopUses(func);
+    placeStackValues(func, intervals, usedInLoop, conventions, result);
+    // Values that are never read need no storage at all
+    std::vector<LiveInterval *> order;
+    for (auto &interval : intervals)
+    {
+        if (!interval.empty() && interval.uses > 0 && !result.locations[interval.vreg].inMemory())
+            order.push_back(&interval);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const LiveInterval *a, const LiveInterval *b) { return a->start < b->start; });
+
+    std::vector<std::string> regs = allocatableTemps;
+    regs.insert(regs.end(), allocatableSaved.begin(), allocatableSaved.end());
+    int total = static_cast<int>(regs.size());
+    std::vector<char> regFree(total, 1);
+    std::vector<int> regOf(func.numVRegs(), -1);
+    std::vector<LiveInterval *> active;
+    std::vector<int> constants;
+    std::vector<char> remat = findConstantVRegs(func, constants);
+
+    auto spill = [&](LiveInterval *interval) {
+        VRegLocation &loc = result.locations[interval->vreg];
+        if (remat[interval->vreg])
+        {
+            loc.remat = true;
+            loc.constant = constants[interval->vreg];
+            result.remats++;
+            return;
+        }
+        loc.slot = result.slotCount++;
+        result.spills++;
+    };
+    // Spill order: constants first (they are recomputed, not stored), then the furthest end
+    auto spillKey = [&](const LiveInterval *interval) { return std::make_pair(remat[interval->vreg], interval->end); };
+    for (LiveInterval *current : order)
+    {
+        // A constant live across a call would hold a callee-saved register
+        // (an li plus a save and restore per invocation) or be saved around
+        // the call; an li at each of up to three uses outside loops is cheaper
+        if (remat[current->vreg] && current->crossesCall && !usedInLoop[current->vreg] && current->uses <= 3)
+        {
+            spill(current);
+            continue;
+        }
+        // Expire intervals that ended before this one starts
+        for (auto it = active.begin(); it != active.end();)
+        {
+            if ((*it)->end < current->start)
+            {
+                regFree[regOf[(*it)->vreg]] = 1;
+                it = active.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        // Call-crossing values try registers the calls leave alone first
+        int chosen = pickRegister(regFree, current->callClobbers);
+        if (chosen < 0)
+        {
+            auto cheaperLast = [&](const LiveInterval *a, const LiveInterval *b) { return spillKey(a) < spillKey(b); };
+            auto victim = std::max_element(active.begin(), active.end(), cheaperLast);
+            if (spillKey(*victim) <= spillKey(current))
+            {
+                spill(current);
+                continue;
+            }
+            chosen = regOf[(*victim)->vreg];
+            result.locations[(*victim)->vreg].reg.clear();
+            spill(*victim);
+            active.erase(victim);
+        }
+        regFree[chosen] = 0;
+        regOf[current->vreg] = chosen;
+        result.locations[current->vreg].reg = regs[chosen];
+        active.push_back(current);
+    }
+    return result;
+}
+
+int countEliminatedMoves(const IRFunction &func, const RegisterAssignment &assignment)
+{
+    int count = 0;
+    for (const auto &block : func.blocks)
+    {
+        for (const auto &inst : block.insts)
+        {
+            if (inst.op != IROp::Copy)
+                continue;
+            const VRegLocation &to = assignment.locations[inst.dst];
+            const VRegLocation &from = assignment.locations[inst.a];
+            if (to.reg.empty() && !to.inMemory())
+                count++; // dead copy
+            else if (!to.reg.empty() ? to.reg == from.reg : (from.reg.empty() && to.outgoing < 0 && to.slot == from.slot))
+                count++;
+        }
+    }
+    return count;
+}
+
+void GraphColoringAllocator::addEdge(int u, int v)
+{
+    if (u == v || adjSet[u].test(v))
+    {
+        return;
+    }
+    adjSet[u].set(v);
+    adjSet[v].set(u);
+    adjList[u].push_back(v);
+    adjList[v].push_back(u);
+    degree[u]++;
+    degree[v]++;
+}
+
+template <typename F>
+void GraphColoringAllocator::forEachAdjacent(int n, F f) const
+{
+    for (int m : adjList[n])
+    {
+        if (state[m] != NodeState::OnStack && state[m] != NodeState::Coalesced)
+            f(m);
+    }
+}
+
+template <typename F>
+void GraphColoringAllocator::forEachNodeMove(int n, F f) const
+{
+    for (int m : moveList[n])
+    {
+        if (moveState[m] == MoveState::Worklist || moveState[m] == MoveState::Active)
+            f(m);
+    }
+}
+
+bool GraphColoringAllocator::moveRelated(int n) const
+{
+    bool related = false;
+    forEachNodeMove(n, [&](int) { related = true; });
+    return related;
+}
+
+void GraphColoringAllocator::build(const IRFunction &func, const std::vector<LiveInterval> &intervals)
+{
+    DominatorTree dom(func);
+    LoopInfo loops(func, dom);
+    Liveness live(func);
+    // Values that are never read get no storage and, like the ones that
+    // stay in their stack place, stay out of the graph
+    auto isNode = [&](int v) { return intervals[v].uses > 0 && !inMemory[v]; };
+    for (size_t v = 0; v < state.size(); v++)
+    {
+        if (!isNode(v))
+            state[v] = NodeState::Colored;
+    }
+    for (size_t b = 0; b < func.blocks.size(); b++)
+    {
+        const auto &insts = func.blocks[b].insts;
+        double weight = 1;
+        for (int d = 0; d < std::min(loops.depth[b], 8); d++)
+            weight *= 10;
+        VRegSet current = live.liveOut[b];
+        for (size_t i = insts.size(); i-- > 0;)
+        {
+            const IRInst &inst = insts[i];
+            bool isMove = inst.op == IROp::Copy && inst.dst >= 0 && isNode(inst.dst) && isNode(inst.a) &&
+                          inst.dst != inst.a;
+            if (isMove)
+            {
+                // The source does not interfere with the copy's destination
+                current.reset(inst.a);
+                int m = static_cast<int>(moves.size());
+                moves.push_back({inst.dst, inst.a});
+                moveState.push_back(MoveState::Worklist);
+                moveList[inst.dst].push_back(m);
+                moveList[inst.a].push_back(m);
+                worklistMoves.insert(m);
+            }
+            if (inst.op == IROp::Call)
+            {
+                // What a value in a clobbered register pays for this call
+                current.forEach([&](int v) {
+                    if (v != inst.dst)
+                        callCost[v] += weight * SAVE_RESTORE_COST;
+                });
+            }
+            if (inst.dst >= 0 && isNode(inst.dst))
+            {
+                current.forEach([&](int v) {
+                    if (isNode(v))
+                        addEdge(inst.dst, v);
+                });
+                // A rematerialized constant has no store at its definition
+                if (!remat[inst.dst])
+                    cost[inst.dst] += weight;
+            }
+            if (inst.dst >= 0)
+            {
+                current.reset(inst.dst);
+            }
+            for (int v : inst.uses())
+            {
+                if (!isNode(v))
+                    continue;
+                current.set(v);
+                // ... and an li at each use is cheaper than a load
+                cost[v] += remat[v] ? weight * REMAT_USE_COST : weight;
+            }
+        }
+        if (b == 0)
+        {
+            // Parameters are all defined on entry
+            for (int param : func.params)
+            {
+                if (!isNode(param))
+                    continue;
+                // A spilled parameter is stored on entry
+                cost[param] += weight;
+                current.forEach([&](int v) { addEdge(param, v); });
+                for (int other : func.params)
+                {
+                    if (isNode(other))
+                        addEdge(param, other);
+                }
+            }
+        }
+    }
+}
+
+void GraphColoringAllocator::makeWorklist()
+{
+    for (size_t n = 0; n < state.size(); n++)
+    {
+        if (state[n] != NodeState::None)
+            continue;
+        if (degree[n] >= K)
+        {
+            state[n] = NodeState::Spill;
+            spillWorklist.insert(n);
+        }
+        else if (moveRelated(n))
+        {
+            state[n] = NodeState::Freeze;
+            freezeWorklist.insert(n);
+        }
+        else
+        {
+            state[n] = NodeState::Simplify;
+            simplifyWorklist.insert(n);
+        }
+    }
+}
+
+void GraphColoringAllocator::simplify()
+{
+    int n = *simplifyWorklist.begin();
+    simplifyWorklist.erase(simplifyWorklist.begin());
+    state[n] = NodeState::OnStack;
+    selectStack.push_back(n);
+    forEachAdjacent(n, [&](int m) { decrementDegree(m); });
+}
+
+void GraphColoringAllocator::decrementDegree(int m)
+{
+    int d = degree[m]--;
+    if (d != K)
+    {
+        return;
+    }
+    enableMoves(m);
+    forEachAdjacent(m, [&](int a) { enableMoves(a); });
+    spillWorklist.erase(m);
+    if (moveRelated(m))
+    {
+        state[m] = NodeState::Freeze;
+        freezeWorklist.insert(m);
+    }
+    else
+    {
+        state[m] = NodeState::Simplify;
+        simplifyWorklist.insert(m);
+    }
+}
+
+void GraphColoringAllocator::enableMoves(int n)
+{
+    forEachNodeMove(n, [&](int m) {
+        if (moveState[m] == MoveState::Active)
+        {
+            activeMoves.erase(m);
+            moveState[m] = MoveState::Worklist;
+            worklistMoves.insert(m);
+        }
+    });
+}
+
+void GraphColoringAllocator::addWorklist(int u)
+{
+    if (state[u] == NodeState::Freeze && !moveRelated(u) && degree[u] < K)
+    {
+        freezeWorklist.erase(u);
+        state[u] = NodeState::Simplify;
+        simplifyWorklist.insert(u);
+    }
+}
+
+// Briggs: the merged node has fewer than K neighbours of significant degree
+bool GraphColoringAllocator::conservative(int u, int v) const
+{
+    std::set<int> significant;
+    auto count = [&](int n) {
+        if (degree[n] >= K)
+            significant.insert(n);
+    };
+    forEachAdjacent(u, count);
+    forEachAdjacent(v, count);
+    return static_cast<int>(significant.size()) < K;
+}
+
+int GraphColoringAllocator::getAlias(int n) const
+{
+    while (state[n] == NodeState::Coalesced)
+    {
+        n = alias[n];
+    }
+    return n;
+}
+
+void GraphColoringAllocator::coalesce()
+{
+    int m = *worklistMoves.begin();
+    worklistMoves.erase(worklistMoves.begin());
+    int u = getAlias(moves[m].dst);
+    int v = getAlias(moves[m].src);
+    if (u == v)
+    {
+        moveState[m] = MoveState::Coalesced;
+        addWorklist(u);
+    }
+    else if (adjSet[u].test(v))
+    {
+        moveState[m] = MoveState::Constrained;
+        addWorklist(u);
+        addWorklist(v);
+    }
+    else if (conservative(u, v))
+    {
+        moveState[m] = MoveState::Coalesced;
+        combine(u, v);
+        addWorklist(u);
+    }
+    else
+    {
+        moveState[m] = MoveState::Active;
+        activeMoves.insert(m);
+    }
+}
+
+void GraphColoringAllocator::combine(int u, int v)
+{
+    if (state[v] == NodeState::Freeze)
+        freezeWorklist.erase(v);
+    else
+        spillWorklist.erase(v);
+    state[v] = NodeState::Coalesced;
+    alias[v] = u;
+    moveList[u].insert(moveList[u].end(), moveList[v].begin(), moveList[v].end());
+    cost[u] += cost[v];
+    callCost[u] += callCost[v];
+    callClobbers[u] |= callClobbers[v];
+    enableMoves(v);
+    forEachAdjacent(v, [&](int t) {
+        addEdge(t, u);
+        decrementDegree(t);
+    });
+    if (degree[u] >= K && state[u] == NodeState::Freeze)
+    {
+        freezeWorklist.erase(u);
+        state[u] = NodeState::Spill;
+        spillWorklist.insert(u);
+    }
+}
+
+void GraphColoringAllocator::freeze()
+{
+    int u = *freezeWorklist.begin();
+    freezeWorklist.erase(freezeWorklist.begin());
+    state[u] = NodeState::Simplify;
+    simplifyWorklist.insert(u);
+    freezeMoves(u);
+}
+
+void GraphColoringAllocator::freezeMoves(int u)
+{
+    std::vector<int> related;
+    forEachNodeMove(u, [&](int m) { related.push_back(m); });
+    for (int m : related)
+    {
+        int x = getAlias(moves[m].dst);
+        int y = getAlias(moves[m].src);
+        int v = y == getAlias(u) ? x : y;
+        activeMoves.erase(m);
+        worklistMoves.erase(m);
+        moveState[m] = MoveState::Frozen;
+        if (state[v] == NodeState::Freeze && !moveRelated(v) && degree[v] < K)
+        {
+            freezeWorklist.erase(v);
+            state[v] = NodeState::Simplify;
+            simplifyWorklist.insert(v);
+        }
+    }
+}
+
+void GraphColoringAllocator::selectSpill()
+{
+    // Cheapest to spill: low loop-weighted use count, high degree
+    int best = -1;
+    double bestScore = 0;
+    for (int n : spillWorklist)
+    {
+        double score = cost[n] / std::max(degree[n], 1);
+        if (best < 0 || score < bestScore)
+        {
+            best = n;
+            bestScore = score;
+        }
+    }
+    spillWorklist.erase(best);
+    state[best] = NodeState::Simplify;
+    simplifyWorklist.insert(best);
+    freezeMoves(best);
+}
+
+void GraphColoringAllocator::assignColors()
+{
+    int temps = static_cast<int>(allocatableTemps.size());
+    std::vector<char> savedInUse(K, 0);
+    while (!selectStack.empty())
+    {
+        int n = selectStack.back();
+        selectStack.pop_back();
+        std::vector<char> ok(K, 1);
+        for (int w : adjList[n])
+        {
+            int a = getAlias(w);
+            if (state[a] == NodeState::Colored)
+                ok[color[a]] = 0;
+        }
+        // Cheapest free color: a register the calls clobber is saved around
+        // each of them, a callee-saved one costs a save and a restore the
+        // first time a function that preserves them uses it; on a tie, one
+        // the calls leave alone
+        int chosen = -1;
+        std::pair<double, bool> best;
+        for (int r = 0; r < K; r++)
+        {
+            if (!ok[r])
+                continue;
+            bool clobbered = callClobbers[n] >> r & 1;
+            double price = clobbered                                     ? callCost[n]
+                           : preservesSaved && r >= temps && !savedInUse[r] ? SAVE_RESTORE_COST
+                                                                             : 0;
+            if (chosen < 0 || std::make_pair(price, clobbered) < best)
+            {
+                chosen = r;
+                best = {price, clobbered};
+            }
+        }
+        // A stack slot (or an li at each use) may be cheaper than any register
+        if (chosen < 0 || cost[n] < best.first)
+        {
+            state[n] = NodeState::Spilled;
+        }
+        else
+        {
+            state[n] = NodeState::Colored;
+            color[n] = chosen;
+            savedInUse[chosen] = 1;
+        }
+    }
+}
+
+RegisterAssignment GraphColoringAllocator::allocate(const IRFunction &func,
+                                                    const std::map<std::string, CallingConvention> *conventions)
+{
+    int n = func.numVRegs();
+    regs = allocatableTemps;
+    regs.insert(regs.end(), allocatableSaved.begin(), allocatableSaved.end());
+    K = static_cast<int>(regs.size());
+    state.assign(n, NodeState::None);
+    adjSet.assign(n, VRegSet(n));
+    adjList.assign(n, {});
+    degree.assign(n, 0);
+    alias.assign(n, -1);
+    color.assign(n, -1);
+    cost.assign(n, 0);
+    callCost.assign(n, 0);
+    callClobbers.assign(n, 0);
+    moveList.assign(n, {});
+    moves.clear();
+    moveState.clear();
+    simplifyWorklist.clear();
+    freezeWorklist.clear();
+    spillWorklist.clear();
+    worklistMoves.clear();
+    activeMoves.clear();
+    selectStack.clear();
+
+    std::vector<LiveInterval> intervals = computeLiveIntervals(func, conventions);
+    for (int v = 0; v < n; v++)
+    {
+        callClobbers[v] = intervals[v].callClobbers;
+    }
+    std::vector<int> constants;
+    remat = findConstantVRegs(func, constants);
+    RegisterAssignment result;
+    result.locations.resize(n);
+    placeStackValues(func, intervals, findLoopUses(func), conventions, result);
+    inMemory.assign(n, 0);
+    for (int v = 0; v < n; v++)
+    {
+        inMemory[v] = result.locations[v].inMemory();
+    }
+    build(func, intervals);
+    makeWorklist();
+    while (!simplifyWorklist.empty() || !worklistMoves.empty() || !freezeWorklist.empty() ||
+           !spillWorklist.empty())
+    {
+        if (!simplifyWorklist.empty())
+            simplify();
+        else if (!worklistMoves.empty())
+            coalesce();
+        else if (!freezeWorklist.empty())
+            freeze();
+        else
+            selectSpill();
+    }
+    assignColors();
+
+    std::vector<int> slotOf(n, -1);
+    for (int v = 0; v < n; v++)
+    {
+        if (intervals[v].uses == 0 || inMemory[v])
+            continue;
+        int root = getAlias(v);
+        if (state[root] == NodeState::Colored)
+        {
+            result.locations[v].reg = regs[color[root]];
+            continue;
+        }
+        if (remat[v])
+        {
+            result.locations[v].remat = true;
+            result.locations[v].constant = constants[v];
+            result.remats++;
+            continue;
+        }
+        // Coalesced nodes share the slot of their representative
+        if (slotOf[root] < 0)
+            slotOf[root] = result.slotCount++;
+        result.locations[v].slot = slotOf[root];
+        result.spills++;
+    }
+    return result;
+}
+
+void colorStackSlots(const IRFunction &func, RegisterAssignment &assignment)
+{
+    int slots = assignment.slotCount;
+    assignment.unsharedSlots = slots;
+    if (slots < 2)
+        return;
+    auto slotOf = [&](int v) {
+        const VRegLocation &loc = assignment.locations[v];
+        return loc.reg.empty() ? loc.slot : -1;
+    };
+    std::vector<std::set<int>> conflicts(slots);
+    auto conflict = [&](int a, int b) {
+        if (a >= 0 && b >= 0 && a != b)
+        {
+            conflicts[a].insert(b);
+            conflicts[b].insert(a);
+        }
+    };
+    Liveness live(func);
+    for (size_t b = 0; b < func.blocks.size(); b++)
+    {
+        const auto &insts = func.blocks[b].insts;
+        VRegSet current = live.liveOut[b];
+        for (size_t i = insts.size(); i-- > 0;)
+        {
+            const IRInst &inst = insts[i];
+            if (inst.dst >= 0)
+            {
+                int skip = inst.op == IROp::Copy ? inst.a : -1;
+                current.forEach([&](int v) {
+                    if (v != skip && v != inst.dst)
+                        conflict(slotOf(inst.dst), slotOf(v));
+                });
+                current.reset(inst.dst);
+            }
+            for (int v : inst.uses())
+                current.set(v);
+        }
+        if (b == 0)
+        {
+            // Parameters are all stored on entry
+            for (int param : func.params)
+            {
+                current.forEach([&](int v) { conflict(slotOf(param), slotOf(v)); });
+                for (int other : func.params)
+                    conflict(slotOf(param), slotOf(other));
+            }
+        }
+    }
+
+    std::vector<int> color(slots, -1);
+    int used = 0;
+    for (int slot = 0; slot < slots; slot++)
+    {
+        std::vector<char> taken(used, 0);
+        for (int other : conflicts[slot])
+        {
+            if (color[other] >= 0)
+                taken[color[other]] = 1;
+        }
+        color[slot] = static_cast<int>(std::find(taken.begin(), taken.end(), 0) - taken.begin());
+        used = std::max(used, color[slot] + 1);
+    }
+    for (auto &loc : assignment.locations)
+    {
+        if (loc.reg.empty() && loc.slot >= 0)
+            loc.slot = color[loc.slot];
+    }
+    assignment.slotCount = used;
+}
+
+RegisterAssignment ProgramAllocator::allocateFunction(const IRFunction &func, bool ownConvention)
+{
+    const std::map<std::string, CallingConvention> *known = interprocedural ? &conventionMap : nullptr;
+    RegisterAssignment result;
+    if (allocator == "graph")
+        result = GraphColoringAllocator(!ownConvention).allocate(func, known);
+    else if (allocator == "linear")
+        result = LinearScanAllocator().allocate(func, known);
+    else
+        result = RegisterAssignment::allStack(func);
+    if (slotColoring)
+        colorStackSlots(func, result);
+    return result;
+}
+
+CallingConvention ProgramAllocator::conventionFor(const IRFunction &func, const RegisterAssignment &assignment) const
+{
+    // Scratch and argument registers, everything the function allocates and
+    // everything its callees clobber
+    CallingConvention conv;
+    conv.standard = false;
+    for (const auto &reg : {"t0", "t1", "t2", "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7"})
+        conv.clobbers.insert(reg);
+    for (int param : func.params)
+        conv.paramRegs.push_back(assignment.locations[param].reg);
+    for (const auto &loc : assignment.locations)
+    {
+        if (!loc.reg.empty())
+            conv.clobbers.insert(loc.reg);
+    }
+    for (const auto &block : func.blocks)
+    {
+        for (const auto &inst : block.insts)
+        {
+            if (inst.op == IROp::Call)
+            {
+                const auto &callee = CallingConvention::lookup(&conventionMap, inst.callee).clobbers;
+                conv.clobbers.insert(callee.begin(), callee.end());
+            }
+        }
+    }
+    return conv;
+}
+
+std::vector<RegisterAssignment> ProgramAllocator::allocate(const IRProgram &program)
+{
+    conventionMap.clear();
+    size_t n = program.functions.size();
+    std::vector<RegisterAssignment> result(n);
+    if (!interprocedural)
+    {
+        for (size_t f = 0; f < n; f++)
+            result[f] = allocateFunction(program.functions[f]);
+        return result;
+    }
+
+    std::map<std::string, int> indexOf;
+    for (size_t f = 0; f < n; f++)
+        indexOf[program.functions[f].name] = static_cast<int>(f);
+    std::vector<std::vector<int>> callees(n);
+    std::vector<char> selfCall(n, 0);
+    for (size_t f = 0; f < n; f++)
+    {
+        for (const auto &block : program.functions[f].blocks)
+        {
+            for (const auto &inst : block.insts)
+            {
+                auto it = inst.op == IROp::Call ? indexOf.find(inst.callee) : indexOf.end();
+                if (it == indexOf.end())
+                    continue;
+                callees[f].push_back(it->second);
+                selfCall[f] |= it->second == static_cast<int>(f);
+            }
+        }
+    }
+
+    // Tarjan's algorithm finishes every strongly connected component after
+    // the ones it calls into, which is exactly the callees-first order
+    std::vector<int> index(n, -1), lowLink(n, 0), stack;
+    std::vector<char> onStack(n, 0);
+    int counter = 0;
+    auto visit = [&](auto &self, int f) -> void {
+        index[f] = lowLink[f] = counter++;
+        stack.push_back(f);
+        onStack[f] = 1;
+        for (int g : callees[f])
+        {
+            if (index[g] < 0)
+            {
+                self(self, g);
+                lowLink[f] = std::min(lowLink[f], lowLink[g]);
+            }
+            else if (onStack[g])
+            {
+                lowLink[f] = std::min(lowLink[f], index[g]);
+            }
+        }
+        if (lowLink[f] != index[f])
+            return;
+        std::vector<int> component;
+        int g;
+        do
+        {
+            g = stack.back();
+            stack.pop_back();
+            onStack[g] = 0;
+            component.push_back(g);
+        } while (g != f);
+        const IRFunction &func = program.functions[f];
+        bool ownConvention = component.size() == 1 && !selfCall[f] && func.name != "main";
+        for (int h : component)
+            result[h] = allocateFunction(program.functions[h], ownConvention);
+        if (ownConvention)
+            conventionMap[func.name] = conventionFor(func, result[f]);
+    };
+    for (size_t f = 0; f < n; f++)
+    {
+        if (index[f] < 0)
+            visit(visit, static_cast<int>(f));
+    }
+    return result;
+}
+
+void reportAllocators(std::ostream &out, const IRProgram &program)
+{
+    out << std::left << std::setw(16) << "function" << std::right << std::setw(7) << "copies" << std::setw(14)
+        << "linear spill" << std::setw(12) << "linear mv" << std::setw(13) << "graph spill" << std::setw(11)
+        << "graph mv" << "\n";
+    int copies = 0, linearSpills = 0, linearMoves = 0, graphSpills = 0, graphMoves = 0;
+    LinearScanAllocator linearScan;
+    GraphColoringAllocator graphColoring;
+    for (const auto &func : program.functions)
+    {
+        int funcCopies = 0;
+        for (const auto &block : func.blocks)
+            for (const auto &inst : block.insts)
+                funcCopies += inst.op == IROp::Copy;
+        RegisterAssignment linear = linearScan.allocate(func);
+        RegisterAssignment graph = graphColoring.allocate(func);
+        int linearEliminated = countEliminatedMoves(func, linear);
+        int graphEliminated = countEliminatedMoves(func, graph);
+        out << std::left << std::setw(16) << func.name << std::right << std::setw(7) << funcCopies << std::setw(14)
+            << linear.spills << std::setw(12) << linearEliminated << std::setw(13) << graph.spills << std::setw(11)
+            << graphEliminated << "\n";
+        copies += funcCopies;
+        linearSpills += linear.spills;
+        linearMoves += linearEliminated;
+        graphSpills += graph.spills;
+        graphMoves += graphEliminated;
+    }
+    out << std::left << std::setw(16) << "total" << std::right << std::setw(7) << copies << std::setw(14)
+        << linearSpills << std::setw(12) << linearMoves << std::setw(13) << graphSpills << std::setw(11)
+        << graphMoves << std::endl;
+}
@@ -0,0 +1,200 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "IR.h"
+#include "IREmitter.h"
+#include "IRAnalysis.h"
+
+// Registers handed out by the allocators; t0-t2 stay reserved as emitter scratch
+extern const std::vector<std::string> allocatableTemps;  // caller saved: t3-t6
+extern const std::vector<std::string> allocatableSaved;  // callee saved: s0-s11
+
+// Live interval of a vreg over the linear instruction order (block order,
+// two positions per instruction: uses at 2i, the definition at 2i+1).
+// Holes are ignored, so the interval is the hull of every live range.
+struct LiveInterval
+{
+    int vreg = -1;
+    int start = -1;
+    int end = -1;
+    bool crossesCall = false; // live across at least one call
+    uint32_t callClobbers = 0; // allocatable registers (temps then saved, one bit each) those calls change
+    int uses = 0;
+
+    bool empty() const { return start < 0; }
+};
+
+// Live intervals of every vreg of a non-SSA function; callees missing from
+// conventions clobber what ILP32 lets them
+std::vector<LiveInterval> computeLiveIntervals(const IRFunction &func,
+                                               const std::map<std::string, CallingConvention> *conventions = nullptr);
+
+// Outgoing-area offset of every vreg that is defined once and read only as
+// a stack argument of a later call in the same block with no call in
+// between, -1 for the others. Such a value can be computed straight into
+// its argument place instead of taking a register or slot until the call.
+std::vector<int> findStackArguments(const IRFunction &func,
+                                    const std::map<std::string, CallingConvention> *conventions = nullptr);
+
+// Linear-scan register allocation (Poletto and Sarkar).
+//
+// Intervals are visited by start point; values live across a call prefer
+// registers the callee does not clobber (the s registers under ILP32) so
+// the emitter need not save them around the call, the others prefer the t
+// registers. When no register is free a constant is given up first, to
+// be rematerialized with li at each use, otherwise the interval that ends
+// last is spilled to a stack slot for its whole lifetime. A constant live
+// across a call, read at most three times and not in a loop, is
+// rematerialized rather than given a callee-saved register. Stack
+// arguments of calls (findStackArguments) and stack parameters read
+// outside loops take no register. Linear in the number of instructions and
+// vregs (times the register count), which keeps it cheap enough for -O1.
+class LinearScanAllocator
+{
+public:
+    RegisterAssignment allocate(const IRFunction &func,
+                                const std::map<std::string, CallingConvention> *conventions = nullptr);
+};
+
+// Iterated register coalescing (George and Appel's Chaitin/Briggs
+// allocator).
+//
+// Builds the interference graph from liveness, coalesces copies with the
+// Briggs test, and simplifies/freezes/spills until the graph is empty.
+// The spill candidate is the node with the lowest cost per degree, where
+// every def and use costs 10^loop depth; a constant costs only half per
+// use, since spilling it means rematerializing it with li at each use
+// rather than a store and reloads. A spilled node lives in a stack
+// slot and is accessed through the emitter's scratch registers, so no
+// rewrite round is needed. Each node takes the cheapest free color: a
+// register the calls it is live across clobber costs a save and a restore
+// around each of them (the emitter's caller-save slots split the value
+// there), a callee-saved register costs a save and a restore the first
+// time the function uses it, and a node whose spill cost is lower than
+// that is spilled or rematerialized instead. Stack arguments and stack
+// parameters are placed as in linear scan and take no node.
+class GraphColoringAllocator
+{
+private:
+    enum class NodeState : uint8_t
+    {
+        None,
+        Simplify,
+        Freeze,
+        Spill,
+        OnStack,
+        Coalesced,
+        Colored,
+        Spilled
+    };
+    enum class MoveState : uint8_t
+    {
+        Worklist,
+        Active,
+        Coalesced,
+        Constrained,
+        Frozen
+    };
+    struct Move
+    {
+        int dst, src;
+    };
+
+    int K = 0;
+    std::vector<std::string> regs;
+    std::vector<NodeState> state;
+    std::vector<VRegSet> adjSet;
+    std::vector<std::vector<int>> adjList;
+    std::vector<int> degree;
+    std::vector<int> alias;
+    std::vector<int> color;
+    std::vector<double> cost;
+    std::vector<double> callCost;      // saves and restores around the calls a node is live across
+    std::vector<uint32_t> callClobbers;
+    std::vector<char> inMemory;        // stack arguments and parameters kept in place (no node)
+    bool preservesSaved;               // the function saves the callee-saved registers it uses
+    std::vector<char> remat;
+    std::vector<std::vector<int>> moveList;
+    std::vector<Move> moves;
+    std::vector<MoveState> moveState;
+    std::set<int> simplifyWorklist, freezeWorklist, spillWorklist;
+    std::set<int> worklistMoves, activeMoves;
+    std::vector<int> selectStack;
+
+    void build(const IRFunction &func, const std::vector<LiveInterval> &intervals);
+    void addEdge(int u, int v);
+    template <typename F>
+    void forEachAdjacent(int n, F f) const;
+    template <typename F>
+    void forEachNodeMove(int n, F f) const;
+    bool moveRelated(int n) const;
+    void makeWorklist();
+    void simplify();
+    void decrementDegree(int m);
+    void enableMoves(int n);
+    void coalesce();
+    void addWorklist(int u);
+    bool conservative(int u, int v) const;
+    int getAlias(int n) const;
+    void combine(int u, int v);
+    void freeze();
+    void freezeMoves(int u);
+    void selectSpill();
+    void assignColors();
+
+public:
+    // preserves: false for a function with a convention of its own, whose
+    // s registers cost its callers rather than its prologue
+    explicit GraphColoringAllocator(bool preserves = true) : preservesSaved(preserves) {}
+
+    RegisterAssignment allocate(const IRFunction &func,
+                                const std::map<std::string, CallingConvention> *conventions = nullptr);
+};
+
+// Whole-program allocation with one allocator ("graph", "linear" or "stack").
+//
+// In interprocedural mode functions are allocated callees first, and every
+// function except main that is not on a call-graph cycle gets a convention
+// of its own: each parameter arrives in the register allocated to it, and
+// its clobber set is exactly what it and its callees write. Callers then
+// save only those registers and steer values live across the call into
+// the others. main and recursive functions keep ILP32.
+class ProgramAllocator
+{
+private:
+    std::string allocator;
+    bool interprocedural;
+    bool slotColoring;
+    std::map<std::string, CallingConvention> conventionMap;
+
+    // ownConvention: func gets a convention of its own and saves no s registers
+    RegisterAssignment allocateFunction(const IRFunction &func, bool ownConvention = false);
+    CallingConvention conventionFor(const IRFunction &func, const RegisterAssignment &assignment) const;
+
+public:
+    ProgramAllocator(const std::string &name, bool ipra, bool colorSlots = true)
+        : allocator(name), interprocedural(ipra), slotColoring(colorSlots)
+    {
+    }
+    // One assignment per function, in program order
+    std::vector<RegisterAssignment> allocate(const IRProgram &program);
+    // Custom conventions of the last allocate(); empty unless interprocedural
+    const std::map<std::string, CallingConvention> &conventions() const { return conventionMap; }
+};
+
+// Stack-slot coloring: slots whose vregs are never live at the same time are
+// merged, first fit in slot order. A copy's source does not conflict with
+// its destination, so both can end up in one slot and the copy disappears.
+// Records the old count in unsharedSlots.
+void colorStackSlots(const IRFunction &func, RegisterAssignment &assignment);
+
+// Copies whose source and destination share a register or slot, and so emit nothing
+int countEliminatedMoves(const IRFunction &func, const RegisterAssignment &assignment);
+
+// Per-function table of spills and eliminated moves under the linear-scan
+// and graph-coloring allocators
+void reportAllocators(std::ostream &out, const IRProgram &program);
@@ -0,0 +1,320 @@
+#include "SSA.h"
+#include "IRAnalysis.h"
+#include <map>
+#include <set>
+
+namespace
+{
+    class SSARenamer
+    {
+    public:
+        IRFunction &func;
+        const DominatorTree &dom;
+        std::vector<char> renamed;                 // vreg needs renaming
+        std::vector<std::vector<int>> stacks;      // current names of each renamed vreg
+        std::vector<std::vector<int>> phiVars;     // original vreg of each phi, per block
+        int undefValue = -1;
+
+        SSARenamer(IRFunction &f, const DominatorTree &d) : func(f), dom(d) {}
+
+        int current(int var)
+        {
+            if (!stacks[var].empty())
+            {
+                return stacks[var].back();
+            }
+            // Read before any definition: use a zero defined at the entry
+            if (undefValue < 0)
+            {
+                undefValue = func.newVReg();
+                IRInst zero;
+                zero.op = IROp::Const;
+                zero.dst = undefValue;
+                auto &entry = func.blocks[0].insts;
+                size_t at = 0;
+                while (at < entry.size() && entry[at].op == IROp::Phi)
+                    at++;
+                entry.insert(entry.begin() + at, zero);
+            }
+            return undefValue;
+        }
+
+        void rename(int block)
+        {
+            std::vector<int> pushed;
+            size_t phiIndex = 0;
+            for (auto &inst : func.blocks[block].insts)
+            {
+                if (inst.op == IROp::Phi)
+                {
+                    int var = phiVars[block][phiIndex++];
+                    int name = func.newVReg(func.vregNames[var]);
+                    inst.dst = name;
+                    stacks[var].push_back(name);
+                    pushed.push_back(var);
+                    continue;
+                }
+                inst.forEachUse([&](int &v) {
+                    if (v < static_cast<int>(renamed.size()) && renamed[v])
+                        v = current(v);
+                });
+                if (inst.dst >= 0 && inst.dst < static_cast<int>(renamed.size()) && renamed[inst.dst])
+                {
+                    int var = inst.dst;
+                    int name = func.newVReg(func.vregNames[var]);
+                    inst.dst = name;
+                    stacks[var].push_back(name);
+                    pushed.push_back(var);
+                }
+            }
+            for (int succ : func.blocks[block].succs)
+            {
+                size_t k = 0;
+                for (auto &inst : func.blocks[succ].insts)
+                {
+                    if (inst.op != IROp::Phi)
+                        break;
+                    int var = phiVars[succ][k++];
+                    for (size_t i = 0; i < inst.phiBlocks.size(); i++)
+                    {
+                        if (inst.phiBlocks[i] == block)
+                        {
+                            inst.args[i] = current(var);
+                        }
+                    }
+                }
+            }
+            for (int child : dom.children[block])
+            {
+                rename(child);
+            }
+            for (auto it = pushed.rbegin(); it != pushed.rend(); ++it)
+            {
+                stacks[*it].pop_back();
+            }
+        }
+    };
+}
+
+void constructSSA(IRFunction &func)
+{
+    if (func.isSSA || func.blocks.empty())
+    {
+        return;
+    }
+    func.computeCFG();
+    DominatorTree dom(func);
+    Liveness live(func);
+    int numVars = func.numVRegs();
+
+    // Definition sites; parameters are defined on entry
+    std::vector<int> defCount(numVars, 0);
+    std::vector<std::set<int>> defBlocks(numVars);
+    for (int param : func.params)
+    {
+        defCount[param]++;
+        defBlocks[param].insert(0);
+    }
+    for (const auto &block : func.blocks)
+    {
+        for (const auto &inst : block.insts)
+        {
+            if (inst.dst >= 0)
+            {
+                defCount[inst.dst]++;
+                defBlocks[inst.dst].insert(block.id);
+            }
+        }
+    }
+
+    SSARenamer renamer(func, dom);
+    renamer.renamed.assign(numVars, 0);
+    renamer.stacks.assign(numVars, {});
+    renamer.phiVars.assign(func.blocks.size(), {});
+    for (int var = 0; var < numVars; var++)
+    {
+        if (defCount[var] < 2)
+        {
+            continue;
+        }
+        renamer.renamed[var] = 1;
+        std::vector<int> worklist(defBlocks[var].begin(), defBlocks[var].end());
+        std::set<int> hasPhi;
+        std::set<int> queued(defBlocks[var].begin(), defBlocks[var].end());
+        while (!worklist.empty())
+        {
+            int block = worklist.back();
+            worklist.pop_back();
+            for (int df : dom.frontier[block])
+            {
+                if (hasPhi.count(df) || !live.liveIn[df].test(var))
+                {
+                    continue;
+                }
+                hasPhi.insert(df);
+                IRInst phi;
+                phi.op = IROp::Phi;
+                phi.dst = var;
+                phi.pos = func.blocks[df].insts.empty() ? SourcePos() : func.blocks[df].insts.front().pos;
+                for (int pred : func.blocks[df].preds)
+                {
+                    phi.args.push_back(var);
+                    phi.phiBlocks.push_back(pred);
+                }
+                auto &insts = func.blocks[df].insts;
+                size_t at = renamer.phiVars[df].size();
+                insts.insert(insts.begin() + at, phi);
+                renamer.phiVars[df].push_back(var);
+                if (queued.insert(df).second)
+                {
+                    worklist.push_back(df);
+                }
+            }
+        }
+    }
+    for (int param : func.params)
+    {
+        if (renamer.renamed[param])
+        {
+            renamer.stacks[param].push_back(param); // the incoming value keeps its vreg
+        }
+    }
+    renamer.rename(0);
+    func.isSSA = true;
+}
+
+// Emit copies dst[i] = src[i] as if performed simultaneously
+static void sequentializeCopies(IRFunction &func, std::vector<std::pair<int, int>> copies, std::vector<IRInst> &out,
+                                const SourcePos &pos)
+{
+    auto emitCopy = [&](int dst, int src) {
+        IRInst copy;
+        copy.op = IROp::Copy;
+        copy.dst = dst;
+        copy.a = src;
+        copy.pos = pos;
+        out.push_back(copy);
+    };
+    std::vector<std::pair<int, int>> pending;
+    for (auto &copy : copies)
+    {
+        if (copy.first != copy.second)
+            pending.push_back(copy);
+    }
+    while (!pending.empty())
+    {
+        bool progress = false;
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            int dst = pending[i].first;
+            bool dstIsSource = false;
+            for (size_t j = 0; j < pending.size(); j++)
+            {
+                if (j != i && pending[j].second == dst)
+                {
+                    dstIsSource = true;
+                    break;
+                }
+            }
+            if (!dstIsSource)
+            {
+                emitCopy(dst, pending[i].second);
+                pending.erase(pending.begin() + i);
+                progress = true;
+                break;
+            }
+        }
+        if (!progress)
+        {
+            // Every destination is still needed as a source: break the cycle
+            int dst = pending[0].first;
+            int temp = func.newVReg();
+            emitCopy(temp, dst);
+            for (auto &copy : pending)
+            {
+                if (copy.second == dst)
+                    copy.second = temp;
+            }
+        }
+    }
+}
+
+void destructSSA(IRFunction &func)
+{
+    if (!func.isSSA)
+    {
+        return;
+    }
+    func.computeCFG();
+    // Split critical edges leading to blocks with phis
+    size_t originalBlocks = func.blocks.size();
+    for (size_t b = 0; b < originalBlocks; b++)
+    {
+        if (func.blocks[b].insts.empty() || func.blocks[b].insts.front().op != IROp::Phi ||
+            func.blocks[b].preds.size() < 2)
+        {
+            continue;
+        }
+        std::vector<int> preds = func.blocks[b].preds;
+        for (int pred : preds)
+        {
+            if (func.blocks[pred].succs.size() < 2)
+            {
+                continue;
+            }
+            int split = func.newBlock();
+            IRInst jump;
+            jump.op = IROp::Jump;
+            jump.target = static_cast<int>(b);
+            jump.pos = func.blocks[pred].terminator().pos;
+            func.blocks[split].insts.push_back(jump);
+            IRInst &term = func.blocks[pred].terminator();
+            if (term.target == static_cast<int>(b))
+                term.target = split;
+            if (term.elseTarget == static_cast<int>(b))
+                term.elseTarget = split;
+            for (auto &inst : func.blocks[b].insts)
+            {
+                if (inst.op != IROp::Phi)
+                    break;
+                for (auto &from : inst.phiBlocks)
+                {
+                    if (from == pred)
+                        from = split;
+                }
+            }
+        }
+    }
+    func.computeCFG();
+
+    for (auto &block : func.blocks)
+    {
+        size_t phiCount = 0;
+        while (phiCount < block.insts.size() && block.insts[phiCount].op == IROp::Phi)
+        {
+            phiCount++;
+        }
+        if (phiCount == 0)
+        {
+            continue;
+        }
+        std::map<int, std::vector<std::pair<int, int>>> copiesByPred;
+        for (size_t i = 0; i < phiCount; i++)
+        {
+            const IRInst &phi = block.insts[i];
+            for (size_t k = 0; k < phi.args.size(); k++)
+            {
+                copiesByPred[phi.phiBlocks[k]].push_back({phi.dst, phi.args[k]});
+            }
+        }
+        for (auto &[pred, copies] : copiesByPred)
+        {
+            auto &predInsts = func.blocks[pred].insts;
+            std::vector<IRInst> sequence;
+            sequentializeCopies(func, copies, sequence, predInsts.back().pos);
+            predInsts.insert(predInsts.end() - 1, sequence.begin(), sequence.end());
+        }
+        block.insts.erase(block.insts.begin(), block.insts.begin() + phiCount);
+    }
+    func.isSSA = false;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "IR.h"
+
+// Convert a function to pruned SSA form: phis are placed on the iterated
+// dominance frontier of the definitions of every multiply-assigned vreg,
+// only where the vreg is live, and all definitions are renamed.
+void constructSSA(IRFunction &func);
+
+// Leave SSA form: critical edges into phi blocks are split and every phi
+// becomes a parallel copy at the end of each predecessor, sequentialized
+// with a temporary when the copies form a cycle.
+void destructSSA(IRFunction &func);
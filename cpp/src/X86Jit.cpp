@@ -0,0 +1,543 @@
+#include "X86Jit.h"
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define TOYC_JIT_SUPPORTED 1
+#endif
+
+// Stack used while running main: 256 MiB, reserved lazily by the kernel
+static constexpr size_t JIT_STACK_BYTES = size_t(256) << 20;
+
+void X86Jit::imm32(int32_t value)
+{
+    uint32_t v = static_cast<uint32_t>(value);
+    bytes({uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24)});
+}
+
+int X86Jit::newLabel()
+{
+    labels.emplace_back();
+    return static_cast<int>(labels.size() - 1);
+}
+
+void X86Jit::bind(int label)
+{
+    labels[label].target = static_cast<int64_t>(code.size());
+}
+
+void X86Jit::jumpTo(std::initializer_list<uint8_t> opcode, int label)
+{
+    bytes(opcode);
+    labels[label].patches.push_back(code.size());
+    imm32(0);
+}
+
+void X86Jit::loadLocal(int32_t disp)
+{
+    bytes({0x8B, 0x85}); // mov eax, [rbp+disp32]
+    imm32(disp);
+}
+
+void X86Jit::storeLocal(int32_t disp)
+{
+    bytes({0x89, 0x85}); // mov [rbp+disp32], eax
+    imm32(disp);
+}
+
+int32_t X86Jit::lookup(const std::string &name) const
+{
+    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
+    {
+        auto found = it->find(name);
+        if (found != it->end())
+        {
+            return found->second;
+        }
+    }
+    throw std::runtime_error("Undefined variable: " + name);
+}
+
+namespace
+{
+    // Second opcode byte of setcc (0F 9x) and jcc rel32 (0F 8x) share the low nibble
+    uint8_t conditionCode(BinOp op, bool negate)
+    {
+        switch (op)
+        {
+        case BinOp::Lt:
+            return negate ? 0xD : 0xC;
+        case BinOp::Ge:
+            return negate ? 0xC : 0xD;
+        case BinOp::Gt:
+            return negate ? 0xE : 0xF;
+        case BinOp::Le:
+            return negate ? 0xF : 0xE;
+        case BinOp::Eq:
+            return negate ? 0x5 : 0x4;
+        case BinOp::Ne:
+            return negate ? 0x4 : 0x5;
+        default:
+            throw std::runtime_error("Not a comparison operator");
+        }
+    }
+
+    bool isComparison(BinOp op)
+    {
+        return op == BinOp::Lt || op == BinOp::Gt || op == BinOp::Le || op == BinOp::Ge || op == BinOp::Eq ||
+               op == BinOp::Ne;
+    }
+}
+
+void X86Jit::compileExpr(const Expr &expr)
+{
+    if (auto lit = dynamic_cast<const IntLit *>(&expr))
+    {
+        if (lit->value == 0)
+        {
+            bytes({0x31, 0xC0}); // xor eax, eax
+        }
+        else
+        {
+            byte(0xB8); // mov eax, imm32
+            imm32(lit->value);
+        }
+    }
+    else if (auto var = dynamic_cast<const Var *>(&expr))
+    {
+        loadLocal(lookup(var->name));
+    }
+    else if (auto bin = dynamic_cast<const BinOpExpr *>(&expr))
+    {
+        if (bin->op == BinOp::And || bin->op == BinOp::Or)
+        {
+            int falseLabel = newLabel();
+            int endLabel = newLabel();
+            compileCondJump(expr, false, falseLabel);
+            bytes({0xB8, 1, 0, 0, 0}); // mov eax, 1
+            jumpTo({0xE9}, endLabel);
+            bind(falseLabel);
+            bytes({0x31, 0xC0});
+            bind(endLabel);
+            return;
+        }
+        // Left operand in eax, right operand in ecx
+        compileExpr(*bin->left);
+        if (auto rightLit = dynamic_cast<const IntLit *>(bin->right.get()))
+        {
+            byte(0xB9); // mov ecx, imm32
+            imm32(rightLit->value);
+        }
+        else if (auto rightVar = dynamic_cast<const Var *>(bin->right.get()))
+        {
+            bytes({0x8B, 0x8D}); // mov ecx, [rbp+disp32]
+            imm32(lookup(rightVar->name));
+        }
+        else
+        {
+            byte(0x50); // push rax
+            compileExpr(*bin->right);
+            bytes({0x89, 0xC1}); // mov ecx, eax
+            byte(0x58);          // pop rax
+        }
+        switch (bin->op)
+        {
+        case BinOp::Add:
+            bytes({0x01, 0xC8}); // add eax, ecx
+            break;
+        case BinOp::Sub:
+            bytes({0x29, 0xC8}); // sub eax, ecx
+            break;
+        case BinOp::Mul:
+            bytes({0x0F, 0xAF, 0xC1}); // imul eax, ecx
+            break;
+        case BinOp::Div:
+        case BinOp::Mod:
+        {
+            // idiv traps on x/0 and INT_MIN/-1, handle both like RISC-V
+            bool isDiv = bin->op == BinOp::Div;
+            int zeroLabel = newLabel();
+            int minusOneLabel = newLabel();
+            int endLabel = newLabel();
+            bytes({0x85, 0xC9}); // test ecx, ecx
+            jumpTo({0x0F, 0x84}, zeroLabel);
+            bytes({0x83, 0xF9, 0xFF}); // cmp ecx, -1
+            jumpTo({0x0F, 0x84}, minusOneLabel);
+            byte(0x99);          // cdq
+            bytes({0xF7, 0xF9}); // idiv ecx
+            if (!isDiv)
+            {
+                bytes({0x89, 0xD0}); // mov eax, edx
+            }
+            jumpTo({0xE9}, endLabel);
+            bind(minusOneLabel);
+            if (isDiv)
+            {
+                bytes({0xF7, 0xD8}); // neg eax
+            }
+            else
+            {
+                bytes({0x31, 0xC0});
+            }
+            jumpTo({0xE9}, endLabel);
+            bind(zeroLabel);
+            if (isDiv)
+            {
+                bytes({0xB8, 0xFF, 0xFF, 0xFF, 0xFF}); // mov eax, -1
+            }
+            bind(endLabel);
+            break;
+        }
+        default:
+            bytes({0x39, 0xC8});                            // cmp eax, ecx
+            bytes({0x0F, uint8_t(0x90 | conditionCode(bin->op, false)), 0xC0}); // setcc al
+            bytes({0x0F, 0xB6, 0xC0});                      // movzx eax, al
+            break;
+        }
+    }
+    else if (auto un = dynamic_cast<const UnOpExpr *>(&expr))
+    {
+        compileExpr(*un->right);
+        if (un->op == UnOp::Neg)
+        {
+            bytes({0xF7, 0xD8}); // neg eax
+        }
+        else
+        {
+            bytes({0x85, 0xC0});       // test eax, eax
+            bytes({0x0F, 0x94, 0xC0}); // sete al
+            bytes({0x0F, 0xB6, 0xC0}); // movzx eax, al
+        }
+    }
+    else if (auto call = dynamic_cast<const Call *>(&expr))
+    {
+        auto it = funcLabels.find(call->name);
+        if (it == funcLabels.end())
+        {
+            throw std::runtime_error("Call to undefined function: " + call->name);
+        }
+        if (funcParams.at(call->name) != call->args.size())
+        {
+            throw std::runtime_error("Wrong number of arguments in call to " + call->name);
+        }
+        // Push the last argument first so argument i ends up at [rbp+16+8*i]
+        for (size_t i = call->args.size(); i-- > 0;)
+        {
+            compileExpr(*call->args[i]);
+            byte(0x50); // push rax
+        }
+        jumpTo({0xE8}, it->second); // call rel32
+        if (!call->args.empty())
+        {
+            bytes({0x48, 0x81, 0xC4}); // add rsp, imm32
+            imm32(static_cast<int32_t>(8 * call->args.size()));
+        }
+    }
+    else
+    {
+        throw std::runtime_error("Unknown expression type in JIT");
+    }
+}
+
+void X86Jit::compileCondJump(const Expr &expr, bool jumpIfTrue, int label)
+{
+    if (auto lit = dynamic_cast<const IntLit *>(&expr))
+    {
+        if ((lit->value != 0) == jumpIfTrue)
+        {
+            jumpTo({0xE9}, label);
+        }
+        return;
+    }
+    if (auto un = dynamic_cast<const UnOpExpr *>(&expr); un && un->op == UnOp::Not)
+    {
+        compileCondJump(*un->right, !jumpIfTrue, label);
+        return;
+    }
+    if (auto bin = dynamic_cast<const BinOpExpr *>(&expr))
+    {
+        if (bin->op == BinOp::And || bin->op == BinOp::Or)
+        {
+            bool shortCircuitValue = bin->op == BinOp::Or;
+            if (jumpIfTrue == shortCircuitValue)
+            {
+                compileCondJump(*bin->left, jumpIfTrue, label);
+                compileCondJump(*bin->right, jumpIfTrue, label);
+            }
+            else
+            {
+                int skip = newLabel();
+                compileCondJump(*bin->left, !jumpIfTrue, skip);
+                compileCondJump(*bin->right, jumpIfTrue, label);
+                bind(skip);
+            }
+            return;
+        }
+        if (isComparison(bin->op))
+        {
+            compileExpr(*bin->left);
+            byte(0x50);
+            compileExpr(*bin->right);
+            bytes({0x89, 0xC1});
+            byte(0x58);
+            bytes({0x39, 0xC8}); // cmp eax, ecx
+            jumpTo({0x0F, uint8_t(0x80 | conditionCode(bin->op, !jumpIfTrue))}, label);
+            return;
+        }
+    }
+    compileExpr(expr);
+    bytes({0x85, 0xC0}); // test eax, eax
+    jumpTo({0x0F, uint8_t(jumpIfTrue ? 0x85 : 0x84)}, label);
+}
+
+void X86Jit::compileStmt(const Stmt &stmt)
+{
+    if (auto block = dynamic_cast<const Block *>(&stmt))
+    {
+        int saved = nextSlot;
+        scopes.emplace_back();
+        for (const auto &s : block->stmts)
+        {
+            compileStmt(*s);
+        }
+        scopes.pop_back();
+        nextSlot = saved; // slots of the block's locals are reused
+    }
+    else if (dynamic_cast<const EmptyStmt *>(&stmt))
+    {
+    }
+    else if (auto exprStmt = dynamic_cast<const ExprStmt *>(&stmt))
+    {
+        if (!dynamic_cast<const Var *>(exprStmt->expr.get()) && !dynamic_cast<const IntLit *>(exprStmt->expr.get()))
+        {
+            compileExpr(*exprStmt->expr);
+        }
+    }
+    else if (auto assign = dynamic_cast<const Assign *>(&stmt))
+    {
+        compileExpr(*assign->value);
+        storeLocal(lookup(assign->name));
+    }
+    else if (auto decl = dynamic_cast<const Decl *>(&stmt))
+    {
+        // The initializer still sees an outer variable of the same name
+        if (decl->value)
+        {
+            compileExpr(*decl->value);
+        }
+        else
+        {
+            bytes({0x31, 0xC0});
+        }
+        int32_t disp = -8 * (++nextSlot);
+        maxSlot = std::max(maxSlot, nextSlot);
+        scopes.back()[decl->name] = disp;
+        storeLocal(disp);
+    }
+    else if (auto ifStmt = dynamic_cast<const If *>(&stmt))
+    {
+        int elseLabel = newLabel();
+        compileCondJump(*ifStmt->condition, false, elseLabel);
+        compileStmt(*ifStmt->thenBody);
+        if (ifStmt->elseBody)
+        {
+            int endLabel = newLabel();
+            jumpTo({0xE9}, endLabel);
+            bind(elseLabel);
+            compileStmt(*ifStmt->elseBody);
+            bind(endLabel);
+        }
+        else
+        {
+            bind(elseLabel);
+        }
+    }
+    else if (auto whileStmt = dynamic_cast<const While *>(&stmt))
+    {
+        // jmp cond; body: ...; cond: jcc body; end:
+        int bodyLabel = newLabel();
+        int condLabel = newLabel();
+        int endLabel = newLabel();
+        jumpTo({0xE9}, condLabel);
+        bind(bodyLabel);
+        loops.push_back({endLabel, condLabel});
+        compileStmt(*whileStmt->body);
+        loops.pop_back();
+        bind(condLabel);
+        compileCondJump(*whileStmt->condition, true, bodyLabel);
+        bind(endLabel);
+    }
+    else if (dynamic_cast<const Break *>(&stmt))
+    {
+        if (loops.empty())
+        {
+            throw std::runtime_error("Break statement not within a loop");
+        }
+        jumpTo({0xE9}, loops.back().breakLabel);
+    }
+    else if (dynamic_cast<const Continue *>(&stmt))
+    {
+        if (loops.empty())
+        {
+            throw std::runtime_error("Continue statement not within a loop");
+        }
+        jumpTo({0xE9}, loops.back().continueLabel);
+    }
+    else if (auto ret = dynamic_cast<const Return *>(&stmt))
+    {
+        if (ret->returnValue)
+        {
+            compileExpr(*ret->returnValue);
+        }
+        else
+        {
+            bytes({0x31, 0xC0});
+        }
+        jumpTo({0xE9}, returnLabel);
+    }
+    else
+    {
+        throw std::runtime_error("Unknown statement type in JIT");
+    }
+}
+
+void X86Jit::compileFunc(const FuncDef &func)
+{
+    bind(funcLabels.at(func.name));
+    byte(0x55);                // push rbp
+    bytes({0x48, 0x89, 0xE5}); // mov rbp, rsp
+    bytes({0x48, 0x81, 0xEC}); // sub rsp, imm32 (patched below)
+    size_t frameSizeAt = code.size();
+    imm32(0);
+
+    scopes.clear();
+    scopes.emplace_back();
+    for (size_t i = 0; i < func.args.size(); i++)
+    {
+        scopes.back()[func.args[i]] = static_cast<int32_t>(16 + 8 * i);
+    }
+    nextSlot = 0;
+    maxSlot = 0;
+    returnLabel = newLabel();
+    if (func.body)
+    {
+        compileStmt(*func.body);
+    }
+    bytes({0x31, 0xC0}); // falling off the end returns 0
+    bind(returnLabel);
+    byte(0xC9); // leave
+    byte(0xC3); // ret
+
+    int32_t frameSize = (maxSlot * 8 + 15) & ~15;
+    std::memcpy(&code[frameSizeAt], &frameSize, 4);
+}
+
+void X86Jit::release()
+{
+#ifdef TOYC_JIT_SUPPORTED
+    if (memory)
+    {
+        munmap(memory, memorySize);
+    }
+    if (stackMemory)
+    {
+        munmap(stackMemory, stackSize);
+    }
+#endif
+    memory = nullptr;
+    stackMemory = nullptr;
+}
+
+size_t X86Jit::compile(const Program &program)
+{
+#ifndef TOYC_JIT_SUPPORTED
+    (void)program;
+    throw std::runtime_error("The JIT is only available on x86-64 Linux hosts");
+#else
+    release();
+    code.clear();
+    labels.clear();
+    funcLabels.clear();
+    funcParams.clear();
+    loops.clear();
+    for (const auto &func : program.functions)
+    {
+        funcLabels[func->name] = newLabel();
+        funcParams[func->name] = func->args.size();
+    }
+    if (!funcLabels.count("main"))
+    {
+        throw std::runtime_error("Program has no main function");
+    }
+    for (const auto &func : program.functions)
+    {
+        compileFunc(*func);
+    }
+
+    // Entry stub: int entry(void *stackTop) switches to the JIT stack and calls main
+    entryOffset = code.size();
+    byte(0x53);                // push rbx
+    bytes({0x48, 0x89, 0xE3}); // mov rbx, rsp
+    bytes({0x48, 0x89, 0xFC}); // mov rsp, rdi
+    jumpTo({0xE8}, funcLabels.at("main"));
+    bytes({0x48, 0x89, 0xDC}); // mov rsp, rbx
+    byte(0x5B);                // pop rbx
+    byte(0xC3);                // ret
+
+    for (const auto &label : labels)
+    {
+        for (size_t at : label.patches)
+        {
+            if (label.target < 0)
+            {
+                throw std::runtime_error("Unbound label in JIT code");
+            }
+            int32_t rel = static_cast<int32_t>(label.target - static_cast<int64_t>(at + 4));
+            std::memcpy(&code[at], &rel, 4);
+        }
+    }
+
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    memorySize = (code.size() + page - 1) / page * page;
+    memory = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        memory = nullptr;
+        throw std::runtime_error("mmap failed for JIT code");
+    }
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, memorySize, PROT_READ | PROT_EXEC) != 0)
+    {
+        throw std::runtime_error("mprotect failed for JIT code");
+    }
+    return code.size();
+#endif
+}
+
+JitResult X86Jit::run(const Program &program)
+{
+    JitResult result;
+    auto start = std::chrono::steady_clock::now();
+    result.codeBytes = compile(program);
+    auto compiled = std::chrono::steady_clock::now();
+#ifdef TOYC_JIT_SUPPORTED
+    stackSize = JIT_STACK_BYTES;
+    stackMemory = mmap(nullptr, stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stackMemory == MAP_FAILED)
+    {
+        stackMemory = nullptr;
+        throw std::runtime_error("mmap failed for JIT stack");
+    }
+    using EntryFn = int32_t (*)(void *);
+    auto entry = reinterpret_cast<EntryFn>(static_cast<uint8_t *>(memory) + entryOffset);
+    auto running = std::chrono::steady_clock::now();
+    result.value = entry(static_cast<uint8_t *>(stackMemory) + stackSize);
+    auto finished = std::chrono::steady_clock::now();
+    result.compileMs = std::chrono::duration<double, std::milli>(compiled - start).count();
+    result.runMs = std::chrono::duration<double, std::milli>(finished - running).count();
+#endif
+    return result;
+}
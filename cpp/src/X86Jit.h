@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include "ASTNode.h"
+
+// Host-native execution: compiles every FuncDef to x86-64 machine code in
+// mmap'd executable memory and runs main directly. Only available on
+// x86-64 Linux; elsewhere compile() throws.
+//
+// Code shape (internal convention, never called from C except via the entry
+// stub): values are computed in eax, temporaries are pushed on the machine
+// stack, locals live in 8-byte slots below rbp. The caller pushes arguments
+// so that argument i is at [rbp+16+8*i] in the callee, and pops them after
+// the call. Arithmetic wraps at 32 bits and div/rem follow RISC-V semantics
+// like the bytecode VM. main runs on a separate large stack so deep
+// recursion does not overflow the host thread's stack.
+struct JitResult
+{
+    int32_t value = 0;
+    double compileMs = 0; // AST to executable memory
+    double runMs = 0;
+    size_t codeBytes = 0;
+};
+
+class X86Jit
+{
+private:
+    struct Label
+    {
+        int64_t target = -1;               // offset in code, -1 until bound
+        std::vector<size_t> patches;       // rel32 fields referring to it
+    };
+    struct LoopLabels
+    {
+        int breakLabel;
+        int continueLabel;
+    };
+
+    std::vector<uint8_t> code;
+    std::vector<Label> labels;
+    std::map<std::string, int> funcLabels;
+    std::map<std::string, size_t> funcParams;
+    std::vector<std::map<std::string, int32_t>> scopes; // name -> rbp displacement
+    std::vector<LoopLabels> loops;
+    int nextSlot = 0;
+    int maxSlot = 0;
+    int returnLabel = -1;
+    size_t entryOffset = 0;
+
+    void *memory = nullptr;
+    size_t memorySize = 0;
+    void *stackMemory = nullptr;
+    size_t stackSize = 0;
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void bytes(std::initializer_list<uint8_t> bs) { code.insert(code.end(), bs); }
+    void imm32(int32_t value);
+    int newLabel();
+    void bind(int label);
+    void jumpTo(std::initializer_list<uint8_t> opcode, int label); // opcode followed by rel32
+    void loadLocal(int32_t disp);  // mov eax, [rbp+disp]
+    void storeLocal(int32_t disp); // mov [rbp+disp], eax
+    int32_t lookup(const std::string &name) const;
+
+    void compileExpr(const Expr &expr); // result in eax
+    void compileCondJump(const Expr &expr, bool jumpIfTrue, int label);
+    void compileStmt(const Stmt &stmt);
+    void compileFunc(const FuncDef &func);
+    void release();
+
+public:
+    X86Jit() = default;
+    X86Jit(const X86Jit &) = delete;
+    X86Jit &operator=(const X86Jit &) = delete;
+    ~X86Jit() { release(); }
+
+    // Translate the program and map it executable; returns the code size
+    size_t compile(const Program &program);
+    // Compile and run main, timing both steps
+    JitResult run(const Program &program);
+};
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -5,31 +6,361 @@
 #include "Generator.h"
 #include "ASTNode.h"
 #include "ASTParser.h"
+#include "CodegenStats.h"
+#include "Profile.h"
+#include "BytecodeVM.h"
+#include "X86Jit.h"
+#include "CodeCache.h"
+#include "IR.h"
+#include "IRBuilder.h"
+#include "IREmitter.h"
+#include "PassManager.h"
+#include "RegAlloc.h"
+#include "Assembler.h"
+#include <sstream>
+#include <iomanip>
+
+static void printUsage(const char *prog)
+{
+    std::cerr << "Usage: " << prog << " [options] < input.ast > output.s\n"
+              << "Options:\n"
+              << "  --stats <file>   write per-function codegen statistics to <file> ('-' for stderr)\n"
+              << "  -g               emit .file/.loc directives from the AST source positions\n"
+              << "  --source <name>  source file name used by -g (default: code.tc)\n"
+              << "  --instrument     emit profile counters; the program writes them when main returns\n"
+              << "  --profile-path <file>  profile file written by --instrument (default: toyc.prof)\n"
+              << "  --profile-use <file>   use a profile for block layout and hot-call inlining\n"
+              << "  --run            run the program in the bytecode VM and print its result and step count\n"
+              << "  --step-limit <n> stop the VM after <n> instructions (default: no limit)\n"
+              << "  --dump-bytecode  print the bytecode to stderr before running\n"
+              << "  --cache-dir <dir>  reuse the assembly of unchanged functions from <dir>\n"
+              << "  --jit            compile to x86-64 in memory and run main natively (x86-64 Linux only)\n"
+              << "  -O0              generate code directly from the AST (default, fastest compile)\n"
+              << "  -O1              generate code through the IR with cheap cleanup passes\n"
+              << "  -O2              run the full SSA optimization pipeline on the IR\n"
+              << "  --passes <list>  comma separated IR pass pipeline, replacing the one of the -O level\n"
+              << "  --print-after-all      print the AST/IR to stderr after every pass\n"
+              << "  --print-after <pass>   print the AST/IR to stderr after <pass> (repeatable)\n"
+              << "  --time-passes    print per-pass time and change counts to stderr\n"
+              << "  --regalloc <graph|linear|stack>  IR register allocator (default: linear at -O1, graph at -O2)\n"
+              << "  --regalloc-report  print spills and eliminated moves of the linear and graph allocators\n"
+              << "  --no-slot-reuse  give every variable, spill and vreg its own stack slot (see --stats)\n"
+              << "  --no-if-convert  keep branches for two-way assignments and short-circuit && / ||\n"
+              << "  --no-peephole    skip the peephole optimizer on the emitted assembly (see --stats)\n"
+              << "  --ipra / --no-ipra  per-function calling conventions from whole-program allocation (default: on at -O2)\n"
+              << "  --emit-obj <file>  assemble in-process and write a relocatable RV32IM ELF object\n"
+              << "  --emit-exe <file>  assemble in-process and write a static RV32IM ELF executable\n"
+              << "  -march=rv32imc   use compressed (RVC) encodings wherever the operands fit (default: rv32im)\n";
+}
+
+int main(int argc, char *argv[]) {
+    std::string statsFile;
+    bool debugInfo = false;
+    std::string sourceName = "code.tc";
+    bool instrument = false;
+    std::string profilePath = "toyc.prof";
+    std::string profileUse;
+    bool runVM = false;
+    bool dumpBytecode = false;
+    bool runJit = false;
+    std::string cacheDir;
+    uint64_t stepLimit = 0;
+    int optLevel = 0;
+    bool customPasses = false;
+    std::vector<std::string> passList;
+    std::string regAlloc;
+    bool regAllocReport = false;
+    int interprocedural = -1; // -1: on at -O2
+    bool slotReuse = true;
+    bool ifConversion = true;
+    bool peephole = true;
+    bool timePasses = false;
+    PassManager passManager;
+    std::string objectFile;
+    bool executable = false;
+    bool compressed = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stats" && i + 1 < argc) {
+            statsFile = argv[++i];
+        } else if (arg == "-g") {
+            debugInfo = true;
+        } else if (arg == "--source" && i + 1 < argc) {
+            sourceName = argv[++i];
+        } else if (arg == "--instrument") {
+            instrument = true;
+        } else if (arg == "--profile-path" && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (arg == "--profile-use" && i + 1 < argc) {
+            profileUse = argv[++i];
+        } else if (arg == "--run") {
+            runVM = true;
+        } else if (arg == "--step-limit" && i + 1 < argc) {
+            stepLimit = std::stoull(argv[++i]);
+        } else if (arg == "--cache-dir" && i + 1 < argc) {
+            cacheDir = argv[++i];
+        } else if (arg == "--jit") {
+            runJit = true;
+        } else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            optLevel = arg[2] - '0';
+        } else if (arg == "--passes" && i + 1 < argc) {
+            customPasses = true;
+            passList.clear();
+            std::stringstream list(argv[++i]);
+            std::string name;
+            while (std::getline(list, name, ',')) {
+                if (!name.empty()) {
+                    passList.push_back(name);
+                }
+            }
+        } else if (arg == "--regalloc" && i + 1 < argc) {
+            regAlloc = argv[++i];
+            if (regAlloc != "graph" && regAlloc != "linear" && regAlloc != "stack") {
+                std::cerr << "Unknown register allocator: " << regAlloc << std::endl;
+                return 1;
+            }
+        } else if (arg == "--regalloc-report") {
+            regAllocReport = true;
+        } else if (arg == "--no-slot-reuse") {
+            slotReuse = false;
+        } else if (arg == "--no-peephole") {
+            peephole = false;
+        } else if (arg == "--no-if-convert") {
+            ifConversion = false;
+        } else if (arg == "--ipra" || arg == "--no-ipra") {
+            interprocedural = arg == "--ipra";
+        } else if (arg == "--print-after-all") {
+            passManager.setPrintAfterAll(true);
+        } else if (arg == "--print-after" && i + 1 < argc) {
+            passManager.addPrintAfter(argv[++i]);
+        } else if ((arg == "--emit-obj" || arg == "--emit-exe") && i + 1 < argc) {
+            objectFile = argv[++i];
+            executable = arg == "--emit-exe";
+        } else if (arg.rfind("-march=", 0) == 0) {
+            std::string march = arg.substr(7);
+            if (march != "rv32im" && march != "rv32imc") {
+                std::cerr << "Unsupported -march: " << march << std::endl;
+                return 1;
+            }
+            compressed = march == "rv32imc";
+        } else if (arg == "--time-passes") {
+            timePasses = true;
+        } else if (arg == "--dump-bytecode") {
+            dumpBytecode = true;
+        } else if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (instrument && !profileUse.empty()) {
+        std::cerr << "--instrument and --profile-use cannot be used together" << std::endl;
+        return 1;
+    }
+    // Profiles and the cache belong to the AST generator, register allocation to the IR emitter
+    bool irPath = optLevel > 0 || customPasses;
+    std::string unsupported;
+    if (irPath) {
+        if (instrument) {
+            unsupported = "--instrument";
+        } else if (!profileUse.empty()) {
+            unsupported = "--profile-use";
+        } else if (!cacheDir.empty()) {
+            unsupported = "--cache-dir";
+        }
+    } else {
+        if (!regAlloc.empty()) {
+            unsupported = "--regalloc";
+        } else if (interprocedural >= 0) {
+            unsupported = interprocedural ? "--ipra" : "--no-ipra";
+        } else if (regAllocReport) {
+            unsupported = "--regalloc-report";
+        }
+    }
+    if (!unsupported.empty()) {
+        std::cerr << unsupported << (irPath ? " is only supported at -O0" : " is only supported at -O1/-O2 or with --passes")
+                  << std::endl;
+        return 1;
+    }
 
-int main() {
     try {
         // Parse AST from stdin
         ASTParser parser(std::cin);
-        
-        auto program = parser.parse();
+
+        std::unique_ptr<Program> program;
+        passManager.timePhase("parse", [&] { program = parser.parse(); });
         if (!program) {
             std::cerr << "Failed to parse AST from stdin" << std::endl;
             return 1;
         }
         // Constant folding
-        auto foldedProgram = program->foldConstants();
+        auto foldedProgram = passManager.runProgramPass("fold", [&] { return program->foldConstants(); });
         if (!foldedProgram) {
             std::cerr << "Failed to fold constants in AST" << std::endl;
             return 1;
         }
-        // Generate assembly to stdout
-        Generator generator(std::cout);
-        generator.generateProg(*foldedProgram);
-        
+        if (runJit) {
+            // Run natively on the host
+            X86Jit jit;
+            JitResult result = jit.run(*foldedProgram);
+            std::cout << "result " << result.value << "\n";
+            std::cout << "code " << result.codeBytes << " bytes\n";
+            std::cout << "compile " << result.compileMs << " ms\n";
+            std::cout << "run " << result.runMs << " ms" << std::endl;
+            return 0;
+        }
+        if (runVM) {
+            // Run in the bytecode VM instead of emitting assembly
+            BytecodeCompiler compiler;
+            BytecodeProgram bytecode = compiler.compile(*foldedProgram);
+            if (dumpBytecode) {
+                bytecode.disassemble(std::cerr);
+            }
+            BytecodeVM vm;
+            VMResult result = vm.run(bytecode, stepLimit);
+            std::cout << "result " << result.value << "\n";
+            std::cout << "steps " << result.steps << std::endl;
+            return 0;
+        }
+        CodegenStats stats;
+        // With --emit-obj/--emit-exe or RVC the assembly stays in memory and is assembled in-process
+        std::ostringstream asmBuffer;
+        std::ostream &asmOut = objectFile.empty() && !compressed ? std::cout : asmBuffer;
+        if (optLevel > 0 || customPasses) {
+            // Lower to IR, optimize and emit from it
+            std::vector<std::string> pipeline = customPasses ? passList : PassManager::pipelineFor(optLevel);
+            if (!ifConversion) {
+                pipeline.erase(std::remove(pipeline.begin(), pipeline.end(), "ifconvert"), pipeline.end());
+            }
+            passManager.setPipeline(pipeline);
+            IRBuilder builder;
+            builder.setFlattenLogic(ifConversion);
+            IRProgram ir;
+            passManager.timePhase("irbuild", [&] { ir = builder.build(*foldedProgram); }, &ir);
+            passManager.run(ir);
+            passManager.timePhase("isel", [&] { selectImmediates(ir); }, &ir);
+            IREmitter emitter(asmOut);
+            emitter.setPeephole(peephole);
+            if (!statsFile.empty()) {
+                emitter.setStats(&stats);
+            }
+            if (debugInfo) {
+                emitter.setDebugInfo(sourceName);
+            }
+            if (regAlloc.empty()) {
+                regAlloc = optLevel >= 2 ? "graph" : "linear";
+            }
+            if (interprocedural < 0) {
+                interprocedural = optLevel >= 2;
+            }
+            ProgramAllocator allocator(regAlloc, interprocedural, slotReuse);
+            std::vector<RegisterAssignment> assignments;
+            passManager.timePhase("regalloc", [&] { assignments = allocator.allocate(ir); });
+            emitter.setConventions(&allocator.conventions());
+            if (regAllocReport) {
+                reportAllocators(std::cerr, ir);
+            }
+            passManager.timePhase("emit", [&] {
+                emitter.emitHeader();
+                for (size_t f = 0; f < ir.functions.size(); f++) {
+                    emitter.emitFunction(ir.functions[f], assignments[f]);
+                }
+            });
+        } else {
+            // Number profile counter sites on the folded AST
+            Profile profile;
+            profile.assignSites(*foldedProgram);
+            if (!profileUse.empty()) {
+                std::string error;
+                if (profile.load(profileUse, error)) {
+                    profile.inlineHotCalls(*foldedProgram);
+                } else {
+                    std::cerr << "Warning: " << error << ", ignoring profile" << std::endl;
+                }
+            }
+            // Generate assembly to stdout
+            Generator generator(asmOut);
+            if (!statsFile.empty()) {
+                generator.setStats(&stats);
+            }
+            if (debugInfo) {
+                generator.setDebugInfo(sourceName);
+            }
+            generator.setSlotReuse(slotReuse);
+            generator.setIfConversion(ifConversion);
+            generator.setPeephole(peephole);
+            if (instrument) {
+                generator.setInstrumentation(&profile, profilePath);
+            } else if (profile.loaded()) {
+                generator.setProfile(&profile);
+            }
+            // Profile counts and statistics are not part of the cache key
+            std::unique_ptr<CodeCache> cache;
+            if (!cacheDir.empty() && !instrument && !profile.loaded() && statsFile.empty()) {
+                std::string options = std::string("g=") + (debugInfo ? "1" : "0") + (slotReuse ? "" : ",no-slot-reuse") +
+                                      (ifConversion ? "" : ",no-if-convert") + (peephole ? "" : ",no-peephole");
+                cache = std::make_unique<CodeCache>(cacheDir, options, debugInfo);
+                generator.setCache(cache.get());
+            }
+            passManager.timePhase("codegen", [&] { generator.generateProg(*foldedProgram); });
+            if (cache) {
+                std::cerr << "cache: " << cache->hits() << " hit, " << cache->misses() << " miss" << std::endl;
+            } else if (!cacheDir.empty()) {
+                const char *reason = instrument ? "--instrument" : profile.loaded() ? "--profile-use" : "--stats";
+                std::cerr << "cache: not used with " << reason << std::endl;
+            }
+        }
+        if (!objectFile.empty() || compressed) {
+            auto outputKind = executable ? RiscvAssembler::OutputKind::Executable : RiscvAssembler::OutputKind::Object;
+            RiscvAssembler assembler(outputKind, compressed);
+            passManager.timePhase("assemble", [&] { assembler.assemble(asmBuffer.str()); });
+            if (objectFile.empty()) {
+                std::cout << assembler.compressedListing(asmBuffer.str());
+            } else {
+                std::ofstream objectOut(objectFile, std::ios::binary);
+                if (!objectOut) {
+                    std::cerr << "Failed to open output file: " << objectFile << std::endl;
+                    return 1;
+                }
+                assembler.write(objectOut);
+                std::cerr << "elf: " << assembler.instructions() << " instructions, text " << assembler.textSize()
+                          << " bytes, data " << assembler.dataSize() << " bytes, " << assembler.relaxedBranchCount()
+                          << " branches relaxed, " << assembler.relocationCount() << " relocations" << std::endl;
+            }
+            if (compressed) {
+                // Size of the same code without RVC, for the savings report
+                RiscvAssembler uncompressed(outputKind);
+                uncompressed.assemble(asmBuffer.str());
+                uint32_t before = uncompressed.textSize(), after = assembler.textSize();
+                std::cerr << "rvc: " << assembler.compressedInstructions() << " of " << assembler.instructions()
+                          << " instructions compressed, text " << before << " -> " << after << " bytes (saved "
+                          << before - after << " bytes, " << std::fixed << std::setprecision(1)
+                          << (before ? 100.0 * (before - after) / before : 0.0) << "%)" << std::endl;
+            }
+        }
+        if (timePasses) {
+            passManager.report(std::cerr);
+        }
+
+        if (statsFile == "-") {
+            stats.report(std::cerr);
+        } else if (!statsFile.empty()) {
+            std::ofstream statsOut(statsFile);
+            if (!statsOut) {
+                std::cerr << "Failed to open stats file: " << statsFile << std::endl;
+                return 1;
+            }
+            stats.report(statsOut);
+        }
+
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
-    
+
     return 0;
-}
\ No newline at end of file
+}
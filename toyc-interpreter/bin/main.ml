@@ -3,10 +3,19 @@ open Ast
 
 
 (* ===== Structured Print Helpers ===== *)
+
+(* When set by --loc, node header lines carry a " @line:col" suffix *)
+let print_loc = ref false
+
+let loc_suffix loc =
+  if !print_loc then Printf.sprintf " @%d:%d" loc.line loc.col else ""
+;;
+
 let rec print_expr indent expr =
-  match expr with
-  | IntLit i -> Printf.printf "%sIntLit(%d)\n" indent i
-  | Var name -> Printf.printf "%sVar(%s)\n" indent name
+  let at = loc_suffix expr.eloc in
+  match expr.edesc with
+  | IntLit i -> Printf.printf "%sIntLit(%d)%s\n" indent i at
+  | Var name -> Printf.printf "%sVar(%s)%s\n" indent name at
   | Binop (e1, op, e2) ->
     let op_str =
       match op with
@@ -24,7 +33,7 @@ let rec print_expr indent expr =
       | And -> "&&"
       | Or -> "||"
     in
-    Printf.printf "%sBinop\n" indent;
+    Printf.printf "%sBinop%s\n" indent at;
     Printf.printf "%s  Operator %s\n" indent op_str;
     Printf.printf "%s  Left\n" indent;
     print_expr (indent ^ "    ") e1;
@@ -36,10 +45,10 @@ let rec print_expr indent expr =
       | Neg -> "-"
       | Not -> "!"
     in
-    Printf.printf "%sUnop(%s)\n" indent op_str;
+    Printf.printf "%sUnop(%s)%s\n" indent op_str at;
     print_expr (indent ^ "  ") e
   | Call (fname, args) ->
-    Printf.printf "%sCall(%s)\n" indent fname;
+    Printf.printf "%sCall(%s)%s\n" indent fname at;
     List.iteri
       (fun i arg ->
          Printf.printf "%s  Arg[%d]\n" indent i;
@@ -48,18 +57,19 @@ let rec print_expr indent expr =
 ;;
 
 let rec print_stmt indent stmt =
-  match stmt with
+  let at = loc_suffix stmt.sloc in
+  match stmt.sdesc with
   | Block stmts ->
-    Printf.printf "%sBlock\n" indent;
+    Printf.printf "%sBlock%s\n" indent at;
     List.iter (print_stmt (indent ^ "  ")) stmts
   | Assign (var, expr) ->
-    Printf.printf "%sAssign(%s)\n" indent var;
+    Printf.printf "%sAssign(%s)%s\n" indent var at;
     print_expr (indent ^ "  ") expr
   | Decl (var, expr) ->
-    Printf.printf "%sDecl(%s)\n" indent var;
+    Printf.printf "%sDecl(%s)%s\n" indent var at;
     print_expr (indent ^ "  ") expr
   | If (cond, then_stmt, else_stmt) ->
-    Printf.printf "%sIf:\n" indent;
+    Printf.printf "%sIf:%s\n" indent at;
     Printf.printf "%s  Condition\n" indent;
     print_expr (indent ^ "    ") cond;
     Printf.printf "%s  Then\n" indent;
@@ -70,22 +80,22 @@ let rec print_stmt indent stmt =
        print_stmt (indent ^ "    ") s
      | None -> ())
   | While (cond, body) ->
-    Printf.printf "%sWhile\n" indent;
+    Printf.printf "%sWhile%s\n" indent at;
     Printf.printf "%s  Condition\n" indent;
     print_expr (indent ^ "    ") cond;
     Printf.printf "%s  Body\n" indent;
     print_stmt (indent ^ "    ") body
   | Return expr_opt ->
-    Printf.printf "%sReturn\n" indent;
+    Printf.printf "%sReturn%s\n" indent at;
     (match expr_opt with
      | Some expr -> print_expr (indent ^ "  ") expr
      | None -> Printf.printf "%s  (void)\n" indent)
   | ExprStmt expr ->
-    Printf.printf "%sExprStmt\n" indent;
+    Printf.printf "%sExprStmt%s\n" indent at;
     print_expr (indent ^ "  ") expr
-  | Break -> Printf.printf "%sBreak\n" indent
-  | Continue -> Printf.printf "%sContinue\n" indent
-  | EmptyStmt -> Printf.printf "%sEmptyStmt\n" indent
+  | Break -> Printf.printf "%sBreak%s\n" indent at
+  | Continue -> Printf.printf "%sContinue%s\n" indent at
+  | EmptyStmt -> Printf.printf "%sEmptyStmt%s\n" indent at
 ;;
 
 
@@ -94,11 +104,12 @@ let print_ast ast =
   List.iter
     (fun func ->
        Printf.printf
-         "Function %s (returns %s)\n"
+         "Function %s (returns %s)%s\n"
          func.fname
          (match func.rtype with
           | Int -> "int"
-          | Void -> "void");
+          | Void -> "void")
+         (loc_suffix func.floc);
        Printf.printf "Parameters [%s]\n" (String.concat "; " func.params);
        Printf.printf "Body\n";
        print_stmt "  " func.body;
@@ -118,16 +129,17 @@ let check_program ast =
          if func.params <> [] then failwith "Main function cannot take parameters");
        let rec check_returns stmt_list =
          List.iter
-           (function
-             | Ast.Return (Some _) when func.rtype = Void ->
-               failwith "Void function cannot return a value"
-             | Ast.Return None when func.rtype = Int ->
-               failwith "Int function must return a value"
-             | Ast.Block stmts -> check_returns stmts
-             | Ast.If (_, then_stmt, Some else_stmt) ->
-               check_returns [ then_stmt; else_stmt ]
-             | Ast.If (_, then_stmt, None) -> check_returns [ then_stmt ]
-             | _ -> ()) 
+           (fun stmt ->
+              match stmt.sdesc with
+              | Ast.Return (Some _) when func.rtype = Void ->
+                failwith "Void function cannot return a value"
+              | Ast.Return None when func.rtype = Int ->
+                failwith "Int function must return a value"
+              | Ast.Block stmts -> check_returns stmts
+              | Ast.If (_, then_stmt, Some else_stmt) ->
+                check_returns [ then_stmt; else_stmt ]
+              | Ast.If (_, then_stmt, None) -> check_returns [ then_stmt ]
+              | _ -> ()) 
            stmt_list
        in
        check_returns [ func.body ])
@@ -162,6 +174,10 @@ let parse_stdin () =
 (* ==== Main Entry ==== *)
 
 let () =
+  Arg.parse
+    [ "--loc", Arg.Set print_loc, " Append source positions (@line:col) to AST nodes" ]
+    (fun _ -> ())
+    "Usage: front [--loc] < input.tc";
   try
     let ast = parse_stdin () in
     print_ast ast;
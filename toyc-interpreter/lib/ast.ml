@@ -6,14 +6,30 @@ type binop =
 type unop = 
   | Neg | Not
 
-type expr = 
+(* Source position: 1-based line and column *)
+type loc = {
+  line: int;
+  col: int;
+}
+
+type expr = {
+  edesc: expr_desc;
+  eloc: loc;
+}
+
+and expr_desc =
   | IntLit of int
   | Var of string
   | Binop of expr * binop * expr
   | Unop of unop * expr
   | Call of string * expr list
 
-type stmt = 
+type stmt = {
+  sdesc: stmt_desc;
+  sloc: loc;
+}
+
+and stmt_desc =
   | Block of stmt list 
   | EmptyStmt
   | ExprStmt of expr
@@ -32,6 +48,7 @@ type func_def = {
   rtype: ret_type;
   params: string list;
   body: stmt;
+  floc: loc;
 }
 
 type program = func_def list
\ No newline at end of file